@@ -0,0 +1,110 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_aho_corasick.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+
+namespace re2 {
+
+AhoCorasick::AhoCorasick(const std::vector<std::string> &literals,
+                         bool ascii_fold) {
+  for (int c = 0; c < 256; c++) {
+    fold[c] = (ascii_fold && 'A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+  }
+
+  // Build the trie with ordered maps, then flatten it.
+  std::vector<std::map<uint8_t, int>> trie(1);
+  literal_at.assign(1, -1);
+  same_literal.assign(literals.size(), -1);
+  for (size_t id = 0; id < literals.size(); id++) {
+    int state = 0;
+    for (char ch : literals[id]) {
+      uint8_t c = fold[static_cast<uint8_t>(ch)];
+      auto edge = trie[state].find(c);
+      if (edge != trie[state].end()) {
+        state = edge->second;
+        continue;
+      }
+      int child = static_cast<int>(trie.size());
+      trie[state][c] = child;
+      trie.emplace_back();
+      literal_at.push_back(-1);
+      state = child;
+    }
+    same_literal[id] = literal_at[state];
+    literal_at[state] = static_cast<int>(id);
+  }
+
+  size_t nstates = trie.size();
+  edge_begin.assign(nstates + 1, 0);
+  for (size_t s = 0; s < nstates; s++) {
+    edge_begin[s + 1] = edge_begin[s] + static_cast<int>(trie[s].size());
+    for (auto &edge : trie[s]) {
+      labels.push_back(edge.first);
+      targets.push_back(edge.second);
+    }
+  }
+  std::fill(root_next, root_next + 256, 0);
+  for (auto &edge : trie[0]) {
+    root_next[edge.first] = edge.second;
+  }
+  trie.clear();
+
+  // Failure and output links, breadth first from the root.
+  fail.assign(nstates, 0);
+  out_link.assign(nstates, -1);
+  std::deque<int> queue;
+  for (int e = edge_begin[0]; e < edge_begin[1]; e++) {
+    queue.push_back(targets[e]);
+  }
+  while (!queue.empty()) {
+    int state = queue.front();
+    queue.pop_front();
+    for (int e = edge_begin[state]; e < edge_begin[state + 1]; e++) {
+      int child = targets[e];
+      int f = next(fail[state], labels[e]);
+      fail[child] = f;
+      out_link[child] = literal_at[f] >= 0 ? f : out_link[f];
+      queue.push_back(child);
+    }
+  }
+}
+
+// Goto function of the automaton: follows failure links until state
+// has an edge labelled c.
+int AhoCorasick::next(int state, uint8_t c) const {
+  while (state != 0) {
+    const uint8_t *begin = labels.data() + edge_begin[state];
+    const uint8_t *end = labels.data() + edge_begin[state + 1];
+    const uint8_t *edge = std::lower_bound(begin, end, c);
+    if (edge != end && *edge == c) {
+      return targets[edge - labels.data()];
+    }
+    state = fail[state];
+  }
+  return root_next[c];
+}
+
+void AhoCorasick::find(const StringPiece &text, std::vector<int> *found) const {
+  size_t first = found->size();
+  for (int id = literal_at[0]; id >= 0; id = same_literal[id]) {
+    found->push_back(id); // empty literal
+  }
+  int state = 0;
+  for (char ch : text) {
+    state = next(state, fold[static_cast<uint8_t>(ch)]);
+    int match = literal_at[state] >= 0 ? state : out_link[state];
+    for (; match > 0; match = out_link[match]) {
+      for (int id = literal_at[match]; id >= 0; id = same_literal[id]) {
+        found->push_back(id);
+      }
+    }
+  }
+  std::sort(found->begin() + first, found->end());
+  found->erase(std::unique(found->begin() + first, found->end()),
+               found->end());
+}
+
+} // namespace re2
@@ -0,0 +1,48 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_AHO_CORASICK_H_
+#define RE2_AHO_CORASICK_H_
+
+#include <re2/re2.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace re2 {
+
+// Aho-Corasick automaton over bytes. Finds all the given literals that
+// occur in a text in a single pass. With ascii_fold, ASCII letters in
+// the text are lowercased before matching; the literals are expected to
+// be lowercase already (as the atoms returned by FilteredRE2 are).
+//
+// Immutable after construction; find() may be called concurrently.
+class AhoCorasick {
+public:
+  AhoCorasick(const std::vector<std::string> &literals, bool ascii_fold);
+
+  // Appends to found the indices of the literals occurring in text,
+  // sorted and without duplicates.
+  void find(const StringPiece &text, std::vector<int> *found) const;
+
+  // Number of states of the automaton.
+  size_t num_states() const { return literal_at.size(); }
+
+private:
+  int next(int state, uint8_t c) const;
+
+  // Trie edges in compressed sparse row form: the edges of state s are
+  // labels[edge_begin[s]..edge_begin[s+1]), sorted by label.
+  std::vector<int> edge_begin;
+  std::vector<uint8_t> labels;
+  std::vector<int> targets;
+  int root_next[256]; // dense transitions out of the root (0 if none)
+  std::vector<int> fail;
+  std::vector<int> literal_at;   // a literal ending at the state, or -1
+  std::vector<int> same_literal; // next literal with the same text, or -1
+  std::vector<int> out_link;     // nearest suffix state with a literal, or -1
+  uint8_t fold[256];
+};
+
+} // namespace re2
+#endif
@@ -0,0 +1,183 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_cache.h"
+#include <Rcpp.h>
+#include <re2/re2.h>
+
+using namespace Rcpp;
+
+namespace {
+// Cache key: the options, followed by the pattern text. Every option
+// that influences parsing, compilation or matching is part of the key.
+std::string cache_key(const std::string &pattern,
+                      const RE2::Options &options) {
+  std::string key;
+  key.reserve(pattern.size() + 32);
+  key += options.encoding() == RE2::Options::EncodingUTF8 ? 'U' : 'L';
+  const bool flags[] = {options.posix_syntax(),   options.longest_match(),
+                        options.log_errors(),     options.literal(),
+                        options.never_nl(),       options.dot_nl(),
+                        options.never_capture(),  options.case_sensitive(),
+                        options.perl_classes(),   options.word_boundary(),
+                        options.one_line()};
+  for (bool flag : flags) {
+    key += flag ? '1' : '0';
+  }
+  key += std::to_string(options.max_mem());
+  key += ',';
+  key += std::to_string(options.bit_state_max_mem());
+  key += ',';
+  key += std::to_string(options.one_pass_max_text());
+  key += ':';
+  key += pattern;
+  return key;
+}
+} // namespace
+
+namespace re2 {
+
+RE2Cache &RE2Cache::instance() {
+  static RE2Cache cache;
+  return cache;
+}
+
+std::shared_ptr<const RE2> RE2Cache::get(const std::string &pattern,
+                                         const RE2::Options &options) {
+  std::string key = cache_key(pattern, options);
+  auto found = index.find(key);
+  if (found != index.end()) {
+    _hits++;
+    lru.splice(lru.begin(), lru, found->second);
+    return found->second->re2p;
+  }
+
+  _misses++;
+  std::shared_ptr<const RE2> re2p = std::make_shared<RE2>(pattern, options);
+  if (!(re2p->ok())) {
+    throw std::invalid_argument(re2p->error());
+  }
+  int program_size = re2p->ProgramSize();
+  if (_max_size == 0 || program_size > _max_program_size) {
+    return re2p; // would evict everything else; do not cache
+  }
+  lru.push_front(Entry{key, re2p, program_size, false, nullptr});
+  index.emplace(std::move(key), lru.begin());
+  total_program_size += program_size;
+  evict();
+  return re2p;
+}
+
+std::shared_ptr<const RE2> RE2Cache::ascii_twin(
+    const std::string &pattern, const RE2::Options &options,
+    const std::function<std::shared_ptr<const RE2>()> &make_twin) {
+  auto found = index.find(cache_key(pattern, options));
+  if (found == index.end()) {
+    return nullptr;
+  }
+  Entry &entry = *found->second;
+  std::shared_ptr<const RE2> twin = entry.twin;
+  if (!entry.twin_checked) {
+    entry.twin_checked = true;
+    entry.twin = twin = make_twin();
+    if (twin) {
+      int program_size = twin->ProgramSize();
+      entry.program_size += program_size;
+      total_program_size += program_size;
+      // The entry was just used, so evict others first; with the twin
+      // it may still be over the limit on its own and go too, so the
+      // twin is returned from our own reference.
+      lru.splice(lru.begin(), lru, found->second);
+      evict();
+    }
+  }
+  return twin;
+}
+
+void RE2Cache::evict() {
+  while (!lru.empty() && (lru.size() > _max_size ||
+                          total_program_size > _max_program_size)) {
+    Entry &last = lru.back();
+    total_program_size -= last.program_size;
+    index.erase(last.key);
+    lru.pop_back(); // callers may still hold the shared_ptr
+    _evictions++;
+  }
+}
+
+void RE2Cache::clear() {
+  index.clear();
+  lru.clear();
+  total_program_size = 0;
+}
+
+void RE2Cache::set_limits(size_t max_size, int64_t max_program_size) {
+  _max_size = max_size;
+  _max_program_size = max_program_size;
+  evict();
+}
+
+} // namespace re2
+
+//' Cache of compiled character patterns
+//'
+//' @description
+//' Character string patterns passed to re2 functions are compiled once
+//'   and kept in a least-recently-used cache, keyed by pattern and
+//'   options. Later calls with the same pattern reuse the compiled
+//'   regular expression. Patterns compiled with \code{\link{re2_regexp}}
+//'   are not cached; they are owned by the returned object.
+//'
+//' \code{re2_cache_info} returns cache statistics. \code{re2_cache_clear}
+//'   removes all entries. \code{re2_cache_limits} changes the maximum
+//'   number of entries and the maximum sum of program sizes (number of
+//'   compiled instructions) of the cached patterns. Least recently used
+//'   entries are evicted when either limit is exceeded. A \code{max_size}
+//'   of 0 disables caching.
+//'
+//' @param max_size Maximum number of cached patterns (default 1000).
+//' @param max_program_size Maximum sum of program sizes of cached
+//'   patterns (default 1048576).
+//'
+//' @return A list with elements \code{size}, \code{program_size},
+//'   \code{hits}, \code{misses}, \code{evictions}, \code{max_size} and
+//'   \code{max_program_size}.
+//'
+//' @example inst/examples/cache.R
+//'
+//' @seealso
+//'   \code{\link{re2_regexp}} to compile a pattern explicitly.
+//'
+// [[Rcpp::export]]
+List re2_cache_info() {
+  re2::RE2Cache &cache = re2::RE2Cache::instance();
+  return List::create(
+      Named("size") = static_cast<double>(cache.size()),
+      Named("program_size") = static_cast<double>(cache.program_size()),
+      Named("hits") = static_cast<double>(cache.hits()),
+      Named("misses") = static_cast<double>(cache.misses()),
+      Named("evictions") = static_cast<double>(cache.evictions()),
+      Named("max_size") = static_cast<double>(cache.max_size()),
+      Named("max_program_size") =
+          static_cast<double>(cache.max_program_size()));
+}
+
+//' @rdname re2_cache_info
+// [[Rcpp::export]]
+List re2_cache_clear() {
+  re2::RE2Cache::instance().clear();
+  return re2_cache_info();
+}
+
+//' @rdname re2_cache_info
+// [[Rcpp::export]]
+List re2_cache_limits(double max_size, double max_program_size) {
+  if (!(max_size >= 0) || !(max_program_size >= 0)) {
+    throw std::invalid_argument("cache limits must be non-negative");
+  }
+  re2::RE2Cache::instance().set_limits(
+      max_size > SIZE_MAX ? SIZE_MAX : static_cast<size_t>(max_size),
+      max_program_size > INT64_MAX ? INT64_MAX
+                                   : static_cast<int64_t>(max_program_size));
+  return re2_cache_info();
+}
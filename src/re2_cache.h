@@ -0,0 +1,80 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_CACHE_H_
+#define RE2_CACHE_H_
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+namespace re2 {
+
+// Bounded LRU cache of compiled RE2 objects, keyed by pattern text and
+// RE2::Options. Character patterns passed to the matching functions are
+// compiled through the cache, so repeated calls with the same pattern do
+// not parse and compile it again. Entries are evicted when either the
+// number of entries or the sum of their ProgramSize() exceeds its limit.
+//
+// Only accessed from the R main thread; not thread-safe.
+class RE2Cache {
+public:
+  static RE2Cache &instance();
+
+  // Returns the compiled pattern, compiling it on a miss. Throws
+  // std::invalid_argument if the pattern does not compile. Patterns that
+  // fail to compile are not cached.
+  std::shared_ptr<const RE2> get(const std::string &pattern,
+                                 const RE2::Options &options);
+
+  // Returns the ASCII twin of the cached pattern (see
+  // RE2Proxy::Adapter::prepare_ascii), or NULL if it has none. The twin is
+  // made by make_twin, which returns NULL to reject it, the first time it
+  // is asked for; the verdict is kept with the pattern's entry, and an
+  // accepted twin counts towards its program size. Twins are neither
+  // cache hits nor misses. A pattern that is not cached gets no twin.
+  std::shared_ptr<const RE2>
+  ascii_twin(const std::string &pattern, const RE2::Options &options,
+             const std::function<std::shared_ptr<const RE2>()> &make_twin);
+
+  void clear();
+  void set_limits(size_t max_size, int64_t max_program_size);
+
+  size_t size() const { return lru.size(); }
+  int64_t program_size() const { return total_program_size; }
+  size_t max_size() const { return _max_size; }
+  int64_t max_program_size() const { return _max_program_size; }
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+  uint64_t evictions() const { return _evictions; }
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const RE2> re2p;
+    int program_size;
+    bool twin_checked;
+    std::shared_ptr<const RE2> twin;
+  };
+  typedef std::list<Entry> LRUList;
+
+  RE2Cache() {}
+  void evict();
+
+  LRUList lru; // most recently used first
+  std::unordered_map<std::string, LRUList::iterator> index;
+  int64_t total_program_size = 0;
+  size_t _max_size = 1000;
+  int64_t _max_program_size = 1 << 20;
+  uint64_t _hits = 0;
+  uint64_t _misses = 0;
+  uint64_t _evictions = 0;
+};
+
+} // namespace re2
+#endif
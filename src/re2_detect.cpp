@@ -1,12 +1,126 @@
 // Copyright (c) 2021 Girish Palya
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
+#include "re2_parallel.h"
 #include "re2_re2proxy.h"
+#include "re2_string.h"
 #include <Rcpp.h>
+#include <map>
+#include <mutex>
 #include <re2/re2.h>
+#include <vector>
 
 using namespace Rcpp;
 
+namespace {
+
+const R_xlen_t kBatch = 1024;
+
+// Match texts[begin, end) against the pattern(s) and call emit(i, result)
+// for each element in order, where result is TRUE, FALSE or NA_LOGICAL.
+// A NULL view is an NA element. A single pattern goes to RE2::MatchBatch
+// a batch at a time. Elements flagged in ascii use the pattern's Latin-1
+// twin, if any. Runs on worker threads, so it must not touch the R API:
+// the caller gathers texts and ascii with gather_texts() and calls
+// re2proxy.prepare_ascii() first.
+template <typename Emit>
+void detect_range(const re2::StringPiece *texts, const char *ascii,
+                  re2::RE2Proxy &re2proxy, R_xlen_t begin, R_xlen_t end,
+                  Emit emit) {
+  bool matched[kBatch];
+  for (R_xlen_t i = begin; i < end; i += kBatch) {
+    R_xlen_t m = std::min(kBatch, end - i);
+    R_xlen_t nascii = 0;
+    for (R_xlen_t j = 0; j < m; j++) {
+      nascii += ascii[i + j];
+    }
+    if (re2proxy.size() == 1 &&
+        (nascii == 0 || nascii == m || !re2proxy[0].has_ascii_twin())) {
+      re2proxy[0].get(nascii == m).MatchBatch(texts + i, m, matched);
+    } else {
+      for (R_xlen_t j = 0; j < m; j++) {
+        const re2::StringPiece &text = texts[i + j];
+        int re_idx = (i + j) % re2proxy.size();
+        matched[j] = re2proxy[re_idx].get(ascii[i + j] != 0).Match(
+            text, 0, text.size(), RE2::UNANCHORED, nullptr, 0);
+      }
+    }
+    for (R_xlen_t j = 0; j < m; j++) {
+      emit(i + j, texts[i + j].data() == NULL ? NA_LOGICAL : matched[j]);
+    }
+  }
+}
+
+// Views of the elements of string and their ASCII flags, read on the
+// calling thread. NA elements get a NULL view and are not ASCII.
+void gather_texts(StringVector &string, std::vector<re2::StringPiece> &texts,
+                  std::vector<char> &ascii) {
+  R_xlen_t n = string.size();
+  texts.assign(n, re2::StringPiece());
+  ascii.assign(n, 0);
+  for (R_xlen_t i = 0; i < n; i++) {
+    SEXP elt = STRING_ELT(string, i);
+    if (elt != NA_STRING) {
+      texts[i] = re2::as_string_piece(elt);
+      ascii[i] = IS_ASCII(elt) != 0;
+    }
+  }
+}
+
+void warn_recycling(R_xlen_t n, re2::RE2Proxy &re2proxy) {
+  if ((n % re2proxy.size()) != 0) {
+    Rcerr << "Warning: string vector length is not a "
+             "multiple of pattern vector length"
+          << '\n';
+  }
+}
+
+// Indices of the elements of string that match pattern (or that do not,
+// if negate), in increasing order. NA elements are never selected. Each
+// thread collects the indices of its own range, so no per-element result
+// buffer is needed.
+std::vector<R_xlen_t> which_matches(StringVector string, SEXP pattern,
+                                    bool negate, SEXP nthreads) {
+  re2::RE2Proxy re2proxy(pattern);
+  R_xlen_t n = string.size();
+  warn_recycling(n, re2proxy);
+  std::vector<re2::StringPiece> texts;
+  std::vector<char> ascii;
+  gather_texts(string, texts, ascii);
+  re2proxy.prepare_ascii(STRING_PTR_RO(string), n);
+
+  std::mutex mu;
+  std::map<R_xlen_t, std::vector<R_xlen_t>> parts; // by range begin
+  re2::parallel_for(
+      n, re2::nthreads_option(nthreads), [&](R_xlen_t begin, R_xlen_t end) {
+        std::vector<R_xlen_t> found;
+        detect_range(texts.data(), ascii.data(), re2proxy, begin, end,
+                     [&found, negate](R_xlen_t i, int result) {
+                       if (result != NA_LOGICAL && (result != 0) != negate) {
+                         found.push_back(i);
+                       }
+                     });
+        std::lock_guard<std::mutex> lock(mu);
+        parts[begin].swap(found);
+      });
+
+  if (parts.size() == 1) {
+    return std::move(parts.begin()->second);
+  }
+  std::vector<R_xlen_t> res;
+  size_t total = 0;
+  for (const auto &part : parts) {
+    total += part.second.size();
+  }
+  res.reserve(total);
+  for (const auto &part : parts) {
+    res.insert(res.end(), part.second.begin(), part.second.end());
+  }
+  return res;
+}
+
+} // namespace
+
 //' Find the presence of a pattern in string(s)
 //'
 //' @description
@@ -26,32 +140,23 @@ using namespace Rcpp;
 //'   \code{\link{re2_match}} to extract matched groups.
 //'
 // [[Rcpp::export]]
-LogicalVector re2_detect(StringVector string, SEXP pattern) {
+LogicalVector re2_detect(StringVector string, SEXP pattern,
+                         SEXP nthreads = R_NilValue) {
   re2::RE2Proxy re2proxy(pattern);
-  StringVector &vstring = string;
-  LogicalVector result(vstring.size());
-
-  if ((vstring.size() % re2proxy.size()) != 0) {
-    Rcerr << "Warning: string vector length is not a "
-             "multiple of pattern vector length"
-          << '\n';
-  }
-
-  for (int i = 0; i < vstring.size(); i++) {
-    if (vstring(i) == NA_STRING) {
-      result(i) = NA_LOGICAL;
-      continue;
-    }
-    int re_idx = i % re2proxy.size();
-    re2::StringPiece text(R_CHAR(vstring(i)));
-
-    if (re2proxy[re_idx].get().Match(text, 0, text.size(), RE2::UNANCHORED,
-                                     nullptr, 0)) {
-      result(i) = true;
-    } else {
-      result(i) = false;
-    }
-  }
+  R_xlen_t n = string.size();
+  warn_recycling(n, re2proxy);
+  LogicalVector result(n);
+  std::vector<re2::StringPiece> texts;
+  std::vector<char> ascii;
+  gather_texts(string, texts, ascii);
+  re2proxy.prepare_ascii(STRING_PTR_RO(string), n);
+  int *out = LOGICAL(result);
+  re2::parallel_for(n, re2::nthreads_option(nthreads),
+                    [&](R_xlen_t begin, R_xlen_t end) {
+                      detect_range(texts.data(), ascii.data(), re2proxy,
+                                   begin, end,
+                                   [out](R_xlen_t i, int r) { out[i] = r; });
+                    });
   return result;
 }
 
@@ -65,6 +170,8 @@ LogicalVector re2_detect(StringVector string, SEXP pattern) {
 //'   grepl(pattern, x) see \code{\link{re2_detect}}.
 //'
 //' @inheritParams re2_match
+//' @param negate If TRUE, select the strings that do not match instead.
+//'   NA strings are never selected.
 //'
 //' @return \code{re2_subset} returns a character vector, and \code{re2_which}
 //'   returns an integer vector.
@@ -77,26 +184,26 @@ LogicalVector re2_detect(StringVector string, SEXP pattern) {
 //'   \code{\link{re2_detect}} to find presence of a pattern (grep).
 //'
 // [[Rcpp::export]]
-IntegerVector re2_which(StringVector string, SEXP pattern) {
-  LogicalVector vec = re2_detect(string, pattern);
-  std::vector<int> res;
-  for (int i = 0; i < vec.size(); i++) {
-    if (vec(i) && vec(i) != NA_LOGICAL) {
-      res.push_back(i + 1);
-    }
+IntegerVector re2_which(StringVector string, SEXP pattern,
+                        SEXP nthreads = R_NilValue, bool negate = false) {
+  std::vector<R_xlen_t> idx = which_matches(string, pattern, negate, nthreads);
+  IntegerVector res(idx.size());
+  for (size_t k = 0; k < idx.size(); k++) {
+    res[k] = static_cast<int>(idx[k] + 1);
   }
-  return wrap(res);
+  return res;
 }
 
 //' @rdname re2_which
 // [[Rcpp::export]]
-StringVector re2_subset(StringVector string, SEXP pattern) {
-  LogicalVector vec = re2_detect(string, pattern);
-  std::vector<std::string> res;
-  for (int i = 0; i < vec.size(); i++) {
-    if (vec(i) && vec(i) != NA_LOGICAL) {
-      res.push_back(as<std::string>(string(i)));
-    }
+StringVector re2_subset(StringVector string, SEXP pattern,
+                        SEXP nthreads = R_NilValue, bool negate = false) {
+  std::vector<R_xlen_t> idx = which_matches(string, pattern, negate, nthreads);
+  StringVector res(idx.size());
+  for (size_t k = 0; k < idx.size(); k++) {
+    // The selected strings are the input's own CHARSXPs, so they keep
+    // their encoding and need no copying.
+    SET_STRING_ELT(res, k, STRING_ELT(string, idx[k]));
   }
-  return wrap(res);
+  return res;
 }
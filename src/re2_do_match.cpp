@@ -5,66 +5,235 @@
 #include <re2/re2.h>
 #include "re2_re2proxy.h"
 #include "re2_do_match.h"
+#include "re2_parallel.h"
+#include "re2_string.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
 
 using namespace Rcpp;
 
+namespace {
+// Elements matched by the worker threads before the callbacks are run
+// on the main thread. Bounds the memory held by pending matches.
+const R_xlen_t kParallelBlockSize = 1 << 16;
+
+// Size of the buffer files are read into. A record longer than the
+// buffer grows it.
+const size_t kFileBufferSize = 1 << 22;
+
+// Collect up to limit successive matches of re in text into arena, as
+// consecutive rows of nsubmatch StringPieces. Returns the number of
+// matches found. The arena is cleared but keeps its capacity.
+size_t find_matches(const RE2 &re, re2::StringPiece text, int nsubmatch,
+                    size_t limit, re2::MatchArena &arena) {
+  arena.clear();
+  size_t found = 0;
+  while (found < limit) {
+    size_t pos = arena.size();
+    arena.resize(pos + nsubmatch);
+    if (!re.Match(text, 0, text.size(), RE2::UNANCHORED, &arena[pos],
+                  nsubmatch)) {
+      arena.resize(pos);
+      break;
+    }
+    found++;
+    size_t consumed = static_cast<size_t>(arena[pos].end() - text.begin());
+    if (consumed == 0) {
+      break;
+    }
+    text.remove_prefix(consumed);
+  }
+  return found;
+}
+
+// Match texts[0..n) on nthreads threads. Text k is matched against
+// re2proxy[(first + k) % re2proxy.size()], and its matches are left in
+// matches[k]. A text with NULL data (NA) has no matches. If ascii is not
+// NULL, ascii[k] says whether R flags text k as ASCII.
+void find_all_matches(const re2::StringPiece *texts, const char *ascii,
+                      R_xlen_t n, R_xlen_t first, re2::RE2Proxy &re2proxy,
+                      const std::vector<int> &nsubmatch, size_t limit,
+                      int nthreads, std::vector<re2::MatchArena> &matches) {
+  if (matches.size() < static_cast<size_t>(n)) {
+    matches.resize(n);
+  }
+  re2::parallel_for(n, nthreads, [&](R_xlen_t begin, R_xlen_t end) {
+    for (R_xlen_t k = begin; k < end; k++) {
+      matches[k].clear();
+      if (texts[k].data() != NULL) {
+        int re_idx = (first + k) % re2proxy.size();
+        find_matches(re2proxy[re_idx].get(ascii != NULL && ascii[k]),
+                     texts[k], nsubmatch[re_idx], limit, matches[k]);
+      }
+    }
+  });
+}
+
+// Adapter caches lazily; fill the caches before the workers start.
+std::vector<int> all_nsubmatch(re2::RE2Proxy &re2proxy,
+                               re2::DoMatchIntf &doer) {
+  std::vector<int> nsubmatch(re2proxy.size());
+  for (int j = 0; j < re2proxy.size(); j++) {
+    nsubmatch[j] = doer.nsubmatch(re2proxy[j]);
+  }
+  return nsubmatch;
+}
+
+struct FileCloser {
+  void operator()(FILE *fp) const { fclose(fp); }
+};
+
+SEXP re2_do_match_parallel(StringVector &vstring, re2::RE2Proxy &re2proxy,
+                           re2::DoMatchIntf &doer, int nthreads) {
+  R_xlen_t n = vstring.size();
+  std::vector<re2::StringPiece> texts(n);
+  std::vector<char> ascii(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    SEXP elt = STRING_ELT(vstring, i);
+    if (elt != NA_STRING) {
+      texts[i] = re2::as_string_piece(elt);
+      ascii[i] = IS_ASCII(elt) != 0;
+    }
+  }
+  re2proxy.prepare_ascii(STRING_PTR_RO(vstring), n);
+  std::vector<int> nsubmatch = all_nsubmatch(re2proxy, doer);
+  size_t limit = doer.match_limit();
+
+  std::vector<re2::MatchArena> matches;
+  for (R_xlen_t start = 0; start < n; start += kParallelBlockSize) {
+    R_xlen_t len = std::min(kParallelBlockSize, n - start);
+    find_all_matches(texts.data() + start, ascii.data() + start, len, start,
+                     re2proxy, nsubmatch, limit, nthreads, matches);
+
+    for (R_xlen_t k = 0; k < len; k++) {
+      R_xlen_t i = start + k;
+      int re_idx = i % re2proxy.size();
+      if (matches[k].empty()) {
+        doer.match_not_found(i, vstring(i), re2proxy[re_idx]);
+        continue;
+      }
+      re2::AllMatches all_matches(matches[k].data(),
+                                  matches[k].size() / nsubmatch[re_idx],
+                                  nsubmatch[re_idx]);
+      doer.match_found(i, texts[i], re2proxy[re_idx], all_matches);
+    }
+  }
+  return doer.get();
+}
+} // namespace
+
 SEXP re2_do_match(StringVector string, SEXP pattern,
-		  re2::DoMatchIntf &doer) {
+		  re2::DoMatchIntf &doer, int nthreads) {
   re2::RE2Proxy re2proxy(pattern);
-  return re2_do_match(string, re2proxy, doer);
+  return re2_do_match(string, re2proxy, doer, nthreads);
 }
 
 SEXP re2_do_match(StringVector string, re2::RE2Proxy &re2proxy,
-		  re2::DoMatchIntf &doer) {
+		  re2::DoMatchIntf &doer, int nthreads) {
   StringVector& vstring = string;
   if ((vstring.size() % re2proxy.size()) != 0) {
     Rcerr << "Warning: string vector length is not a "
       "multiple of pattern vector length" << '\n';
   }
-    
+
+  if (nthreads > 1) {
+    return re2_do_match_parallel(vstring, re2proxy, doer, nthreads);
+  }
+
+  size_t limit = doer.match_limit();
+  re2::MatchArena arena;
   for (int i = 0; i < vstring.size(); i++) {
     int re_idx = i % re2proxy.size();
-    
-    bool match_found = false;
-    if (vstring(i) != NA_STRING) {
-      re2::StringPiece text(R_CHAR(vstring(i)));
-      std::vector<re2::StringPiece*> all_matches;
-
-      int nsubmatch = re2proxy[re_idx].nsubmatch();
-
-      size_t consumed;
-      while (true) {
-	if (!doer.proceed()) {
-	  break;
-	}
-	re2::StringPiece *submatch = new re2::StringPiece[nsubmatch];
-	if (re2proxy[re_idx].get().Match(text, 0, text.size(), RE2::UNANCHORED,
-				 submatch, nsubmatch)) {
-	  all_matches.push_back(submatch);
-	  consumed = static_cast<size_t>(submatch[0].end() - text.begin());
-	  if (consumed == 0) {
-	    break;
-	  }
-	  text.remove_prefix(consumed);
-	} else {
-	  delete[] submatch;
-	  break;
-	}
+
+    if (vstring(i) == NA_STRING) {
+      doer.match_not_found(i, vstring(i), re2proxy[re_idx]);
+      continue;
+    }
+    SEXP elt = vstring(i);
+    re2::StringPiece text = re2::as_string_piece(elt);
+    int nsubmatch = doer.nsubmatch(re2proxy[re_idx]);
+    bool ascii = IS_ASCII(elt) != 0;
+    if (ascii) {
+      re2proxy[re_idx].prepare_ascii();
+    }
+    size_t nmatches = find_matches(re2proxy[re_idx].get(ascii), text,
+                                   nsubmatch, limit, arena);
+    if (nmatches == 0) {
+      doer.match_not_found(i, vstring(i), re2proxy[re_idx]);
+    } else {
+      re2::AllMatches all_matches(arena.data(), nmatches, nsubmatch);
+      doer.match_found(i, text, re2proxy[re_idx], all_matches);
+    }
+  }
+  return doer.get();
+}
+
+SEXP re2_do_match_file(const std::string &path, char delimiter,
+                       re2::RE2Proxy &re2proxy, re2::DoMatchIntf &doer,
+                       int nthreads) {
+  std::unique_ptr<FILE, FileCloser> fp(
+      fopen(R_ExpandFileName(path.c_str()), "rb"));
+  if (!fp) {
+    const char *fmt = "Cannot open file: [file=%s].";
+    throw ::Rcpp::not_compatible(fmt, path.c_str());
+  }
+  std::vector<int> nsubmatch = all_nsubmatch(re2proxy, doer);
+  size_t limit = doer.match_limit();
+
+  std::vector<char> buffer(kFileBufferSize);
+  size_t len = 0;      // bytes in buffer
+  R_xlen_t record = 0; // number of the first record in buffer
+  bool eof = false;
+  std::vector<re2::StringPiece> records;
+  std::vector<re2::MatchArena> matches;
+  while (!eof) {
+    len += fread(buffer.data() + len, 1, buffer.size() - len, fp.get());
+    if (ferror(fp.get())) {
+      const char *fmt = "Error reading file: [file=%s].";
+      throw ::Rcpp::not_compatible(fmt, path.c_str());
+    }
+    eof = feof(fp.get()) != 0;
+
+    // Split the complete records; keep the incomplete tail for later.
+    records.clear();
+    const char *begin = buffer.data();
+    const char *end = begin + len;
+    const char *p = begin;
+    while (p < end) {
+      const char *next =
+          static_cast<const char *>(memchr(p, delimiter, end - p));
+      if (next == NULL) {
+        break;
       }
+      records.emplace_back(p, next - p);
+      p = next + 1;
+    }
+    if (eof && p < end) {
+      records.emplace_back(p, end - p); // no trailing delimiter
+      p = end;
+    }
 
-      if (!all_matches.empty()) {
-	text.set(R_CHAR(vstring(i))); // reset
-	doer.match_found(i, text, re2proxy[re_idx], all_matches);
-	match_found = true;
-	// delete heap vector
-	for(const re2::StringPiece* sp_arr : all_matches) {
-	  delete[] sp_arr;
-	}
+    find_all_matches(records.data(), NULL, records.size(), record, re2proxy,
+                     nsubmatch, limit, nthreads, matches);
+    for (size_t k = 0; k < records.size(); k++) {
+      if (!matches[k].empty()) {
+        int re_idx = (record + k) % re2proxy.size();
+        re2::AllMatches all_matches(matches[k].data(),
+                                    matches[k].size() / nsubmatch[re_idx],
+                                    nsubmatch[re_idx]);
+        doer.match_found(record + k, records[k], re2proxy[re_idx],
+                         all_matches);
       }
     }
+    record += records.size();
 
-    if (vstring(i) == NA_STRING || !match_found) {
-      doer.match_not_found(i, vstring(i), re2proxy[re_idx]);
+    size_t consumed = p - begin;
+    if (consumed == 0 && len == buffer.size()) {
+      buffer.resize(buffer.size() * 2);
+    } else {
+      memmove(buffer.data(), p, len - consumed);
+      len -= consumed;
     }
   }
   return doer.get();
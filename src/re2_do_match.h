@@ -6,29 +6,78 @@
 
 #include <Rcpp.h>
 #include <re2/re2.h>
+#include <stdint.h>
 #include "re2_re2proxy.h"
 
 using namespace Rcpp;
 
 namespace re2 {
-  typedef std::vector<re2::StringPiece*> AllMatches;
+  // Growable buffer of submatches, reused from element to element so
+  // that matching does not allocate once the buffer is large enough.
+  typedef std::vector<re2::StringPiece> MatchArena;
+
+  // Read-only view of all the matches found in one element: size() rows
+  // of nsubmatch() StringPieces each, stored contiguously in a
+  // MatchArena. Row 0 is the first (leftmost) match.
+  class AllMatches {
+  public:
+    AllMatches(const re2::StringPiece *data, size_t size, int nsubmatch)
+        : _data(data), _size(size), _nsubmatch(nsubmatch) {}
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    int nsubmatch() const { return _nsubmatch; }
+    const re2::StringPiece *at(size_t row) const {
+      if (row >= _size) {
+        throw std::out_of_range("AllMatches: row out of range");
+      }
+      return _data + row * _nsubmatch;
+    }
+    const re2::StringPiece *operator[](size_t row) const {
+      return _data + row * _nsubmatch;
+    }
+
+  private:
+    const re2::StringPiece *_data;
+    size_t _size;
+    int _nsubmatch;
+  };
   typedef std::vector<std::string> StringVector;
 
+  // Callbacks invoked by re2_do_match() for every element of the string
+  // vector. Callbacks are always invoked from the R main thread, in
+  // element order, even when matching itself runs on worker threads.
   struct DoMatchIntf {
-    virtual void match_found(int i,
+    virtual void match_found(R_xlen_t i,
 			     re2::StringPiece &text,
 			     re2::RE2Proxy::Adapter &re2,
 			     const AllMatches &all_matches) = 0;
-    virtual void match_not_found(int i,
+    virtual void match_not_found(R_xlen_t i,
 				 SEXP text,
 				 re2::RE2Proxy::Adapter &re2) = 0;
-    virtual bool proceed() { return true; };
+    // Number of submatches the callbacks look at. Defaults to all the
+    // capturing groups plus the overall match. Callbacks that only need
+    // match boundaries return 1: RE2 then finds group 0 with the DFA
+    // alone and skips the slower submatch engines (OnePass, BitState,
+    // NFA).
+    virtual int nsubmatch(re2::RE2Proxy::Adapter &re2) {
+      return re2.nsubmatch();
+    }
+    // Maximum number of successive matches to collect per element.
+    virtual size_t match_limit() { return SIZE_MAX; }
     virtual SEXP get() = 0;
   };
 }
 
-SEXP re2_do_match(StringVector string, SEXP pattern, re2::DoMatchIntf &doer);
+SEXP re2_do_match(StringVector string, SEXP pattern, re2::DoMatchIntf &doer,
+		  int nthreads = 1);
 SEXP re2_do_match(StringVector string, re2::RE2Proxy &re2proxy,
-		  re2::DoMatchIntf &doer);
+		  re2::DoMatchIntf &doer, int nthreads = 1);
+// Match the records of a file, separated by delimiter, without reading
+// the whole file into memory. The file is read in fixed size buffers
+// and records are matched in place. Only match_found() is called, with
+// the 0-based record number as index.
+SEXP re2_do_match_file(const std::string &path, char delimiter,
+                       re2::RE2Proxy &re2proxy, re2::DoMatchIntf &doer,
+                       int nthreads = 1);
 
 #endif
@@ -2,6 +2,7 @@
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
 #include "re2_re2proxy.h"
+#include "re2_string.h"
 #include <Rcpp.h>
 #include <re2/re2.h>
 
@@ -66,7 +67,7 @@ SEXP re2_extract_replace_cpp(StringVector string, SEXP pattern,
       continue;
     }
 
-    re2::StringPiece strpc(R_CHAR(string(i)));
+    re2::StringPiece strpc = re2::as_string_piece(string(i));
     std::string outstr;
     lv[i] = RE2::Extract(strpc, re2proxy[re_idx].get(), rewrite, &outstr);
     outv[i] = outstr;
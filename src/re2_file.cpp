@@ -0,0 +1,192 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_do_match.h"
+#include "re2_parallel.h"
+#include "re2_re2proxy.h"
+#include "re2_result.h"
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace Rcpp;
+
+namespace {
+char checked_delimiter(const std::string &delimiter) {
+  if (delimiter.size() != 1) {
+    const char *fmt = "Expecting a single byte delimiter: [delimiter=%s].";
+    throw ::Rcpp::not_compatible(fmt, delimiter.c_str());
+  }
+  return delimiter[0];
+}
+
+void check_single_pattern(re2::RE2Proxy &re2proxy) {
+  if (re2proxy.size() != 1) {
+    throw ::Rcpp::not_compatible("Expecting a single pattern");
+  }
+}
+
+struct DoFileWhich : re2::DoMatchIntf {
+  std::vector<double> records;
+  int nsubmatch(re2::RE2Proxy::Adapter &re2) { return 1; }
+  size_t match_limit() { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    records.push_back(i + 1);
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {}
+  SEXP get() { return wrap(records); }
+};
+
+struct DoFileCount : re2::DoMatchIntf {
+  std::vector<double> records;
+  std::vector<double> counts;
+  int nsubmatch(re2::RE2Proxy::Adapter &re2) { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    records.push_back(i + 1);
+    counts.push_back(all_matches.size());
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {}
+  SEXP get() {
+    NumericMatrix result(records.size(), 2);
+    std::copy(records.begin(), records.end(), result.begin());
+    std::copy(counts.begin(), counts.end(), result.begin() + records.size());
+    std::vector<std::string> cnames = {"record", "count"};
+    colnames(result) = wrap(cnames);
+    return result;
+  }
+};
+
+struct DoFileMatch : re2::DoMatchIntf {
+  bool all;
+  StringVector group_names;
+  std::vector<double> records;
+  // The buffer a record is matched in is reused, so the text of each
+  // matching record, from its first match to the end of its last, is
+  // copied to text. Row k of the result has its submatches at byte
+  // offsets bounds[2 * k * ncol, ...) from text[base[k]]; a negative
+  // begin is NA.
+  std::string text;
+  std::vector<size_t> base;
+  std::vector<int32_t> bounds;
+  DoFileMatch(bool all, re2::RE2Proxy::Adapter &re2)
+      : all(all), group_names(wrap(re2.group_names())) {}
+  size_t match_limit() { return all ? SIZE_MAX : 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &record,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    const char *from = all_matches[0][0].data();
+    const char *to = all_matches[all_matches.size() - 1][0].end();
+    size_t start = text.size();
+    text.append(from, to - from);
+    for (size_t row = 0; row < all_matches.size(); row++) {
+      const re2::StringPiece *sp_arr = all_matches[row];
+      records.push_back(i + 1);
+      base.push_back(start);
+      for (int col = 0; col < all_matches.nsubmatch(); col++) {
+        const re2::StringPiece &sp = sp_arr[col];
+        int32_t begin =
+            sp.data() == NULL ? -1 : static_cast<int32_t>(sp.data() - from);
+        bounds.push_back(begin);
+        bounds.push_back(begin + static_cast<int32_t>(sp.size()));
+      }
+    }
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {}
+  SEXP get() {
+    int ncol = group_names.size();
+    re2::StringColumns mat(records.size(), ncol);
+    for (size_t row = 0; row < records.size(); row++) {
+      const int32_t *cell = &bounds[2 * row * ncol];
+      for (int col = 0; col < ncol; col++) {
+        mat.set(row, col,
+                re2::submatch_string(text.data() + base[row], cell[2 * col],
+                                     cell[2 * col + 1]));
+      }
+    }
+    return List::create(Named("record") = wrap(records),
+                        Named("match") = mat.get(group_names));
+  }
+};
+} // namespace
+
+//' Match the records of a file without reading it into memory
+//'
+//' @description
+//' Scan a file for a pattern without first reading it into a character
+//'   vector. The file is read in fixed size buffers and split into records
+//'   (lines, by default). Records are matched in place, so memory use does
+//'   not grow with the size of the file. Only the matching records are
+//'   returned.
+//'
+//' \code{re2_file_which} returns the numbers of the records that match,
+//'   like \code{grep -n}. \code{re2_file_count} also counts the matches in
+//'   each matching record. \code{re2_file_match} extracts the matched
+//'   groups, like \code{\link{re2_match}} (or \code{\link{re2_match_all}}
+//'   if \code{all} is TRUE).
+//'
+//' @param file Path of the file to read.
+//' @param pattern Character string containing a regular expression,
+//'    or a pre-compiled regular expression. Only a single pattern is
+//'    accepted. \cr
+//'   See \code{\link{re2_regexp}} for available options. \cr
+//'   See \link{re2_syntax} for regular expression syntax. \cr
+//' @param delimiter A single byte separating records. A carriage return
+//'   preceding the delimiter is part of the record.
+//' @param all If TRUE, extract all the matches in each record rather than
+//'   the first.
+//' @inheritParams re2_match
+//'
+//' @return \code{re2_file_which} returns a numeric vector of record
+//'   numbers (starting at 1). \code{re2_file_count} returns a numeric
+//'   matrix with columns \code{record} and \code{count}.
+//'   \code{re2_file_match} returns a list with elements \code{record},
+//'   the record number of each match, and \code{match}, a character
+//'   matrix with one row per match: the entire matching text followed by
+//'   one column for each capture group.
+//'
+//' @example inst/examples/file.R
+//'
+//' @seealso
+//'   \code{\link{re2_which}}, \code{\link{re2_count}} and
+//'   \code{\link{re2_match}} to match character vectors.
+//'
+// [[Rcpp::export]]
+SEXP re2_file_which(std::string file, SEXP pattern,
+                    std::string delimiter = "\n",
+                    SEXP nthreads = R_NilValue) {
+  re2::RE2Proxy re2proxy(pattern);
+  check_single_pattern(re2proxy);
+  DoFileWhich doer;
+  return re2_do_match_file(file, checked_delimiter(delimiter), re2proxy,
+                           doer, re2::nthreads_option(nthreads));
+}
+
+//' @rdname re2_file_which
+// [[Rcpp::export]]
+SEXP re2_file_count(std::string file, SEXP pattern,
+                    std::string delimiter = "\n",
+                    SEXP nthreads = R_NilValue) {
+  re2::RE2Proxy re2proxy(pattern);
+  check_single_pattern(re2proxy);
+  DoFileCount doer;
+  return re2_do_match_file(file, checked_delimiter(delimiter), re2proxy,
+                           doer, re2::nthreads_option(nthreads));
+}
+
+//' @rdname re2_file_which
+// [[Rcpp::export]]
+SEXP re2_file_match(std::string file, SEXP pattern, bool all = false,
+                    std::string delimiter = "\n",
+                    SEXP nthreads = R_NilValue) {
+  re2::RE2Proxy re2proxy(pattern);
+  check_single_pattern(re2proxy);
+  DoFileMatch doer(all, re2proxy[0]);
+  return re2_do_match_file(file, checked_delimiter(delimiter), re2proxy,
+                           doer, re2::nthreads_option(nthreads));
+}
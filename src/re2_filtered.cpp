@@ -0,0 +1,188 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_aho_corasick.h"
+#include "re2_options.h"
+#include "re2_parallel.h"
+#include "re2_pattern_indices.h"
+#include "re2_string.h"
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <re2/filtered_re2.h>
+#include <re2/unicode_casefold.h>
+#include <util/utf.h>
+#include <memory>
+
+using namespace Rcpp;
+
+namespace {
+// A compiled FilteredRE2 along with the atom matcher built from the
+// atoms it returned.
+struct RE2Filtered {
+  re2::FilteredRE2 filter;
+  std::vector<std::string> atoms;
+  std::unique_ptr<re2::AhoCorasick> matcher;
+  bool latin1;
+  RE2Filtered(int min_atom_len, bool latin1)
+      : filter(min_atom_len), latin1(latin1) {}
+};
+
+SEXP filtered_tag() { return Rf_install("re2_filtered"); }
+
+RE2Filtered &checked_filtered(SEXP ptr) {
+  if (TYPEOF(ptr) != EXTPTRSXP || R_ExternalPtrTag(ptr) != filtered_tag()) {
+    const char *fmt = "Expecting a filter (from re2_filtered): [type=%s].";
+    throw ::Rcpp::not_compatible(fmt, Rf_type2char(TYPEOF(ptr)));
+  }
+  XPtr<RE2Filtered> xptr(ptr);
+  return *xptr.checked_get();
+}
+
+bool is_ascii(const re2::StringPiece &text) {
+  for (char c : text) {
+    if (static_cast<unsigned char>(c) >= re2::Runeself) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Lowercase UTF-8 text the way the prefilter lowercases atoms. Bytes
+// that are not valid UTF-8 are copied as-is.
+void utf8_tolower(const re2::StringPiece &text, std::string *lower) {
+  lower->clear();
+  const char *p = text.data();
+  const char *end = p + text.size();
+  char buf[re2::UTFmax];
+  while (p < end) {
+    unsigned char c = static_cast<unsigned char>(*p);
+    if (c < re2::Runeself) {
+      lower->push_back(('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c);
+      p++;
+      continue;
+    }
+    re2::Rune r;
+    int n = re2::fullrune(p, static_cast<int>(end - p))
+                ? re2::chartorune(&r, p)
+                : 1;
+    if (n == 1) { // invalid or truncated sequence
+      lower->push_back(*p++);
+      continue;
+    }
+    const re2::CaseFold *f = re2::LookupCaseFold(
+        re2::unicode_tolower, re2::num_unicode_tolower, r);
+    if (f != NULL && r >= f->lo) {
+      r = re2::ApplyFold(f, r);
+    }
+    lower->append(buf, re2::runetochar(buf, &r));
+    p += n;
+  }
+}
+} // namespace
+
+//' Match a large number of patterns using literal prefilters
+//'
+//' @description
+//' \code{re2_filtered} compiles a collection of regular expressions for
+//'   fast matching when there are too many patterns for
+//'   \code{\link{re2_set}}. Literal strings (atoms) that must occur in
+//'   any text matched by a pattern are extracted from each pattern.
+//'   \code{re2_filtered_match} first finds all the atoms occurring in a
+//'   string with a single pass of an Aho-Corasick automaton, and then
+//'   runs only the patterns whose atoms are present. Patterns without
+//'   usable atoms are always run.
+//'
+//' \code{re2_filtered_atoms} returns the atoms, which are lowercase.
+//'
+//' @param patterns Character vector of regular expressions.
+//' @param min_atom_len Atoms shorter than this are not used for
+//'   filtering. Longer atoms are more selective.
+//' @param more_options Named list of options applied to all the
+//'   patterns. See \code{\link{re2_regexp}}.
+//' @param filter The value obtained from call to \code{re2_filtered}.
+//' @inheritParams re2_set
+//'
+//' @return \code{re2_filtered_match} returns a list of integer vectors:
+//'   the sorted indices of the patterns that match each string (NA if
+//'   string is NA). If \code{simplify} is TRUE, returns a two column
+//'   integer matrix with one row per match: the index of the string and
+//'   the index of the pattern.
+//'
+//' @example inst/examples/filtered.R
+//'
+//' @seealso
+//'   \code{\link{re2_set}} to match fewer patterns in a single pass,
+//'   \code{\link{re2_regexp}} for options to regular expression, and
+//'   \link{re2_syntax} for regular expression syntax.
+//'
+// [[Rcpp::export]]
+SEXP re2_filtered(StringVector patterns, int min_atom_len = 3,
+                  Nullable<List> more_options = R_NilValue) {
+  RE2::Options opt;
+  modify_options(opt, more_options);
+  if (patterns.size() == 0) {
+    throw std::invalid_argument("Expecting at least one pattern");
+  }
+
+  XPtr<RE2Filtered> xptr(
+      new RE2Filtered(min_atom_len,
+                      opt.encoding() == RE2::Options::EncodingLatin1),
+      true, filtered_tag());
+  for (int i = 0; i < patterns.size(); i++) {
+    if (patterns(i) == NA_STRING) {
+      throw std::invalid_argument("Pattern cannot be NA");
+    }
+    re2::StringPiece pattern = re2::as_string_piece(patterns(i));
+    int id;
+    if (xptr->filter.Add(pattern, opt, &id) != RE2::NoError) {
+      RE2 re(pattern, opt); // FilteredRE2 only reports the error code
+      throw std::invalid_argument(re.error());
+    }
+  }
+  xptr->filter.Compile(&xptr->atoms);
+  xptr->matcher.reset(new re2::AhoCorasick(xptr->atoms, true));
+  return xptr;
+}
+
+//' @rdname re2_filtered
+// [[Rcpp::export]]
+SEXP re2_filtered_match(StringVector string, SEXP filter,
+                        bool simplify = false, SEXP nthreads = R_NilValue) {
+  const RE2Filtered &filtered = checked_filtered(filter);
+
+  R_xlen_t n = string.size();
+  std::vector<re2::StringPiece> texts(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    SEXP elt = STRING_ELT(string, i);
+    if (elt != NA_STRING) {
+      texts[i] = re2::as_string_piece(elt);
+    }
+  }
+  std::vector<std::vector<int>> matched(n);
+  re2::parallel_for(
+      n, re2::nthreads_option(nthreads), [&](R_xlen_t begin, R_xlen_t end) {
+        std::vector<int> found;
+        std::string lower;
+        for (R_xlen_t i = begin; i < end; i++) {
+          if (texts[i].data() == NULL) {
+            continue;
+          }
+          found.clear();
+          if (filtered.latin1 || is_ascii(texts[i])) {
+            filtered.matcher->find(texts[i], &found);
+          } else {
+            utf8_tolower(texts[i], &lower);
+            filtered.matcher->find(lower, &found);
+          }
+          filtered.filter.AllMatches(texts[i], found, &matched[i]);
+        }
+      });
+
+  return re2::pattern_indices(texts, matched, simplify);
+}
+
+//' @rdname re2_filtered
+// [[Rcpp::export]]
+std::vector<std::string> re2_filtered_atoms(SEXP filter) {
+  return checked_filtered(filter).atoms;
+}
@@ -3,6 +3,7 @@
 
 #include <Rcpp.h>
 #include <re2/re2.h>
+#include "re2_regexp.h"
 
 using namespace Rcpp;
 
@@ -18,20 +19,14 @@ using namespace Rcpp;
 //'
 // [[Rcpp::export]]
 List re2_get_options(SEXP re2ptr) {
-  if (TYPEOF(re2ptr) != EXTPTRSXP) {
-    const char *fmt = "Expecting an external ptr (to RE2 object): [type=%s].";
-    throw ::Rcpp::not_compatible(fmt, Rf_type2char(TYPEOF(re2ptr)));
-    return List::create(0);
-  }
-
-  XPtr<RE2> xptr(re2ptr);
-  auto re2p = xptr.checked_get();
+  auto re2p = re2::regexp_ptr(re2ptr);
   const RE2::Options &options = re2p->options();
 
   CharacterVector optname = CharacterVector::create(
       "encoding", "posix_syntax", "longest_match", "log_errors", "max_mem",
       "literal", "never_nl", "dot_nl", "never_capture", "case_sensitive",
-      "perl_classes", "word_boundary", "one_line");
+      "perl_classes", "word_boundary", "one_line", "bit_state_max_mem",
+      "one_pass_max_text");
   List out(optname.size());
   out[0] = options.encoding() == RE2::Options::EncodingUTF8 ? "UTF8" : "Latin1";
   out[1] = options.posix_syntax();
@@ -46,6 +41,8 @@ List re2_get_options(SEXP re2ptr) {
   out[10] = options.perl_classes();
   out[11] = options.word_boundary();
   out[12] = options.one_line();
+  out[13] = static_cast<double>(options.bit_state_max_mem());
+  out[14] = static_cast<double>(options.one_pass_max_text());
 
   out.attr("names") = optname;
   return out;
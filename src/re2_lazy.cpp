@@ -0,0 +1,111 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_lazy.h"
+#include "re2_result.h"
+#include <R_ext/Altrep.h>
+#include <Rcpp.h>
+
+using namespace Rcpp;
+
+namespace {
+
+R_altrep_class_t lazy_class;
+
+// What an ALTREP vector of the class shows: element k is the cell in row
+// row + k % nrow and column k / nrow of matches.
+struct LazyView {
+  std::shared_ptr<re2::LazySubmatches> matches;
+  R_xlen_t row;
+  R_xlen_t nrow;
+  int ncol;
+  R_xlen_t elt;
+};
+
+// data1 is an external pointer to the LazyView, which also protects the
+// source vector. data2 is R_NilValue until the vector is made in full.
+const LazyView &lazy_view(SEXP x) {
+  return *static_cast<LazyView *>(R_ExternalPtrAddr(R_altrep_data1(x)));
+}
+
+R_xlen_t lazy_length(SEXP x) {
+  const LazyView &view = lazy_view(x);
+  return view.nrow * view.ncol;
+}
+
+SEXP lazy_elt(SEXP x, R_xlen_t k) {
+  SEXP full = R_altrep_data2(x);
+  if (full != R_NilValue) {
+    return STRING_ELT(full, k);
+  }
+  const LazyView &view = lazy_view(x);
+  R_xlen_t row = view.row + k % view.nrow;
+  return view.matches->get(row, static_cast<int>(k / view.nrow),
+                           view.elt < 0 ? row : view.elt);
+}
+
+SEXP lazy_materialize(SEXP x) {
+  SEXP full = R_altrep_data2(x);
+  if (full == R_NilValue) {
+    R_xlen_t n = lazy_length(x);
+    full = PROTECT(Rf_allocVector(STRSXP, n));
+    for (R_xlen_t k = 0; k < n; k++) {
+      SET_STRING_ELT(full, k, lazy_elt(x, k));
+    }
+    R_set_altrep_data2(x, full);
+    UNPROTECT(1);
+  }
+  return full;
+}
+
+void *lazy_dataptr(SEXP x, Rboolean writeable) {
+  return DATAPTR(lazy_materialize(x));
+}
+
+const void *lazy_dataptr_or_null(SEXP x) {
+  SEXP full = R_altrep_data2(x);
+  return full == R_NilValue ? NULL : DATAPTR(full);
+}
+
+void lazy_set_elt(SEXP x, R_xlen_t k, SEXP value) {
+  SET_STRING_ELT(lazy_materialize(x), k, value);
+}
+
+Rboolean lazy_inspect(SEXP x, int pre, int deep, int pvec,
+                      void (*inspect_subtree)(SEXP, int, int, int)) {
+  const LazyView &view = lazy_view(x);
+  Rcout << "re2 lazy submatches ("
+        << (R_altrep_data2(x) == R_NilValue ? "deferred" : "materialized")
+        << ", nrow=" << view.nrow << ", ncol=" << view.ncol << ")\n";
+  return TRUE;
+}
+
+} // namespace
+
+namespace re2 {
+
+SEXP LazySubmatches::get(R_xlen_t row, int col, R_xlen_t elt) const {
+  const int32_t *cell = &bounds[2 * (row * _ncol + col)];
+  return submatch_string(STRING_ELT(_source, elt), cell[0], cell[1]);
+}
+
+SEXP lazy_submatches_vector(const std::shared_ptr<LazySubmatches> &matches,
+                            R_xlen_t row, R_xlen_t nrow, int ncol,
+                            R_xlen_t elt) {
+  XPtr<LazyView> view(new LazyView{matches, row, nrow, ncol, elt}, true,
+                      R_NilValue, matches->source());
+  return R_new_altrep(lazy_class, view, R_NilValue);
+}
+
+} // namespace re2
+
+// [[Rcpp::init]]
+void re2_init_lazy(DllInfo *dll) {
+  lazy_class = R_make_altstring_class("re2_lazy_submatches", "re2", dll);
+  R_set_altrep_Length_method(lazy_class, lazy_length);
+  R_set_altrep_Inspect_method(lazy_class, lazy_inspect);
+  R_set_altvec_Dataptr_method(lazy_class, lazy_dataptr);
+  R_set_altvec_Dataptr_or_null_method(lazy_class, lazy_dataptr_or_null);
+  R_set_altstring_Elt_method(lazy_class, lazy_elt);
+  R_set_altstring_Set_elt_method(lazy_class, lazy_set_elt);
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_LAZY_H_
+#define RE2_LAZY_H_
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace re2 {
+
+// Submatches kept as byte offsets into the elements of a character
+// vector, so that their strings are made only when R asks for them.
+// Rows of ncol cells are appended in order. A cell holds a begin and an
+// end offset (R strings are shorter than 2^31 bytes); a negative begin
+// means NA.
+class LazySubmatches {
+public:
+  // source must be kept alive by the owner (lazy_submatches_vector()
+  // protects it).
+  LazySubmatches(SEXP source, int ncol) : _source(source), _ncol(ncol) {}
+
+  SEXP source() const { return _source; }
+  int ncol() const { return _ncol; }
+  R_xlen_t nrow() const { return bounds.size() / (2 * _ncol); }
+  void reserve(R_xlen_t nrow) { bounds.reserve(2 * _ncol * nrow); }
+
+  // Appends a row of NA cells and returns its number.
+  R_xlen_t add_row() {
+    bounds.resize(bounds.size() + 2 * _ncol, -1);
+    return nrow() - 1;
+  }
+  // Records submatch sp of text in cell (row, col). A submatch with
+  // NULL data is NA.
+  void set(R_xlen_t row, int col, const StringPiece &text,
+           const StringPiece &sp) {
+    if (sp.data() == NULL) {
+      return;
+    }
+    int32_t *cell = &bounds[2 * (row * _ncol + col)];
+    cell[0] = static_cast<int32_t>(sp.data() - text.data());
+    cell[1] = static_cast<int32_t>(cell[0] + sp.size());
+  }
+  // The string in cell (row, col), a substring of element elt of source.
+  SEXP get(R_xlen_t row, int col, R_xlen_t elt) const;
+
+private:
+  SEXP _source;
+  int _ncol;
+  std::vector<int32_t> bounds;
+};
+
+// An ALTREP character vector of the cells in rows [row, row + nrow) and
+// columns [0, ncol) of matches, in column-major order (give it a dim
+// attribute to make it a matrix). The rows are substrings of element elt
+// of the source vector or, if elt is negative, row r is a substring of
+// element r. A string is made when the element is accessed; the whole
+// vector is made only if R needs a pointer to its data.
+SEXP lazy_submatches_vector(const std::shared_ptr<LazySubmatches> &matches,
+                            R_xlen_t row, R_xlen_t nrow, int ncol,
+                            R_xlen_t elt);
+
+} // namespace re2
+#endif
@@ -5,22 +5,23 @@
 #include <re2/re2.h>
 #include "re2_do_match.h"
 #include "re2_re2proxy.h"
+#include "re2_parallel.h"
 
 using namespace Rcpp;
 
 namespace {
 struct DoLocate : re2::DoMatchIntf {
   IntegerMatrix &result;
-  int count = 1;
   DoLocate(IntegerMatrix &r) : result(r) {
     std::vector<std::string> gnames = {"begin", "end"};
     colnames(result) = wrap(gnames);
   }
-  bool proceed() { return count-- > 0 ? true : false; }
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  int nsubmatch(re2::RE2Proxy::Adapter &re2) { return 1; }
+  size_t match_limit() { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
-    count = 1;
-    re2::StringPiece *sp_arr = all_matches.at(0);
+    const re2::StringPiece *sp_arr = all_matches.at(0);
     if (sp_arr[0].data() == NULL) {
       result(i, 0) = NA_INTEGER;
       result(i, 1) = NA_INTEGER;
@@ -29,8 +30,7 @@ struct DoLocate : re2::DoMatchIntf {
       result(i, 1) = static_cast<size_t>(sp_arr[0].end() - text.begin());
     }
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
-    count = 1;
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
     result(i, 0) = NA_INTEGER;
     result(i, 1) = NA_INTEGER;
   }
@@ -56,23 +56,27 @@ struct DoLocate : re2::DoMatchIntf {
 //'   \code{\link{re2_regexp}} for options to regular expression,
 //'   \link{re2_syntax} for regular expression syntax.
 // [[Rcpp::export]]
-IntegerMatrix re2_locate(StringVector string, SEXP pattern) {
+IntegerMatrix re2_locate(StringVector string, SEXP pattern,
+                         SEXP nthreads = R_NilValue) {
   IntegerMatrix result(string.size(), 2);
   DoLocate doer(result);
-  return re2_do_match(string, pattern, doer);
+  return re2_do_match(string, pattern, doer, re2::nthreads_option(nthreads));
 }
 
 namespace {
 struct DoLocateAll : re2::DoMatchIntf {
   List &result;
-  DoLocateAll(List &r) : result(r) {}
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  StringVector names; // shared by all the matrices
+  DoLocateAll(List &r)
+      : result(r), names(StringVector::create("begin", "end")) {}
+  int nsubmatch(re2::RE2Proxy::Adapter &re2) { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
     IntegerMatrix mat(all_matches.size(), 2);
-    std::vector<std::string> gnames = {"begin", "end"};
-    colnames(mat) = wrap(gnames);
-    for (int row = 0; row < all_matches.size(); row++) {
-      re2::StringPiece *sp_arr = all_matches.at(row);
+    colnames(mat) = names;
+    for (size_t row = 0; row < all_matches.size(); row++) {
+      const re2::StringPiece *sp_arr = all_matches[row];
       if (sp_arr[0].data() == NULL) {
         mat(row, 0) = NA_INTEGER;
         mat(row, 1) = NA_INTEGER;
@@ -83,10 +87,9 @@ struct DoLocateAll : re2::DoMatchIntf {
     }
     result[i] = mat;
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
     IntegerMatrix mat(0, 2);
-    std::vector<std::string> gnames = {"begin", "end"};
-    colnames(mat) = wrap(gnames);
+    colnames(mat) = names;
     result[i] = mat;
   }
   SEXP get() { return result; }
@@ -95,8 +98,9 @@ struct DoLocateAll : re2::DoMatchIntf {
 
 //' @rdname re2_locate
 // [[Rcpp::export]]
-List re2_locate_all(StringVector string, SEXP pattern) {
+List re2_locate_all(StringVector string, SEXP pattern,
+                    SEXP nthreads = R_NilValue) {
   List result(string.size());
   DoLocateAll doer(result);
-  return re2_do_match(string, pattern, doer);
+  return re2_do_match(string, pattern, doer, re2::nthreads_option(nthreads));
 }
@@ -2,88 +2,168 @@
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
 #include "re2_do_match.h"
+#include "re2_lazy.h"
+#include "re2_parallel.h"
 #include "re2_re2proxy.h"
+#include "re2_result.h"
 #include <Rcpp.h>
 #include <re2/re2.h>
+#include <climits>
+#include <cstring>
 
 using namespace Rcpp;
 
 namespace {
+// One row per string, one column per group of all the patterns, made as
+// a character matrix or a data frame.
 struct DoMatchM : re2::DoMatchIntf {
-  StringMatrix &result;
-  int count = 1;
-  re2::RE2Proxy &re2proxy;
-  DoMatchM(StringMatrix &r, re2::RE2Proxy &re2proxy)
-      : result(r), re2proxy(re2proxy) {}
-  bool proceed() { return count-- > 0 ? true : false; }
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  re2::GroupLayout &layout;
+  re2::StringColumns result;
+  DoMatchM(R_xlen_t n, re2::GroupLayout &layout,
+           re2::StringColumns::Shape shape)
+      : layout(layout), result(n, layout.ncol(), shape) {}
+  size_t match_limit() { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
-    count = 1;
-    re2::StringPiece *sp_arr = all_matches.at(0);
+    result.set_row(i, layout.columns(i), all_matches.at(0));
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {}
+  SEXP get() { return result.get(layout.all_names()); }
+};
 
-    if (re2proxy.size() == 1) {
-      for (int col = 0; col < re2.nsubmatch(); col++) {
-        result(i, col) = sp_arr[col].data() == NULL
-                             ? NA_STRING
-                             : String(sp_arr[col].as_string());
-      }
-      return;
-    }
-    std::vector<bool> found(re2proxy.all_groups_count(), false);
-    for (int col = 0; col < re2.nsubmatch(); col++) {
-      std::string &col_name = re2.group_names().at(col);
-      std::vector<std::string> &all = re2proxy.all_group_names();
-      auto it = std::lower_bound(all.begin(), all.end(), col_name);
-      if (it == all.end() || *it != col_name) {
-        const char *fmt = "Error: group names mismatch.";
-        throw ::Rcpp::not_compatible(fmt);
-      }
-      std::size_t index = std::distance(all.begin(), it);
-      result(i, index) = sp_arr[col].data() == NULL
-                             ? NA_STRING
-                             : String(sp_arr[col].as_string());
-      found[index] = true;
-    }
-    for (int col = 0; col < re2proxy.all_groups_count(); col++) {
-      if (!found[col]) {
-        result(i, col) = NA_STRING;
-      }
-    }
+// Byte positions of submatch sp in text, as re2_locate reports them:
+// 1-based begin and inclusive end. NA if sp did not participate.
+void submatch_span(const re2::StringPiece &text, const re2::StringPiece &sp,
+                   int *begin, int *end) {
+  if (sp.data() == NULL) {
+    *begin = NA_INTEGER;
+    *end = NA_INTEGER;
+  } else {
+    *begin = static_cast<int>(sp.begin() - text.begin() + 1);
+    *end = static_cast<int>(sp.end() - text.begin());
+  }
+}
+
+// Like DoMatchM, but returns where the submatches are instead of their
+// text: an integer array of dim c(length(string), 2, groups), so that
+// result[, , g] is a begin/end matrix like re2_locate's for group g.
+struct DoMatchOffsets : re2::DoMatchIntf {
+  IntegerVector result;
+  re2::GroupLayout &layout;
+  R_xlen_t nrow;
+  DoMatchOffsets(R_xlen_t n, re2::GroupLayout &layout)
+      : result(Dimension(n, 2, layout.ncol())), layout(layout), nrow(n) {
+    std::fill(result.begin(), result.end(), NA_INTEGER);
+    std::vector<std::string> span = {"begin", "end"};
+    result.attr("dimnames") =
+        List::create(R_NilValue, wrap(span), layout.all_names());
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
-    count = 1;
-    for (int dcol = 0; dcol < re2proxy.all_groups_count(); dcol++) {
-      result(i, dcol) = NA_STRING;
+  size_t match_limit() { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    const re2::StringPiece *sp_arr = all_matches.at(0);
+    const std::vector<int> &columns = layout.columns(i);
+    int *out = INTEGER(result);
+    for (size_t col = 0; col < columns.size(); col++) {
+      int *cell = out + 2 * nrow * columns[col] + i;
+      submatch_span(text, sp_arr[col], cell, cell + nrow);
     }
   }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {}
   SEXP get() { return result; }
 };
 
+// Like DoMatchM, but records where the submatches are and returns a
+// lazy matrix that makes their strings on access.
+struct DoMatchLazyM : re2::DoMatchIntf {
+  std::shared_ptr<re2::LazySubmatches> matches;
+  re2::GroupLayout &layout;
+  DoMatchLazyM(StringVector &string, re2::GroupLayout &layout)
+      : matches(std::make_shared<re2::LazySubmatches>(string, layout.ncol())),
+        layout(layout) {
+    matches->reserve(string.size());
+  }
+  size_t match_limit() { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    const re2::StringPiece *sp_arr = all_matches.at(0);
+    const std::vector<int> &columns = layout.columns(i);
+    R_xlen_t row = matches->add_row();
+    for (size_t col = 0; col < columns.size(); col++) {
+      matches->set(row, columns[col], text, sp_arr[col]);
+    }
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
+    matches->add_row();
+  }
+  SEXP get() {
+    Shield<SEXP> result(re2::lazy_submatches_vector(
+        matches, 0, matches->nrow(), matches->ncol(), -1));
+    Rf_setAttrib(result, R_DimSymbol,
+                 IntegerVector::create(matches->nrow(), matches->ncol()));
+    Rf_setAttrib(result, R_DimNamesSymbol,
+                 List::create(R_NilValue, layout.all_names()));
+    return result;
+  }
+};
+
+// One named character vector per string, of the groups of its pattern.
 struct DoMatchL : re2::DoMatchIntf {
-  List &result;
-  int count = 1;
-  DoMatchL(List &r) : result(r) {}
-  bool proceed() { return count-- > 0 ? true : false; }
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  List result;
+  re2::GroupLayout &layout;
+  DoMatchL(R_xlen_t n, re2::GroupLayout &layout) : result(n), layout(layout) {}
+  size_t match_limit() { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
-    count = 1;
-    StringVector vect(re2.nsubmatch());
-    vect.names() = wrap(re2.group_names());
-    re2::StringPiece *sp_arr = all_matches.at(0);
+    Shield<SEXP> vect(Rf_allocVector(STRSXP, re2.nsubmatch()));
+    const re2::StringPiece *sp_arr = all_matches.at(0);
     for (int col = 0; col < re2.nsubmatch(); col++) {
-      vect[col] = sp_arr[col].data() == NULL ? NA_STRING
-                                             : String(sp_arr[col].as_string());
+      SET_STRING_ELT(vect, col, re2::submatch_string(sp_arr[col]));
     }
-    result[i] = vect;
+    Rf_setAttrib(vect, R_NamesSymbol, layout.names(i));
+    SET_VECTOR_ELT(result, i, vect);
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
-    count = 1;
-    StringVector vect(re2.nsubmatch());
-    vect.names() = wrap(re2.group_names());
-    result[i] = vect;
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
+    Shield<SEXP> vect(Rf_allocVector(STRSXP, re2.nsubmatch()));
+    Rf_setAttrib(vect, R_NamesSymbol, layout.names(i));
+    SET_VECTOR_ELT(result, i, vect);
   }
   SEXP get() { return result; }
 };
+
+// Like DoMatchL, with a lazy vector for each string that matches.
+struct DoMatchLazyL : DoMatchL {
+  std::shared_ptr<re2::LazySubmatches> matches;
+  DoMatchLazyL(StringVector &string, re2::RE2Proxy &re2proxy,
+               re2::GroupLayout &layout)
+      : DoMatchL(string.size(), layout),
+        matches(std::make_shared<re2::LazySubmatches>(
+            string, max_nsubmatch(re2proxy))) {}
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    const re2::StringPiece *sp_arr = all_matches.at(0);
+    R_xlen_t row = matches->add_row();
+    for (int col = 0; col < re2.nsubmatch(); col++) {
+      matches->set(row, col, text, sp_arr[col]);
+    }
+    Shield<SEXP> vect(
+        re2::lazy_submatches_vector(matches, row, 1, re2.nsubmatch(), i));
+    Rf_setAttrib(vect, R_NamesSymbol, layout.names(i));
+    SET_VECTOR_ELT(result, i, vect);
+  }
+  static int max_nsubmatch(re2::RE2Proxy &re2proxy) {
+    int ncol = 1;
+    for (int j = 0; j < re2proxy.size(); j++) {
+      ncol = std::max(ncol, re2proxy[j].nsubmatch());
+    }
+    return ncol;
+  }
+};
 } // namespace
 
 //' Extract matched groups from a string
@@ -105,77 +185,208 @@ struct DoMatchL : re2::DoMatchIntf {
 //'   See \code{\link{re2_regexp}} for available options. \cr
 //'   See \link{re2_syntax} for regular expression syntax. \cr
 //' @param simplify If TRUE, the default, returns a character matrix. If FALSE,
-//'   returns a list. Not applicable to \code{re2_match_all}.
+//'   returns a list. If "data.frame", returns a data frame of character
+//'   columns. Not applicable to \code{re2_match_all}.
+//' @param lazy If TRUE, the matched substrings are not copied out of
+//'   string until they are used. The result records where each
+//'   substring begins and ends, and each character vector (or matrix) of
+//'   the result makes its strings on access. Saves time and memory when
+//'   only some of the groups or rows are used. Default is FALSE.
+//' @param offsets If TRUE, return the byte positions of the submatches
+//'   instead of their text, like \code{\link{re2_locate}} does for the
+//'   whole match. No strings are made. Default is FALSE.
+//' @param nthreads Number of threads used for matching. Default (NULL) uses
+//'   \code{getOption("re2.nthreads")}, or a single thread if that option is
+//'   not set. Elements of string are split into contiguous ranges, one per
+//'   thread. Worthwhile only for long character vectors.
 //'
 //' @return In case of \code{re2_match} a character matrix. First column is the
 //'    entire matching text, followed by one column for each capture group. If
-//'    simplify is FALSE, returns a list of named character vectors. \cr
+//'    simplify is FALSE, returns a list of named character vectors. If
+//'    simplify is "data.frame", returns a data frame with the columns of
+//'    the matrix. \cr
 //'    In case of \code{re2_match_all}, returns a list of character matrices.
+//'    \cr
+//'    If offsets is TRUE, \code{re2_match} returns an integer array of
+//'    dimension \code{c(length(string), 2, groups)}: \code{result[, , g]}
+//'    is a matrix of begin and end positions of group g, NA where the group
+//'    did not match. \code{re2_match_all} returns an integer matrix in long
+//'    format, with one row per group of each match and columns
+//'    \code{string} (index of the string), \code{match} (index of the
+//'    match within the string), \code{group} (0 for the entire match),
+//'    \code{begin} and \code{end}.
 //'
 //' @example inst/examples/match.R
 //'
 //' @seealso
 //'   \code{\link{re2_regexp}} for options to regular expression,
 //'   \link{re2_syntax} for regular expression syntax.
-// [[Rcpp::export]]
-SEXP re2_match(StringVector string, SEXP pattern, bool simplify = true) {
-  if (simplify) {
-    re2::RE2Proxy re2proxy(pattern);
-    StringMatrix result(string.size(), re2proxy.all_groups_count());
-    colnames(result) = wrap(re2proxy.all_group_names());
-    DoMatchM doer(result, re2proxy);
-    return re2_do_match(string, re2proxy, doer);
+// [[Rcpp::export(signature={string, pattern, simplify=TRUE, lazy=FALSE, offsets=FALSE, nthreads=NULL})]]
+SEXP re2_match(StringVector string, SEXP pattern, SEXP simplify, bool lazy,
+               bool offsets, SEXP nthreads) {
+  int nthr = re2::nthreads_option(nthreads);
+  bool data_frame = TYPEOF(simplify) == STRSXP;
+  if (data_frame &&
+      (Rf_length(simplify) != 1 ||
+       std::strcmp(R_CHAR(STRING_ELT(simplify, 0)), "data.frame") != 0)) {
+    throw std::invalid_argument(
+        "simplify must be TRUE, FALSE or \"data.frame\"");
+  }
+  bool matrix = !data_frame && as<bool>(simplify);
+  re2::RE2Proxy re2proxy(pattern);
+  re2::GroupLayout layout(re2proxy);
+  if (offsets) {
+    if (!matrix) {
+      throw std::invalid_argument("offsets = TRUE requires simplify = TRUE");
+    }
+    DoMatchOffsets doer(string.size(), layout);
+    return re2_do_match(string, re2proxy, doer, nthr);
+  } else if (lazy && data_frame) {
+    throw std::invalid_argument(
+        "lazy = TRUE requires simplify = TRUE or FALSE");
+  } else if (matrix && lazy) {
+    DoMatchLazyM doer(string, layout);
+    return re2_do_match(string, re2proxy, doer, nthr);
+  } else if (lazy) {
+    DoMatchLazyL doer(string, re2proxy, layout);
+    return re2_do_match(string, re2proxy, doer, nthr);
+  } else if (matrix || data_frame) {
+    DoMatchM doer(string.size(), layout,
+                  data_frame ? re2::StringColumns::kDataFrame
+                             : re2::StringColumns::kMatrix);
+    return re2_do_match(string, re2proxy, doer, nthr);
   } else {
-    List result(string.size());
-    DoMatchL doer(result);
-    return re2_do_match(string, pattern, doer);
+    DoMatchL doer(string.size(), layout);
+    return re2_do_match(string, re2proxy, doer, nthr);
   }
 }
 
 namespace {
+// One character matrix per string, with a row per match and a column per
+// group of its pattern.
 struct DoMatchAll : re2::DoMatchIntf {
-  List &result;
-  DoMatchAll(List &r) : result(r) {}
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  List result;
+  re2::GroupLayout &layout;
+  DoMatchAll(R_xlen_t n, re2::GroupLayout &layout)
+      : result(n), layout(layout) {}
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    re2::StringColumns mat(all_matches.size(), re2.nsubmatch());
+    for (size_t row = 0; row < all_matches.size(); row++) {
+      mat.set_row(row, all_matches[row]);
+    }
+    SET_VECTOR_ELT(result, i, mat.get(layout.names(i)));
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
+    re2::StringColumns mat(0, re2.nsubmatch());
+    SET_VECTOR_ELT(result, i, mat.get(layout.names(i)));
+  }
+  SEXP get() { return result; }
+};
+
+// Like DoMatchAll, with a lazy matrix for each string that matches. The
+// matrices share one record of submatch positions.
+struct DoMatchLazyAll : DoMatchAll {
+  std::shared_ptr<re2::LazySubmatches> matches;
+  DoMatchLazyAll(StringVector &string, re2::RE2Proxy &re2proxy,
+                 re2::GroupLayout &layout)
+      : DoMatchAll(string.size(), layout),
+        matches(std::make_shared<re2::LazySubmatches>(
+            string, DoMatchLazyL::max_nsubmatch(re2proxy))) {}
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
-    StringMatrix mat(all_matches.size(), re2.nsubmatch());
-    colnames(mat) = wrap(re2.group_names());
-    for (int row = 0; row < all_matches.size(); row++) {
-      re2::StringPiece *sp_arr = all_matches.at(row);
+    R_xlen_t first = matches->nrow();
+    for (size_t k = 0; k < all_matches.size(); k++) {
+      const re2::StringPiece *sp_arr = all_matches[k];
+      R_xlen_t row = matches->add_row();
       for (int col = 0; col < re2.nsubmatch(); col++) {
-        mat(row, col) = sp_arr[col].data() == NULL
-                            ? NA_STRING
-                            : String(sp_arr[col].as_string());
+        matches->set(row, col, text, sp_arr[col]);
       }
     }
-    result[i] = mat;
+    Shield<SEXP> mat(re2::lazy_submatches_vector(
+        matches, first, all_matches.size(), re2.nsubmatch(), i));
+    Rf_setAttrib(mat, R_DimSymbol,
+                 IntegerVector::create(all_matches.size(), re2.nsubmatch()));
+    Rf_setAttrib(mat, R_DimNamesSymbol,
+                 List::create(R_NilValue, layout.names(i)));
+    SET_VECTOR_ELT(result, i, mat);
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
-    StringMatrix mat(0, re2.nsubmatch());
-    colnames(mat) = wrap(re2.group_names());
-    result[i] = mat;
+};
+
+// Positions of all the submatches of all the matches, in long format:
+// one row (string, match, group, begin, end) per group of each match.
+struct DoMatchAllOffsets : re2::DoMatchIntf {
+  std::vector<int> rows; // row-major, kColumns per row
+  static const int kColumns = 5;
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
+                   const re2::AllMatches &all_matches) {
+    for (size_t k = 0; k < all_matches.size(); k++) {
+      const re2::StringPiece *sp_arr = all_matches[k];
+      for (int col = 0; col < re2.nsubmatch(); col++) {
+        size_t pos = rows.size();
+        rows.resize(pos + kColumns);
+        rows[pos] = static_cast<int>(i + 1);
+        rows[pos + 1] = static_cast<int>(k + 1);
+        rows[pos + 2] = col;
+        submatch_span(text, sp_arr[col], &rows[pos + 3], &rows[pos + 4]);
+      }
+    }
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {}
+  SEXP get() {
+    R_xlen_t nrow = rows.size() / kColumns;
+    if (nrow > INT_MAX) {
+      throw std::invalid_argument(
+          "Too many matches for offsets = TRUE (more than 2^31 - 1 rows)");
+    }
+    IntegerMatrix result(static_cast<int>(nrow), kColumns);
+    int *out = INTEGER(result);
+    for (R_xlen_t r = 0; r < nrow; r++) {
+      for (int c = 0; c < kColumns; c++) {
+        out[c * nrow + r] = rows[r * kColumns + c];
+      }
+    }
+    std::vector<std::string> names = {"string", "match", "group", "begin",
+                                      "end"};
+    colnames(result) = wrap(names);
+    return result;
   }
-  SEXP get() { return result; }
 };
 } // namespace
 
 //' @rdname re2_match
 // [[Rcpp::export]]
-List re2_match_all(StringVector string, SEXP pattern) {
-  List result(string.size());
-  DoMatchAll doer(result);
-  return re2_do_match(string, pattern, doer);
+SEXP re2_match_all(StringVector string, SEXP pattern, bool lazy = false,
+                   bool offsets = false, SEXP nthreads = R_NilValue) {
+  int nthr = re2::nthreads_option(nthreads);
+  if (offsets) {
+    DoMatchAllOffsets doer;
+    return re2_do_match(string, pattern, doer, nthr);
+  }
+  re2::RE2Proxy re2proxy(pattern);
+  re2::GroupLayout layout(re2proxy);
+  if (lazy) {
+    DoMatchLazyAll doer(string, re2proxy, layout);
+    return re2_do_match(string, re2proxy, doer, nthr);
+  }
+  DoMatchAll doer(string.size(), layout);
+  return re2_do_match(string, re2proxy, doer, nthr);
 }
 
 namespace {
 struct DoCount : re2::DoMatchIntf {
   IntegerVector &result;
   DoCount(IntegerVector &r) : result(r) {}
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  int nsubmatch(re2::RE2Proxy::Adapter &re2) { return 1; }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
     result[i] = all_matches.size();
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
     result[i] = 0;
   }
   SEXP get() { return result; }
@@ -199,8 +410,9 @@ struct DoCount : re2::DoMatchIntf {
 //'   \link{re2_syntax} for regular expression syntax.
 //'
 // [[Rcpp::export]]
-IntegerVector re2_count(StringVector string, SEXP pattern) {
+IntegerVector re2_count(StringVector string, SEXP pattern,
+                        SEXP nthreads = R_NilValue) {
   IntegerVector result(string.size());
   DoCount doer(result);
-  return re2_do_match(string, pattern, doer);
+  return re2_do_match(string, pattern, doer, re2::nthreads_option(nthreads));
 }
@@ -2,6 +2,7 @@
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
 #include "re2_re2proxy.h"
+#include "re2_string.h"
 #include <Rcpp.h>
 #include <re2/re2.h>
 #include <stdint.h>
@@ -182,7 +183,7 @@ SEXP re2_match_cpp(StringVector text, SEXP pattern,
       continue;
     }
 
-    re2::StringPiece strp(R_CHAR(text(i))); // shallow copy (providing char *)
+    re2::StringPiece strp = re2::as_string_piece(text(i)); // shallow copy
     endpos = std::min(endpos, strp.size());
 
     if (nsubmatch == 0) {
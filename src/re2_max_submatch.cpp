@@ -2,6 +2,7 @@
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
 #include "re2_re2proxy.h"
+#include "re2_string.h"
 #include <Rcpp.h>
 #include <re2/re2.h>
 
@@ -34,7 +35,7 @@ SEXP re2_max_submatch(StringVector rewrite) {
       ms[i] = NA_INTEGER;
       continue;
     }
-    re2::StringPiece strpc(R_CHAR(rewrite(i))); // shallow copy
+    re2::StringPiece strpc = re2::as_string_piece(rewrite(i)); // shallow copy
     ms[i] = RE2::MaxSubmatch(strpc);
   }
   return ms;
@@ -84,7 +85,7 @@ SEXP re2_check_rewrite_string(SEXP pattern, StringVector rewrite) {
       continue;
     }
 
-    re2::StringPiece strpc(R_CHAR(rewrite(i))); // shallow copy
+    re2::StringPiece strpc = re2::as_string_piece(rewrite(i)); // shallow copy
     std::string err_str;
     lv[i] = re2proxy[0].get().CheckRewriteString(strpc, &err_str);
     errors[i] = err_str;
@@ -0,0 +1,28 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_OPTIONS_H_
+#define RE2_OPTIONS_H_
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+
+using namespace Rcpp;
+
+// Apply options given as a named list (see re2_regexp) to opt, starting
+// from the package defaults (see set_default_options).
+void modify_options(RE2::Options& opt, Nullable<List> more_options);
+
+// Set the options in which the package differs from RE2: errors are
+// not logged, and bit_state_max_mem is 16MB rather than 32KB. Patterns
+// given as character strings are compiled with these, like those compiled
+// by re2_regexp without options.
+void set_default_options(RE2::Options& opt);
+
+inline RE2::Options default_options() {
+  RE2::Options opt;
+  set_default_options(opt);
+  return opt;
+}
+
+#endif
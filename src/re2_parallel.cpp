@@ -0,0 +1,99 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_parallel.h"
+#include <R_ext/Print.h>
+#include <Rcpp.h>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Rcpp;
+
+namespace {
+// Do not hand out less than this many elements to a thread. Spawning a
+// thread costs more than matching a few hundred short strings.
+const R_xlen_t kMinChunkSize = 1024;
+
+// RE2 log messages of the worker threads, waiting to be printed by the
+// main thread.
+thread_local bool in_worker = false;
+std::mutex pending_log_mutex;
+std::string pending_log;
+
+void flush_pending_log() {
+  std::string log;
+  {
+    std::lock_guard<std::mutex> lock(pending_log_mutex);
+    log.swap(pending_log);
+  }
+  if (!log.empty()) {
+    Rprintf("%s", log.c_str());
+  }
+}
+} // namespace
+
+namespace re2 {
+
+void r_log_message(const std::string &message) {
+  if (in_worker) {
+    std::lock_guard<std::mutex> lock(pending_log_mutex);
+    pending_log += message;
+  } else {
+    Rprintf("%s", message.c_str());
+  }
+}
+
+int nthreads_option(SEXP nthreads) {
+  if (Rf_isNull(nthreads)) {
+    nthreads = Rf_GetOption1(Rf_install("re2.nthreads"));
+    if (Rf_isNull(nthreads)) {
+      return 1;
+    }
+  }
+  int n = Rf_asInteger(nthreads);
+  if (n == NA_INTEGER || n < 1) {
+    throw std::invalid_argument("nthreads must be a positive integer");
+  }
+  return n;
+}
+
+void parallel_for(R_xlen_t n, int nthreads,
+                  const std::function<void(R_xlen_t, R_xlen_t)> &fn) {
+  R_xlen_t max_threads = (n + kMinChunkSize - 1) / kMinChunkSize;
+  int nworkers = static_cast<int>(std::min<R_xlen_t>(nthreads, max_threads));
+  if (nworkers <= 1) {
+    fn(0, n);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  std::vector<std::exception_ptr> errors(nworkers);
+  workers.reserve(nworkers);
+  R_xlen_t chunk = (n + nworkers - 1) / nworkers;
+  for (int t = 0; t < nworkers; t++) {
+    R_xlen_t begin = t * chunk;
+    R_xlen_t end = std::min(n, begin + chunk);
+    workers.emplace_back([&fn, &errors, t, begin, end]() {
+      in_worker = true;
+      try {
+        fn(begin, end);
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  flush_pending_log();
+  for (auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+} // namespace re2
@@ -0,0 +1,24 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_PARALLEL_H_
+#define RE2_PARALLEL_H_
+
+#include <Rcpp.h>
+#include <functional>
+
+namespace re2 {
+
+// Number of worker threads requested by the caller. NULL falls back to
+// getOption("re2.nthreads"), and then to 1 (serial execution).
+int nthreads_option(SEXP nthreads);
+
+// Split [0, n) into contiguous ranges and call fn(begin, end) for each
+// range on its own thread. fn must not touch the R API. RE2 log messages
+// written by the workers are printed once they have joined. An exception
+// thrown by a worker is rethrown on the calling thread after that.
+void parallel_for(R_xlen_t n, int nthreads,
+                  const std::function<void(R_xlen_t, R_xlen_t)> &fn);
+
+} // namespace re2
+#endif
@@ -0,0 +1,23 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_PATTERN_INDICES_H_
+#define RE2_PATTERN_INDICES_H_
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <vector>
+
+namespace re2 {
+
+// Result of matching a vector of strings against many patterns at once.
+// matched[i] holds the sorted, 0-based indices of the patterns matching
+// texts[i]; a text with NULL data is NA. Returns a list of 1-based
+// integer vectors, or, if simplify, a (string, pattern) integer matrix
+// with one row per match.
+SEXP pattern_indices(const std::vector<StringPiece> &texts,
+                     const std::vector<std::vector<int>> &matched,
+                     bool simplify);
+
+} // namespace re2
+#endif
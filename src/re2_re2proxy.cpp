@@ -3,25 +3,38 @@
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
 #include "re2_re2proxy.h"
+#include "re2_regexp.h"
+#include <unordered_set>
 
 using namespace Rcpp;
 
 namespace re2 {
 
+template <typename T> void RE2Proxy::append(SEXP key, const T &pattern) {
+  RE2AdapterPtr &adapter = seen[key];
+  if (!adapter) {
+    adapter = std::make_shared<Adapter>(pattern);
+  }
+  container.push_back(adapter);
+}
+
 RE2Proxy::RE2Proxy(const SEXP &input) {
 
   std::function<void(SEXP)> dfs; // recursively traverse list
   dfs = [this, &dfs](SEXP input) -> void {
     switch (TYPEOF(input)) {
     case EXTPTRSXP: {  // precompiled regex pattern
-      XPtr<RE2> xptr(input);
-      append(new Adapter(xptr.checked_get()));
+      if (R_ExternalPtrTag(input) != R_NilValue) { // a set or filter
+        throw ::Rcpp::not_compatible(
+            "Expecting a pattern (from re2_regexp), not a set or filter");
+      }
+      append(input, re2::regexp_ptr(input));
       break;
     }
     case STRSXP: {  // regex pattern
-      StringVector sv(input);
-      for (int i = 0; i < sv.size(); i++) {
-        append(new Adapter(as<std::string>(sv(i))));
+      for (R_xlen_t i = 0; i < XLENGTH(input); i++) {
+        SEXP elt = STRING_ELT(input, i);
+        append(elt, std::string(R_CHAR(elt), LENGTH(elt)));
       }
       break;
     }
@@ -43,11 +56,73 @@ RE2Proxy::RE2Proxy(const SEXP &input) {
     container.reserve(XLENGTH(input));
   }
   dfs(input);
+  seen.clear();
   if (container.empty()) {
     throw ::Rcpp::not_compatible("Invalid pattern");
   }
 }
 
+namespace {
+// A twin is worth matching with only if its program is at most this
+// fraction of the original's. Otherwise the pattern has little that
+// depends on UTF-8, and the DFA of the original is as good.
+const int kAsciiTwinMaxRatio = 2;
+} // namespace
+
+void RE2Proxy::Adapter::prepare_ascii() {
+  if (ascii_prepared) {
+    return;
+  }
+  ascii_prepared = true;
+  const RE2::Options &options = re2p->options();
+  if (options.encoding() != RE2::Options::EncodingUTF8) {
+    return;
+  }
+  // A non-ASCII pattern means something else in Latin-1. An ASCII one
+  // differs only in the non-ASCII characters its classes and
+  // case folding admit, which never occur in ASCII text.
+  const std::string &pattern = re2p->pattern();
+  for (char c : pattern) {
+    if (c & 0x80) {
+      return;
+    }
+  }
+  // The twin is compiled outside the cache, and the verdict kept with
+  // the pattern's entry, so a rejected twin costs one compile per cached
+  // pattern and no cache slot.
+  const RE2 &original = *re2p;
+  std::shared_ptr<const RE2> twin = RE2Cache::instance().ascii_twin(
+      pattern, options, [&original]() -> std::shared_ptr<const RE2> {
+        RE2::Options latin1(original.options());
+        latin1.set_encoding(RE2::Options::EncodingLatin1);
+        latin1.set_log_errors(false); // e.g. \x{100} is not Latin-1
+        auto twin = std::make_shared<const RE2>(original.pattern(), latin1);
+        if (!twin->ok() ||
+            twin->ProgramSize() * kAsciiTwinMaxRatio >
+                original.ProgramSize() ||
+            twin->NumberOfCapturingGroups() !=
+                original.NumberOfCapturingGroups()) {
+          return nullptr;
+        }
+        return twin;
+      });
+  if (twin) {
+    ascii_owner = twin;
+    ascii_re2p = twin.get();
+  }
+}
+
+void RE2Proxy::prepare_ascii(const SEXP *elts, R_xlen_t n) {
+  for (R_xlen_t i = 0; i < n; i++) {
+    if (elts[i] != NA_STRING && IS_ASCII(elts[i])) {
+      for (auto &adapter : container) {
+        adapter->prepare_ascii();
+      }
+      return;
+    }
+  }
+}
+
 std::vector<std::string> &RE2Proxy::Adapter::group_names() {
   if (_group_names.empty()) {
     _group_names.reserve(nsubmatch());
@@ -68,7 +143,11 @@ std::vector<std::string> &RE2Proxy::all_group_names() {
       _all_group_names = container.at(0)->group_names();
     } else {
       std::set<std::string> set;
+      std::unordered_set<Adapter *> visited;
       for (auto &re2p : container) {
+        if (!visited.insert(re2p.get()).second) {
+          continue; // shared by an earlier index
+        }
         for (auto &gr : re2p->group_names()) {
           set.insert(gr);
         }
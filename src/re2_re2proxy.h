@@ -7,6 +7,9 @@
 #include <Rcpp.h>
 #include <re2/re2.h>
 #include <memory>
+#include <unordered_map>
+#include "re2_cache.h"
+#include "re2_options.h"
 
 using namespace Rcpp;
 
@@ -15,15 +18,26 @@ namespace re2 {
 struct RE2Proxy {
 
   struct Adapter {
-    Adapter(const RE2 *re2p) : re2p(re2p) {}
-    Adapter(const std::string &pattern) {
-      re2p = new RE2(pattern);  // Compile the pattern
-      freeable = true;
-      if (!(re2p->ok())) {
-        throw std::invalid_argument(re2p->error());
-      }
-    }
+    // A precompiled regexp is always matched as it is, so that whatever
+    // was done to it (re2_warm_dfa, options) applies to every match.
+    Adapter(const RE2 *re2p) : re2p(re2p), ascii_prepared(true) {}
+    // Compiled through (and shared with) the process-wide RE2Cache.
+    Adapter(const std::string &pattern)
+        : owner(RE2Cache::instance().get(pattern, default_options())),
+          re2p(owner.get()) {}
     const RE2 &get() const { return *re2p; }
+    // The RE2 to match a text with, given whether R flags the text as
+    // ASCII (IS_ASCII): the Latin-1 twin found by prepare_ascii(), if
+    // there is one, or else get().
+    const RE2 &get(bool ascii) const {
+      return ascii && ascii_re2p != nullptr ? *ascii_re2p : *re2p;
+    }
+    bool has_ascii_twin() const { return ascii_re2p != nullptr; }
+    // Looks for a Latin-1 twin of a UTF-8 pattern: on ASCII text it
+    // matches exactly the same spans, and its program is much smaller
+    // when the pattern uses Unicode classes. Uses RE2Cache, so call it
+    // on the main thread before any worker uses get(bool).
+    void prepare_ascii();
     std::vector<std::string> &group_names();
     int nsubmatch() {
       if (_nsubmatch < 0) {
@@ -31,15 +45,14 @@ struct RE2Proxy {
       }
       return _nsubmatch;
     }
-    virtual ~Adapter() {
-      if (freeable) {
-        delete re2p;
-      }
-    }
+    virtual ~Adapter() {}
 
   private:
-    bool freeable = false;
+    std::shared_ptr<const RE2> owner;
     const RE2 *re2p;
+    std::shared_ptr<const RE2> ascii_owner;
+    const RE2 *ascii_re2p = nullptr;
+    bool ascii_prepared = false;
     int _nsubmatch = -1;
     std::vector<std::string> _group_names;
     Adapter();
@@ -48,14 +61,21 @@ struct RE2Proxy {
   RE2Proxy(const SEXP &input);
   Adapter &operator[](int index) { return *container.at(index); }
   int size() { return container.size(); }
+  // Calls prepare_ascii() on every adapter if R flags one of elts[0, n)
+  // as ASCII.
+  void prepare_ascii(const SEXP *elts, R_xlen_t n);
 
   std::vector<std::string> &all_group_names();
   int all_groups_count();
 
 private:
-  typedef std::unique_ptr<Adapter> RE2AdapterPtr;
+  // Adapters are shared between all indices that hold the same pattern.
+  typedef std::shared_ptr<Adapter> RE2AdapterPtr;
   std::vector<RE2AdapterPtr> container;
-  void append(Adapter *ap) { container.push_back(RE2AdapterPtr(ap)); };
+  // Patterns seen so far, keyed by CHARSXP (R interns strings, so equal
+  // patterns share one CHARSXP) or by the external pointer object.
+  std::unordered_map<SEXP, RE2AdapterPtr> seen;
+  template <typename T> void append(SEXP key, const T &pattern);
   std::vector<std::string> _all_group_names;
   RE2Proxy();
 };
@@ -3,12 +3,235 @@
 
 #include <Rcpp.h>
 #include <re2/re2.h>
+#include "re2_options.h"
+#include "re2_parallel.h"
 #include "re2_re2proxy.h"
+#include "re2_regexp.h"
+#include <memory>
+#include <stdint.h>
 
 using namespace Rcpp;
 
-static void modify_options(RE2::Options& opt,
-			   Nullable<List> more_options);
+namespace {
+// Serialized regexps: a header followed by one record per regexp. A
+// record holds the options, the pattern and, optionally, the compiled
+// program as written by RE2::Serialize (with its one-pass NFA, flat DFA
+// tables, required prefix and group names), so that restoring a regexp
+// neither parses nor compiles the pattern. The pattern is kept for RE2
+// to parse on demand, and to compile the regexp again if the program is
+// empty or was written by an incompatible version of RE2.
+//
+//   header: "RE2R", format version (1 byte), record count (uint32)
+//   record: encoding (1 byte), 11 option flags (1 byte each),
+//           max_mem (int64), bit_state_max_mem (int64),
+//           one_pass_max_text (int64), pattern length (uint32),
+//           pattern bytes, program length (uint32), program bytes
+//
+// Integers are little-endian.
+const char kMagic[] = "RE2R";
+const size_t kMagicLen = 4;
+const unsigned char kFormatVersion = 1;
+const size_t kHeaderLen = kMagicLen + 1 + 4;
+const int kNumFlags = 11;
+const size_t kMinRecordLen = 1 + kNumFlags + 8 + 8 + 8 + 4 + 4;
+
+// Default bound of the BitState bitmap; see set_default_options.
+const int64_t kBitStateMaxMem = 16 << 20;
+
+void put_uint(std::string *out, uint64_t value, int nbytes) {
+  for (int i = 0; i < nbytes; i++) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+// Reads serialized regexps; throws on truncated or malformed input.
+class Reader {
+public:
+  Reader(const unsigned char *data, size_t size)
+      : p(data), end(data + size) {}
+  uint64_t get_uint(int nbytes) {
+    need(nbytes);
+    uint64_t value = 0;
+    for (int i = 0; i < nbytes; i++) {
+      value |= static_cast<uint64_t>(*p++) << (8 * i);
+    }
+    return value;
+  }
+  const char *get_bytes(size_t n) {
+    need(n);
+    const char *bytes = reinterpret_cast<const char *>(p);
+    p += n;
+    return bytes;
+  }
+  size_t remaining() const { return end - p; }
+
+private:
+  void need(size_t n) {
+    if (static_cast<size_t>(end - p) < n) {
+      throw std::invalid_argument("Serialized regexp is truncated");
+    }
+  }
+  const unsigned char *p;
+  const unsigned char *end;
+};
+
+void put_header(std::string *out, uint32_t count) {
+  out->append(kMagic, kMagicLen);
+  out->push_back(static_cast<char>(kFormatVersion));
+  put_uint(out, count, 4);
+}
+
+uint32_t get_header(Reader &reader) {
+  if (memcmp(reader.get_bytes(kMagicLen), kMagic, kMagicLen) != 0) {
+    throw std::invalid_argument("Not a serialized regexp");
+  }
+  unsigned version = static_cast<unsigned>(reader.get_uint(1));
+  if (version != kFormatVersion) {
+    const char *fmt = "Unsupported serialized regexp version: [version=%d].";
+    throw ::Rcpp::not_compatible(fmt, version);
+  }
+  return static_cast<uint32_t>(reader.get_uint(4));
+}
+
+// Writes re with program, the output of RE2::Serialize or empty.
+void put_record(std::string *out, const RE2 &re, const std::string &program) {
+  const RE2::Options &opt = re.options();
+  out->push_back(opt.encoding() == RE2::Options::EncodingLatin1 ? 1 : 0);
+  const bool flags[kNumFlags] = {
+      opt.posix_syntax(),  opt.longest_match(), opt.log_errors(),
+      opt.literal(),       opt.never_nl(),      opt.dot_nl(),
+      opt.never_capture(), opt.case_sensitive(), opt.perl_classes(),
+      opt.word_boundary(), opt.one_line()};
+  for (bool flag : flags) {
+    out->push_back(flag ? 1 : 0);
+  }
+  put_uint(out, static_cast<uint64_t>(opt.max_mem()), 8);
+  put_uint(out, static_cast<uint64_t>(opt.bit_state_max_mem()), 8);
+  put_uint(out, static_cast<uint64_t>(opt.one_pass_max_text()), 8);
+  put_uint(out, re.pattern().size(), 4);
+  out->append(re.pattern());
+  put_uint(out, program.size(), 4);
+  out->append(program);
+}
+
+struct Record {
+  std::string pattern;
+  RE2::Options options;
+  std::string program;
+};
+
+void get_record(Reader &reader, Record *record) {
+  RE2::Options &opt = record->options;
+  opt.set_encoding(reader.get_uint(1) == 1 ? RE2::Options::EncodingLatin1
+                                           : RE2::Options::EncodingUTF8);
+  bool flags[kNumFlags];
+  for (int i = 0; i < kNumFlags; i++) {
+    flags[i] = reader.get_uint(1) != 0;
+  }
+  opt.set_posix_syntax(flags[0]);
+  opt.set_longest_match(flags[1]);
+  opt.set_log_errors(flags[2]);
+  opt.set_literal(flags[3]);
+  opt.set_never_nl(flags[4]);
+  opt.set_dot_nl(flags[5]);
+  opt.set_never_capture(flags[6]);
+  opt.set_case_sensitive(flags[7]);
+  opt.set_perl_classes(flags[8]);
+  opt.set_word_boundary(flags[9]);
+  opt.set_one_line(flags[10]);
+  opt.set_max_mem(static_cast<int64_t>(reader.get_uint(8)));
+  opt.set_bit_state_max_mem(static_cast<int64_t>(reader.get_uint(8)));
+  opt.set_one_pass_max_text(static_cast<int64_t>(reader.get_uint(8)));
+  size_t len = static_cast<size_t>(reader.get_uint(4));
+  record->pattern.assign(reader.get_bytes(len), len);
+  len = static_cast<size_t>(reader.get_uint(4));
+  record->program.assign(reader.get_bytes(len), len);
+}
+
+SEXP as_raw(const std::string &bytes) {
+  RawVector raw(bytes.size());
+  std::copy(bytes.begin(), bytes.end(), raw.begin());
+  return raw;
+}
+
+void delete_regexp(SEXP xp) {
+  delete static_cast<RE2 *>(R_ExternalPtrAddr(xp));
+  R_ClearExternalPtr(xp);
+}
+
+SEXP serialize_one(const RE2 &re, const std::string &program) {
+  std::string bytes;
+  put_header(&bytes, 1);
+  put_record(&bytes, re, program);
+  return as_raw(bytes);
+}
+
+// External pointer owning re, which keeps the serialized form of re in
+// its protected slot for readRDS() to restore it. Only the pattern and
+// options are kept, so that regexps never saved cost no more than the
+// compiled RE2; see re2::save_regexp.
+SEXP wrap_regexp(RE2 *re) {
+  return XPtr<RE2>(re, true, R_NilValue, serialize_one(*re, std::string()));
+}
+
+// Restores the compiled program of record, or compiles the pattern if
+// the program cannot be restored. Neither throws nor uses the R API, so
+// that it can run on worker threads.
+RE2 *restore_record(const Record &record) {
+  RE2 *re = NULL;
+  if (!record.program.empty()) {
+    re = RE2::Deserialize(record.pattern, record.options, record.program);
+  }
+  if (re == NULL) {
+    re = new RE2(record.pattern, record.options);
+  }
+  return re;
+}
+
+RE2 *compile_record(const Record &record) {
+  std::unique_ptr<RE2> re(restore_record(record));
+  if (!re->ok()) {
+    throw std::invalid_argument(re->error());
+  }
+  return re.release();
+}
+} // namespace
+
+namespace re2 {
+
+const RE2 *regexp_ptr(SEXP xp) {
+  if (TYPEOF(xp) != EXTPTRSXP) {
+    const char *fmt = "Expecting an external ptr (to RE2 object): [type=%s].";
+    throw ::Rcpp::not_compatible(fmt, Rf_type2char(TYPEOF(xp)));
+  }
+  RE2 *re = static_cast<RE2 *>(R_ExternalPtrAddr(xp));
+  if (re != NULL) {
+    return re;
+  }
+  SEXP saved = R_ExternalPtrProtected(xp);
+  if (TYPEOF(saved) != RAWSXP) {
+    throw ::Rcpp::not_compatible("external pointer is not valid");
+  }
+  Reader reader(RAW(saved), XLENGTH(saved));
+  if (get_header(reader) != 1) {
+    throw std::invalid_argument("Not a serialized regexp");
+  }
+  Record record;
+  get_record(reader, &record);
+  re = compile_record(record);
+  R_SetExternalPtrAddr(xp, re);
+  R_RegisterCFinalizerEx(xp, delete_regexp, TRUE);
+  return re;
+}
+
+void save_regexp(SEXP xp, bool reverse) {
+  const RE2 *re = regexp_ptr(xp);
+  std::string program;
+  re->Serialize(reverse, &program);
+  R_SetExternalPtrProtected(xp, serialize_one(*re, program));
+}
+
+} // namespace re2
 
 
 //' Compile regular expression pattern
@@ -65,6 +288,9 @@ static void modify_options(RE2::Options& opt,
 //'   \verb{never_capture} \tab (\verb{FALSE}) Parse all parens as non-capturing.\cr
 //'   \verb{case_sensitive} \tab (\verb{TRUE}) Match is case-sensitive (regexp can 
 //'                                      override with (?i) unless in posix_syntax mode).\cr
+//'   \verb{bit_state_max_mem} \tab (16MB) Max size of the bitmap used to extract groups.\cr
+//'   \verb{one_pass_max_text} \tab (4096) Max string size for which an anchored
+//'                                      one-pass regexp skips the DFA.\cr
 //' }
 //' The following options are only consulted when \verb{posix_syntax=TRUE}.
 //' When \verb{posix_syntax=FALSE}, these features are always enabled and
@@ -81,32 +307,125 @@ static void modify_options(RE2::Options& opt,
 //' graphs (DFA: The execution engine that implements Deterministic
 //' Finite Automaton search). Default is 8MB.
 //'
-//' @return Compiled regular expression.
+//' Capture groups are extracted after the DFA has located the match, by
+//' the OnePass engine when the regexp allows it and otherwise by the
+//' BitState engine, which marks the (instruction, position) pairs it has
+//' tried in a bitmap of about (program size) * (match length) bits. The
+//' \verb{bit_state_max_mem} option bounds that bitmap; longer matches fall
+//' back to the much slower NFA engine. The bitmap is sized to each match,
+//' so the limit costs memory only on long matches. The package default of
+//' 16MB also applies to patterns given as character strings; the C++
+//' library default is 32KB.
+//'
+//' @section Serialization:
+//'
+//' A compiled regexp can be saved with \code{saveRDS} or sent to another
+//'   R process. The pattern and options are saved along with it, and the
+//'   regexp is recompiled the first time it is used after being restored.
+//'   Once \code{re2_warm_dfa} has built flat DFA tables, the compiled
+//'   program and the tables are saved instead, and restored without
+//'   compiling the pattern again.
+//'   \code{re2_serialize} encodes a list of compiled regexps, with their
+//'   compiled programs, as a raw vector in a versioned binary format, and
+//'   \code{re2_unserialize} restores them, on several threads if
+//'   \code{nthreads} is given. A program saved by an incompatible version
+//'   of the package is compiled again from the pattern.
+//'   Forked processes (for example \code{parallel::mclapply}) share the
+//'   compiled regexps of their parent and need neither.
+//'
+//' @return Compiled regular expression. \code{re2_serialize} returns a raw
+//'   vector and \code{re2_unserialize} a list of compiled regular
+//'   expressions.
 //'
 //' @example inst/examples/regexp.R
 //'
 //' @usage re2_regexp(pattern, \dots)
+//' re2_serialize(regexps)
+//' re2_unserialize(raw, nthreads = NULL)
 //'
 //' @seealso \link{re2_syntax} has regular expression syntax.
 //' 
 // [[Rcpp::export]]
-XPtr<RE2> re2_regexp(std::string& pattern,
-		     Nullable<List> more_options = R_NilValue) {
+SEXP re2_regexp(std::string& pattern,
+		Nullable<List> more_options = R_NilValue) {
 
   RE2::Options opt;
   modify_options(opt, more_options);
 
-  auto re2ptr = new RE2(pattern, opt);
+  std::unique_ptr<RE2> re2ptr(new RE2(pattern, opt));
   if (!(re2ptr->ok())) {
     throw std::invalid_argument(re2ptr->error());
   }
-  return XPtr<RE2>(re2ptr);
+  return wrap_regexp(re2ptr.release());
 }
 
-static void modify_options(RE2::Options& opt,
-			   Nullable<List> more_options) {
-  
+//' @param regexps A compiled regular expression or a list of them.
+//' @param raw A raw vector obtained from \code{re2_serialize}.
+//' @inheritParams re2_match
+//' @rdname re2_regexp
+// [[Rcpp::export]]
+RawVector re2_serialize(SEXP regexps) {
+  std::vector<const RE2 *> res;
+  if (TYPEOF(regexps) == VECSXP) {
+    for (R_xlen_t i = 0; i < XLENGTH(regexps); i++) {
+      res.push_back(re2::regexp_ptr(VECTOR_ELT(regexps, i)));
+    }
+  } else {
+    res.push_back(re2::regexp_ptr(regexps));
+  }
+  std::string bytes;
+  put_header(&bytes, static_cast<uint32_t>(res.size()));
+  for (const RE2 *re : res) {
+    std::string program;
+    re->Serialize(true, &program);
+    put_record(&bytes, *re, program);
+  }
+  return as_raw(bytes);
+}
+
+//' @rdname re2_regexp
+// [[Rcpp::export]]
+List re2_unserialize(RawVector raw, SEXP nthreads = R_NilValue) {
+  Reader reader(RAW(raw), raw.size());
+  R_xlen_t count = get_header(reader);
+  if (static_cast<size_t>(count) > reader.remaining() / kMinRecordLen) {
+    throw std::invalid_argument("Serialized regexp is truncated");
+  }
+  std::vector<Record> records(count);
+  for (R_xlen_t i = 0; i < count; i++) {
+    get_record(reader, &records[i]);
+  }
+
+  std::vector<std::unique_ptr<RE2>> res(count);
+  re2::parallel_for(count, re2::nthreads_option(nthreads),
+                    [&](R_xlen_t begin, R_xlen_t end) {
+                      for (R_xlen_t i = begin; i < end; i++) {
+                        res[i].reset(restore_record(records[i]));
+                      }
+                    });
+
+  List result(count);
+  for (R_xlen_t i = 0; i < count; i++) {
+    if (!res[i]->ok()) {
+      throw std::invalid_argument(res[i]->error());
+    }
+    result[i] = wrap_regexp(res[i].release());
+  }
+  return result;
+}
+
+void set_default_options(RE2::Options& opt) {
   opt.set_log_errors(false); // make 'quiet' option the default
+  // RE2 sizes the BitState bitmap to the match, so a larger limit than
+  // RE2's costs nothing on short matches and keeps long ones off the
+  // much slower NFA.
+  opt.set_bit_state_max_mem(kBitStateMaxMem);
+}
+
+void modify_options(RE2::Options& opt,
+		    Nullable<List> more_options) {
+  
+  set_default_options(opt);
 
   static auto encoding_enum = [] (std::string const& val) {
     return (val == "EncodingLatin1" || val == "Latin1")
@@ -140,6 +459,12 @@ static void modify_options(RE2::Options& opt,
 
         else if (strcmp(R_CHAR(names(i)), "max_mem") == 0) {
           opt.set_max_mem(as<int>(mopts(i)));
+        } else if (strcmp(R_CHAR(names(i)), "bit_state_max_mem") == 0) {
+          opt.set_bit_state_max_mem(
+              static_cast<int64_t>(as<double>(mopts(i))));
+        } else if (strcmp(R_CHAR(names(i)), "one_pass_max_text") == 0) {
+          opt.set_one_pass_max_text(
+              static_cast<int64_t>(as<double>(mopts(i))));
         } else {
 	  const char* fmt
 	    = "Expecting valid option: [type=%s].";
@@ -0,0 +1,25 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_REGEXP_H_
+#define RE2_REGEXP_H_
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+
+namespace re2 {
+
+// Returns the RE2 object held by an external pointer from re2_regexp.
+// Throws if xp is not such a pointer. An external pointer restored by
+// readRDS() or unserialize() has a null address; the RE2 object is then
+// restored from the pattern and options saved along with the pointer,
+// or from the compiled program if save_regexp() saved it.
+const RE2 *regexp_ptr(SEXP xp);
+
+// Saves the compiled program of xp (with its reverse program if reverse
+// is true) along with the pointer, once it has built parts that are
+// worth keeping, such as flat DFA tables.
+void save_regexp(SEXP xp, bool reverse);
+
+} // namespace re2
+#endif
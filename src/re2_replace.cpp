@@ -2,8 +2,12 @@
 // License: https://github.com/girishji/re2/blob/main/LICENSE.md
 
 #include "re2_re2proxy.h"
+#include "re2_options.h"
+#include "re2_string.h"
 #include <Rcpp.h>
 #include <re2/re2.h>
+#include <re2/set.h>
+#include "util/utf.h"
 
 using namespace Rcpp;
 
@@ -51,6 +55,14 @@ SEXP re2_replace_cpp(StringVector string, SEXP pattern, std::string &rewrite,
 //'   corresponding parenthesized group from the pattern. \\0
 //'   refers to the entire matching text.
 //'
+//' @param single_pass Only used when \code{pattern} is a named vector.
+//'   If FALSE, the default, each pattern is applied to the result of
+//'   the previous one. If TRUE, all patterns are searched together in a
+//'   single left-to-right scan: at each position the leftmost match of
+//'   any pattern is replaced (ties go to the pattern listed first), and
+//'   replaced text is not matched again. Much faster for large sets of
+//'   patterns.
+//'
 //' @return A character vector with replacements.
 //' @example inst/examples/replace.R
 //'
@@ -75,18 +87,36 @@ SEXP re2_replace_cpp(StringVector string, SEXP pattern, std::string &rewrite,
              "multiple of pattern vector length"
           << '\n';
   }
+  // Rewrite refers to at most \\9, so 10 submatches always suffice.
+  re2::StringPiece vec[10];
+  int nvec = 1 + RE2::MaxSubmatch(rewrite);
   for (int i = 0; i < string.size(); i++) {
     int re_idx = i % re2proxy.size();
+    SEXP elt = string(i);
 
-    if (string(i) == NA_STRING) {
+    if (elt == NA_STRING) {
       cv[i] = NA_STRING;
       lv[i] = NA_LOGICAL;
       continue;
     }
 
-    std::string str = as<std::string>(string(i));
-    bool rval = RE2::Replace(&str, re2proxy[re_idx].get(), rewrite);
-    cv[i] = str;
+    // Match in place and copy only the elements that change. Elements
+    // without a match keep their original CHARSXP.
+    const RE2 &re = re2proxy[re_idx].get();
+    re2::StringPiece text = re2::as_string_piece(elt);
+    std::string str;
+    bool rval = nvec <= 1 + re.NumberOfCapturingGroups() &&
+                re.Match(text, 0, text.size(), RE2::UNANCHORED, vec, nvec);
+    if (rval) {
+      str.assign(text.data(), vec[0].data() - text.data());
+      rval = re.Rewrite(&str, rewrite, vec, nvec);
+    }
+    if (rval) {
+      str.append(vec[0].end(), text.end() - vec[0].end());
+      cv[i] = Rf_mkCharLenCE(str.data(), str.size(), Rf_getCharCE(elt));
+    } else {
+      cv[i] = elt;
+    }
     if (logical) {
       lv[i] = rval;
     }
@@ -95,20 +125,160 @@ SEXP re2_replace_cpp(StringVector string, SEXP pattern, std::string &rewrite,
   return logical ? lv : cv;
 }
 
+namespace {
+// Applies a list of (pattern, rewrite) rules to a text in a single left to
+// right pass. At each position the leftmost match of any rule is
+// replaced, ties going to the rule listed first, and scanning resumes
+// after the replaced text. An RE2::Set finds, in one DFA scan, the rules
+// that match the text at all; only those rules are searched for their
+// match positions. The leftmost match found for a rule stays valid until
+// the scan passes its start, so each rule is searched again only after a
+// replacement overlaps its match.
+class MultiReplacer {
+public:
+  MultiReplacer(re2::RE2Proxy &rules, const std::vector<std::string> &rewrites)
+      : rules(rules), rewrites(rewrites), nvec(rules.size()),
+        set(default_options(), RE2::UNANCHORED) {
+    bool ok = true;
+    for (int j = 0; j < rules.size(); j++) {
+      const RE2 &re = rules[j].get();
+      nvec[j] = 1 + RE2::MaxSubmatch(rewrites[j]);
+      if (nvec[j] > 1 + re.NumberOfCapturingGroups()) {
+        nvec[j] = 0; // GlobalReplace would refuse this rewrite
+      }
+      ok = ok && set.Add(re.pattern(), nullptr) == j;
+    }
+    use_set = ok && set.Compile();
+    cands.reserve(rules.size());
+  }
+
+  // Returns the number of replacements made. out is filled only when the
+  // count is positive.
+  int replace(const re2::StringPiece &text, std::string *out) {
+    cands.clear();
+    std::vector<int> matched;
+    RE2::Set::ErrorInfo error = {RE2::Set::kNoError};
+    if (use_set && !set.Match(text, &matched, &error) &&
+        error.kind == RE2::Set::kNoError) {
+      return 0;
+    }
+    if (use_set && error.kind == RE2::Set::kNoError) {
+      std::sort(matched.begin(), matched.end());
+      for (int j : matched) {
+        if (nvec[j] > 0) {
+          cands.push_back(Candidate{j});
+        }
+      }
+    } else { // no set, or its DFA ran out of memory
+      for (int j = 0; j < rules.size(); j++) {
+        if (nvec[j] > 0) {
+          cands.push_back(Candidate{j});
+        }
+      }
+    }
+
+    const char *p = text.data();
+    const char *lastend = NULL;
+    int count = 0;
+    out->clear();
+    while (!cands.empty()) {
+      Candidate *best = NULL;
+      for (Candidate &c : cands) {
+        if (c.dead) {
+          continue;
+        }
+        if (c.match.data() == NULL || c.match.data() < p) {
+          search(text, p, c);
+        }
+        if (!c.dead && c.match.empty() && c.match.data() == lastend) {
+          // Disallow empty match at end of last match (as GlobalReplace).
+          search(text, lastend + rune_length(text, lastend, c.rule), c);
+        }
+        if (!c.dead && (best == NULL || c.match.data() < best->match.data())) {
+          best = &c;
+        }
+      }
+      if (best == NULL) {
+        break;
+      }
+
+      const RE2 &re = rules[best->rule].get();
+      re2::StringPiece vec[10];
+      vec[0] = best->match;
+      size_t start = static_cast<size_t>(vec[0].data() - text.data());
+      if (nvec[best->rule] > 1) {
+        re.Match(text, start, text.size(), RE2::ANCHOR_START, vec,
+                 nvec[best->rule]);
+      }
+      out->append(p, vec[0].data() - p);
+      re.Rewrite(out, rewrites[best->rule], vec, nvec[best->rule]);
+      p = vec[0].data() + vec[0].size();
+      lastend = p;
+      count++;
+    }
+    if (count > 0) {
+      out->append(p, text.end() - p);
+    }
+    return count;
+  }
+
+private:
+  struct Candidate {
+    int rule;
+    re2::StringPiece match; // leftmost match at or after the scan position
+    bool dead = false;      // no match left in the rest of the text
+    Candidate(int rule) : rule(rule) {}
+  };
+
+  void search(const re2::StringPiece &text, const char *from, Candidate &c) {
+    size_t startpos = static_cast<size_t>(from - text.data());
+    c.dead = startpos > text.size() ||
+             !rules[c.rule].get().Match(text, startpos, text.size(),
+                                        RE2::UNANCHORED, &c.match, 1);
+  }
+
+  // Length of the character at p, so that skipping an empty match never
+  // splits a UTF-8 sequence.
+  int rune_length(const re2::StringPiece &text, const char *p, int rule) {
+    int left = static_cast<int>(std::min(ptrdiff_t{4}, text.end() - p));
+    if (rules[rule].get().options().encoding() ==
+            RE2::Options::EncodingUTF8 &&
+        left > 0 && re2::fullrune(p, left)) {
+      re2::Rune r;
+      int n = re2::chartorune(&r, p);
+      if (r <= re2::Runemax && !(n == 1 && r == re2::Runeerror)) {
+        return n;
+      }
+    }
+    return 1;
+  }
+
+  re2::RE2Proxy &rules;
+  const std::vector<std::string> &rewrites;
+  std::vector<int> nvec;
+  RE2::Set set;
+  bool use_set;
+  std::vector<Candidate> cands;
+};
+} // namespace
+
 SEXP re2_replace_all_cpp(StringVector string, SEXP pattern,
-                         const std::string &rewrite, bool count);
+                         const std::string &rewrite, bool count,
+                         bool single_pass);
 
 //' @rdname re2_replace
 // [[Rcpp::export]]
-SEXP re2_replace_all(StringVector string, SEXP pattern, const std::string &rewrite = "") {
-  return re2_replace_all_cpp(string, pattern, rewrite, false);
+SEXP re2_replace_all(StringVector string, SEXP pattern,
+                     const std::string &rewrite = "",
+                     bool single_pass = false) {
+  return re2_replace_all_cpp(string, pattern, rewrite, false, single_pass);
 }
 
 // [[Rcpp::export(.re2_replace_all_cpp)]]
 SEXP re2_replace_all_cpp(StringVector string, SEXP pattern,
-                         const std::string &rewrite, bool count = false) {
+                         const std::string &rewrite, bool count = false,
+                         bool single_pass = false) {
 
-  re2::RE2Proxy re2proxy(pattern);
   StringVector sv(string.size());
   IntegerVector cntv(string.size());
 
@@ -116,23 +286,49 @@ SEXP re2_replace_all_cpp(StringVector string, SEXP pattern,
   if (TYPEOF(pattern) == STRSXP) {
     StringVector sp(pattern);
     if (sp.hasAttribute("names")) {
-      Rcpp::CharacterVector pats = sp.names();
+      // Rules are compiled once, not once per string
+      CharacterVector pats = sp.names();
+      re2::RE2Proxy rules(pats);
+      std::vector<std::string> rewrites(sp.size());
+      for (int j = 0; j < (int)sp.size(); j++) {
+        rewrites[j] = as<std::string>(sp(j));
+      }
+      std::unique_ptr<MultiReplacer> replacer;
+      if (single_pass) {
+        replacer.reset(new MultiReplacer(rules, rewrites));
+      }
+      std::string str;
       for (int i = 0; i < string.size(); i++) {
-        if (string(i) == NA_STRING) {
+        SEXP elt = string(i);
+        if (elt == NA_STRING) {
           sv[i] = NA_STRING;
           cntv[i] = NA_INTEGER;
           continue;
         }
-        std::string str = as<std::string>(string(i));
+        re2::StringPiece text = re2::as_string_piece(elt);
         int cnt = 0;
-        for (int j = 0; j < (int)pats.size(); j++) {
-          RE2 re2p(std::string(pats(j)));  // Compile the pattern
-          if (!(re2p.ok())) {
-            throw std::invalid_argument(re2p.error());
+        if (single_pass) {
+          cnt = replacer->replace(text, &str);
+        } else {
+          // Apply rules one after the other; the string is copied only
+          // once a rule matches.
+          bool copied = false;
+          for (int j = 0; j < rules.size(); j++) {
+            const RE2 &re = rules[j].get();
+            if (!copied) {
+              if (!re.Match(text, 0, text.size(), RE2::UNANCHORED, nullptr,
+                            0)) {
+                continue;
+              }
+              str.assign(text.data(), text.size());
+              copied = true;
+            }
+            cnt += RE2::GlobalReplace(&str, re, rewrites[j]);
           }
-          cnt += RE2::GlobalReplace(&str, re2p, as<std::string>(sp(j)));
         }
-        sv[i] = str;
+        sv[i] = cnt == 0 ? elt
+                         : Rf_mkCharLenCE(str.data(), str.size(),
+                                          Rf_getCharCE(elt));
         if (count) {
           cntv[i] = cnt;
         }
@@ -141,6 +337,7 @@ SEXP re2_replace_all_cpp(StringVector string, SEXP pattern,
     }
   }
 
+  re2::RE2Proxy re2proxy(pattern);
   if ((string.size() % re2proxy.size()) != 0) {
     Rcerr << "Warning: string vector length is not a "
              "multiple of pattern vector length"
@@ -148,16 +345,27 @@ SEXP re2_replace_all_cpp(StringVector string, SEXP pattern,
   }
   for (int i = 0; i < string.size(); i++) {
     int re_idx = i % re2proxy.size();
+    SEXP elt = string(i);
 
-    if (string(i) == NA_STRING) {
+    if (elt == NA_STRING) {
       sv[i] = NA_STRING;
       cntv[i] = NA_INTEGER;
       continue;
     }
 
-    std::string str = as<std::string>(string(i));
-    int cnt = RE2::GlobalReplace(&str, re2proxy[re_idx].get(), rewrite);
-    sv[i] = str;
+    // A DFA-only existence check first: elements without a match keep
+    // their original CHARSXP and are never copied.
+    const RE2 &re = re2proxy[re_idx].get();
+    re2::StringPiece text = re2::as_string_piece(elt);
+    int cnt = 0;
+    if (re.Match(text, 0, text.size(), RE2::UNANCHORED, nullptr, 0)) {
+      std::string str(text.data(), text.size());
+      cnt = RE2::GlobalReplace(&str, re, rewrite);
+      if (cnt > 0) {
+        elt = Rf_mkCharLenCE(str.data(), str.size(), Rf_getCharCE(elt));
+      }
+    }
+    sv[i] = elt;
     if (count) {
       cntv[i] = cnt;
     }
@@ -0,0 +1,82 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_result.h"
+#include <unordered_map>
+
+using namespace Rcpp;
+
+namespace re2 {
+
+GroupLayout::GroupLayout(RE2Proxy &re2proxy)
+    : _all_names(wrap(re2proxy.all_group_names())) {
+  std::vector<std::string> &all = re2proxy.all_group_names();
+  std::unordered_map<std::string, int> column;
+  for (size_t k = 0; k < all.size(); k++) {
+    column[all[k]] = static_cast<int>(k);
+  }
+  std::unordered_map<RE2Proxy::Adapter *, std::shared_ptr<Pattern>> seen;
+  patterns.reserve(re2proxy.size());
+  for (int j = 0; j < re2proxy.size(); j++) {
+    std::shared_ptr<Pattern> &pattern = seen[&re2proxy[j]];
+    if (!pattern) {
+      std::vector<std::string> &names = re2proxy[j].group_names();
+      pattern = std::make_shared<Pattern>();
+      pattern->names = wrap(names);
+      pattern->columns.reserve(names.size());
+      for (auto &name : names) {
+        auto it = column.find(name);
+        if (it == column.end()) {
+          const char *fmt = "Error: group names mismatch.";
+          throw ::Rcpp::not_compatible(fmt);
+        }
+        pattern->columns.push_back(it->second);
+      }
+    }
+    patterns.push_back(pattern);
+  }
+}
+
+StringColumns::StringColumns(R_xlen_t nrow, int ncol, Shape shape)
+    : shape(shape), nrow(nrow), ncol(ncol) {
+  if (shape == kMatrix) {
+    data = Rf_allocVector(STRSXP, nrow * ncol);
+  } else {
+    data = Rf_allocVector(VECSXP, ncol);
+    for (int col = 0; col < ncol; col++) {
+      SET_VECTOR_ELT(data, col, Rf_allocVector(STRSXP, nrow));
+    }
+  }
+  buffer = data;
+  for (int col = 0; col < ncol; col++) {
+    for (R_xlen_t row = 0; row < nrow; row++) {
+      set(row, col, NA_STRING);
+    }
+  }
+}
+
+SEXP StringColumns::get(SEXP names) {
+  if (shape == kMatrix) {
+    Rf_setAttrib(buffer, R_DimSymbol,
+                 IntegerVector::create(static_cast<int>(nrow), ncol));
+    Rf_setAttrib(buffer, R_DimNamesSymbol, List::create(R_NilValue, names));
+  } else {
+    Rf_setAttrib(buffer, R_NamesSymbol, names);
+    as_data_frame(buffer, nrow);
+  }
+  return buffer;
+}
+
+SEXP as_data_frame(SEXP columns, R_xlen_t nrow) {
+  // Compact row names, as data.frame() makes them: c(NA, -nrow).
+  if (nrow == 0) {
+    Rf_setAttrib(columns, R_RowNamesSymbol, IntegerVector(0));
+  } else {
+    Rf_setAttrib(columns, R_RowNamesSymbol,
+                 IntegerVector::create(NA_INTEGER, -static_cast<int>(nrow)));
+  }
+  Rf_setAttrib(columns, R_ClassSymbol, Rf_mkString("data.frame"));
+  return columns;
+}
+
+} // namespace re2
@@ -0,0 +1,116 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_RESULT_H_
+#define RE2_RESULT_H_
+
+#include "re2_re2proxy.h"
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace re2 {
+
+// The string of submatch sp, or NA if it did not participate. Marked
+// UTF-8, like all the strings the package makes.
+inline SEXP submatch_string(const StringPiece &sp) {
+  return sp.data() == NULL ? NA_STRING
+                           : Rf_mkCharLenCE(sp.data(),
+                                            static_cast<int>(sp.size()),
+                                            CE_UTF8);
+}
+
+// The string of the submatch [begin, end) of text, as byte offsets, or NA
+// if begin is negative.
+inline SEXP submatch_string(const char *text, int32_t begin, int32_t end) {
+  return begin < 0 ? NA_STRING
+                   : Rf_mkCharLenCE(text + begin, end - begin, CE_UTF8);
+}
+inline SEXP submatch_string(SEXP charsxp, int32_t begin, int32_t end) {
+  return submatch_string(R_CHAR(charsxp), begin, end);
+}
+
+// Where the groups of the patterns of a RE2Proxy go in a result, worked
+// out once per call rather than once per match. A result shared by all
+// the patterns has one column per name in RE2Proxy::all_group_names();
+// a result for one match has the groups of its pattern, in order. Name
+// vectors are made once and shared by every result that carries them.
+// The pattern of element i is pattern i % re2proxy.size(), as in
+// re2_do_match().
+class GroupLayout {
+public:
+  explicit GroupLayout(RE2Proxy &re2proxy);
+  int ncol() const { return _all_names.size(); }
+  // Columns of the shared result that hold the groups of the pattern of
+  // element i.
+  const std::vector<int> &columns(R_xlen_t i) const {
+    return pattern(i).columns;
+  }
+  // Group names of the pattern of element i.
+  SEXP names(R_xlen_t i) const { return pattern(i).names; }
+  // Column names of the shared result.
+  SEXP all_names() const { return _all_names; }
+
+private:
+  struct Pattern {
+    std::vector<int> columns;
+    Rcpp::StringVector names;
+  };
+  const Pattern &pattern(R_xlen_t i) const {
+    return *patterns[i % static_cast<R_xlen_t>(patterns.size())];
+  }
+  // Adapters shared by several indices share their Pattern.
+  std::vector<std::shared_ptr<Pattern>> patterns;
+  Rcpp::StringVector _all_names;
+};
+
+// A character result of nrow rows and ncol columns, NA until set. The
+// cells are written in place, either in one column-major vector that
+// becomes a matrix or in one vector per column that become a data frame.
+class StringColumns {
+public:
+  enum Shape { kMatrix, kDataFrame };
+  StringColumns(R_xlen_t nrow, int ncol, Shape shape = kMatrix);
+
+  void set(R_xlen_t row, int col, SEXP charsxp) {
+    if (shape == kMatrix) {
+      SET_STRING_ELT(buffer, col * nrow + row, charsxp);
+    } else {
+      SET_STRING_ELT(VECTOR_ELT(buffer, col), row, charsxp);
+    }
+  }
+  void set(R_xlen_t row, int col, const StringPiece &sp) {
+    set(row, col, submatch_string(sp));
+  }
+  // Sets the submatches of one match in row: sp_arr[k] in column
+  // columns[k], or in column k if columns is not given.
+  void set_row(R_xlen_t row, const std::vector<int> &columns,
+               const StringPiece *sp_arr) {
+    for (size_t k = 0; k < columns.size(); k++) {
+      set(row, columns[k], sp_arr[k]);
+    }
+  }
+  void set_row(R_xlen_t row, const StringPiece *sp_arr) {
+    for (int col = 0; col < ncol; col++) {
+      set(row, col, sp_arr[col]);
+    }
+  }
+  // The matrix or data frame, with names as column names.
+  SEXP get(SEXP names);
+
+private:
+  Shape shape;
+  R_xlen_t nrow;
+  int ncol;
+  Rcpp::RObject data;
+  SEXP buffer; // data, unwrapped
+};
+
+// Makes a data frame of nrow rows out of columns, a named list of
+// vectors of that length.
+SEXP as_data_frame(SEXP columns, R_xlen_t nrow);
+
+} // namespace re2
+#endif
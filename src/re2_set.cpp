@@ -0,0 +1,234 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include "re2_options.h"
+#include "re2_parallel.h"
+#include "re2_pattern_indices.h"
+#include "re2_string.h"
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include <re2/set.h>
+#include <algorithm>
+
+using namespace Rcpp;
+
+namespace {
+// An RE2::Set along with what RE2::Set does not report about itself:
+// the number of patterns added, whether it has been compiled and
+// whether compiling failed. RE2::Set counts a failed Compile() as
+// compiled, so such a set can neither take patterns nor match.
+struct RE2Set {
+  RE2::Set set;
+  int size = 0;
+  bool compiled = false;
+  bool failed = false;
+  RE2Set(const RE2::Options &options, RE2::Anchor anchor)
+      : set(options, anchor) {}
+};
+
+SEXP set_tag() { return Rf_install("re2_set"); }
+
+RE2Set &checked_set(SEXP setptr) {
+  if (TYPEOF(setptr) != EXTPTRSXP || R_ExternalPtrTag(setptr) != set_tag()) {
+    const char *fmt = "Expecting a set (from re2_set): [type=%s].";
+    throw ::Rcpp::not_compatible(fmt, Rf_type2char(TYPEOF(setptr)));
+  }
+  XPtr<RE2Set> xptr(setptr);
+  RE2Set &re2set = *xptr.checked_get();
+  if (re2set.failed) {
+    throw std::invalid_argument(
+        "Set failed to compile; create it again with a larger max_mem");
+  }
+  return re2set;
+}
+
+void add_patterns(RE2Set &re2set, StringVector &patterns) {
+  if (re2set.compiled) {
+    throw std::invalid_argument("Cannot add patterns to a compiled set");
+  }
+  for (int i = 0; i < patterns.size(); i++) {
+    if (patterns(i) == NA_STRING) {
+      throw std::invalid_argument("Pattern cannot be NA");
+    }
+    std::string error;
+    if (re2set.set.Add(re2::as_string_piece(patterns(i)), &error) < 0) {
+      throw std::invalid_argument(error);
+    }
+    re2set.size++;
+  }
+}
+
+void compile_set(RE2Set &re2set) {
+  if (!re2set.compiled) {
+    if (!re2set.set.Compile()) {
+      re2set.failed = true;
+      throw std::invalid_argument(
+          "Set is too large to compile; increase max_mem");
+    }
+    re2set.compiled = true;
+  }
+}
+} // namespace
+
+namespace re2 {
+
+SEXP pattern_indices(const std::vector<StringPiece> &texts,
+                     const std::vector<std::vector<int>> &matched,
+                     bool simplify) {
+  R_xlen_t n = texts.size();
+  if (simplify) {
+    size_t nrow = 0;
+    for (auto &v : matched) {
+      nrow += v.size();
+    }
+    IntegerMatrix result(nrow, 2);
+    size_t row = 0;
+    for (R_xlen_t i = 0; i < n; i++) {
+      for (int idx : matched[i]) {
+        result(row, 0) = i + 1;
+        result(row, 1) = idx + 1;
+        row++;
+      }
+    }
+    std::vector<std::string> cnames = {"string", "pattern"};
+    colnames(result) = wrap(cnames);
+    return result;
+  }
+
+  List result(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    if (texts[i].data() == NULL) {
+      result[i] = IntegerVector::create(NA_INTEGER);
+      continue;
+    }
+    IntegerVector indices(matched[i].size());
+    for (size_t k = 0; k < matched[i].size(); k++) {
+      indices[k] = matched[i][k] + 1;
+    }
+    result[i] = indices;
+  }
+  return result;
+}
+
+} // namespace re2
+
+//' Match many patterns at once
+//'
+//' @description
+//' A set holds a collection of regular expressions that are matched
+//'   together. \code{re2_set_match} scans each string once, regardless of
+//'   the number of patterns, and reports which patterns match it. This is
+//'   much faster than calling \code{\link{re2_detect}} once per pattern.
+//'
+//' \code{re2_set} creates a set, optionally with an initial vector of
+//'   patterns. \code{re2_set_add} adds patterns, and \code{re2_set_compile}
+//'   compiles the set. Patterns cannot be added after the set is compiled.
+//'   \code{re2_set_match} compiles the set if that has not been done. A
+//'   set that fails to compile (see \verb{max_mem}) cannot be used any
+//'   more; create it again with a larger \verb{max_mem}.
+//'
+//' @param patterns Character vector of regular expressions.
+//' @param anchor One of \verb{"UNANCHORED"} (default), \verb{"ANCHOR_START"}
+//'   (patterns must match at the beginning of string) or
+//'   \verb{"ANCHOR_BOTH"} (patterns must match the entire string).
+//' @param more_options Named list of options applied to all the
+//'   patterns. See \code{\link{re2_regexp}}. The \verb{max_mem} option
+//'   bounds the memory of the combined program and its DFA.
+//' @param set The value obtained from call to \code{re2_set}.
+//' @param string A character vector, or an object which can be coerced
+//'   to one.
+//' @param simplify If FALSE, the default, returns a list. If TRUE,
+//'   returns a two column integer matrix (sparse form), with one row
+//'   per match: the index of the string and the index of the pattern.
+//' @inheritParams re2_match
+//'
+//' @return \code{re2_set} and \code{re2_set_compile} return the set.
+//'   \code{re2_set_add} returns the indices of the added patterns.
+//'   \code{re2_set_match} returns a list of integer vectors: the sorted
+//'   indices of the patterns that match each string (NA if string is NA).
+//'   See \code{simplify}.
+//'
+//' @example inst/examples/set.R
+//'
+//' @seealso
+//'   \code{\link{re2_regexp}} for options to regular expression,
+//'   \link{re2_syntax} for regular expression syntax, and
+//'   \code{\link{re2_detect}} to match a single pattern.
+//'
+// [[Rcpp::export]]
+SEXP re2_set(StringVector patterns = StringVector::create(),
+             std::string anchor = "UNANCHORED",
+             Nullable<List> more_options = R_NilValue) {
+  RE2::Options opt;
+  modify_options(opt, more_options);
+  RE2::Anchor re_anchor;
+  if (anchor == "UNANCHORED") {
+    re_anchor = RE2::UNANCHORED;
+  } else if (anchor == "ANCHOR_START") {
+    re_anchor = RE2::ANCHOR_START;
+  } else if (anchor == "ANCHOR_BOTH") {
+    re_anchor = RE2::ANCHOR_BOTH;
+  } else {
+    const char *fmt = "Expecting valid anchor: [anchor=%s].";
+    throw ::Rcpp::not_compatible(fmt, anchor.c_str());
+  }
+
+  XPtr<RE2Set> xptr(new RE2Set(opt, re_anchor), true, set_tag());
+  add_patterns(*xptr, patterns);
+  return xptr;
+}
+
+//' @rdname re2_set
+// [[Rcpp::export]]
+IntegerVector re2_set_add(SEXP set, StringVector patterns) {
+  RE2Set &re2set = checked_set(set);
+  int first = re2set.size;
+  add_patterns(re2set, patterns);
+  IntegerVector indices(patterns.size());
+  for (int i = 0; i < patterns.size(); i++) {
+    indices[i] = first + i + 1;
+  }
+  return indices;
+}
+
+//' @rdname re2_set
+// [[Rcpp::export]]
+SEXP re2_set_compile(SEXP set) {
+  compile_set(checked_set(set));
+  return set;
+}
+
+//' @rdname re2_set
+// [[Rcpp::export]]
+SEXP re2_set_match(StringVector string, SEXP set, bool simplify = false,
+                   SEXP nthreads = R_NilValue) {
+  RE2Set &re2set = checked_set(set);
+  compile_set(re2set);
+
+  R_xlen_t n = string.size();
+  std::vector<re2::StringPiece> texts(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    SEXP elt = STRING_ELT(string, i);
+    if (elt != NA_STRING) {
+      texts[i] = re2::as_string_piece(elt);
+    }
+  }
+  std::vector<std::vector<int>> matched(n);
+  re2::parallel_for(
+      n, re2::nthreads_option(nthreads), [&](R_xlen_t begin, R_xlen_t end) {
+        for (R_xlen_t i = begin; i < end; i++) {
+          if (texts[i].data() == NULL) {
+            continue;
+          }
+          RE2::Set::ErrorInfo error = {RE2::Set::kNoError};
+          if (!re2set.set.Match(texts[i], &matched[i], &error) &&
+              error.kind != RE2::Set::kNoError) {
+            throw std::runtime_error(
+                "Set ran out of memory while matching; increase max_mem");
+          }
+          std::sort(matched[i].begin(), matched[i].end());
+        }
+      });
+
+  return re2::pattern_indices(texts, matched, simplify);
+}
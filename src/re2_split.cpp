@@ -3,51 +3,139 @@
 
 #include "re2_do_match.h"
 #include "re2_re2proxy.h"
+#include "re2_parallel.h"
+#include "re2_result.h"
 #include <Rcpp.h>
 #include <re2/re2.h>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
 
 using namespace Rcpp;
 
 namespace {
+
+enum class SplitShape { List, Matrix, Long };
+
+// Records where the pieces of each element are, as byte offsets into the
+// element, and makes the result from them once every element is split.
+// Pieces of element i are [first[i], first[i + 1]); an NA element has no
+// pieces. A piece with a negative begin is the whole element.
 struct DoSplit : re2::DoMatchIntf {
-  List &result;
-  int n;
-  int counter;
-  bool _n = false;
-  DoSplit(List &r) : result(r) {}
-  DoSplit(List &r, int n) : result(r), n(n), counter(n), _n(true) {}
-  bool proceed() {
-    if (!_n)
-      return true;
-    return counter-- > 0 ? true : false;
+  StringVector &string;
+  SplitShape shape;
+  size_t n;
+  std::vector<R_xlen_t> first;
+  std::vector<int32_t> bounds;
+  DoSplit(StringVector &s, SplitShape shape, size_t n)
+      : string(s), shape(shape), n(n) {
+    first.reserve(s.size() + 1);
+    first.push_back(0);
   }
-  void match_found(int i, re2::StringPiece &text, re2::RE2Proxy::Adapter &re2,
+  int nsubmatch(re2::RE2Proxy::Adapter &re2) { return 1; }
+  size_t match_limit() { return n; }
+  void add_piece(ptrdiff_t begin, ptrdiff_t end) {
+    bounds.push_back(static_cast<int32_t>(begin));
+    bounds.push_back(static_cast<int32_t>(end));
+  }
+  void match_found(R_xlen_t i, re2::StringPiece &text,
+                   re2::RE2Proxy::Adapter &re2,
                    const re2::AllMatches &all_matches) {
-    counter = n;
-    if (all_matches.size() == 1) {
-      re2::StringPiece *sp_arr = all_matches.at(0);
-      if (sp_arr[0].size() == 0) {
-        result[i] = String(text.as_string());
-        return;
+    if (all_matches.size() == 1 && all_matches.at(0)[0].size() == 0) {
+      add_piece(-1, -1);
+    } else {
+      ptrdiff_t begin = 0;
+      for (size_t row = 0; row < all_matches.size(); row++) {
+        const re2::StringPiece &sp = all_matches[row][0];
+        add_piece(begin, sp.begin() - text.begin());
+        begin = sp.end() - text.begin();
       }
+      add_piece(begin, text.size());
     }
-    StringVector splitted(all_matches.size() + 1);
-    int row = 0;
-    for (; row < all_matches.size(); row++) {
-      re2::StringPiece *sp_arr = all_matches.at(row);
-      size_t size = static_cast<size_t>(sp_arr[0].begin() - text.begin());
-      splitted[row] = String(std::string(text.begin(), size));
-      text.remove_prefix(size + sp_arr[0].size());
+    first.push_back(bounds.size() / 2);
+  }
+  void match_not_found(R_xlen_t i, SEXP text, re2::RE2Proxy::Adapter &re2) {
+    if (text != NA_STRING) {
+      add_piece(-1, -1);
     }
-    splitted[row] = String(text.as_string());
-    result[i] = splitted;
+    first.push_back(bounds.size() / 2);
   }
-  void match_not_found(int i, SEXP text, re2::RE2Proxy::Adapter &re2) {
-    counter = n;
-    result[i] = String(text);
+  R_xlen_t npieces(R_xlen_t i) const { return first[i + 1] - first[i]; }
+  // Piece k (counted over all elements) of element i.
+  SEXP piece(R_xlen_t i, R_xlen_t k) const {
+    SEXP text = STRING_ELT(string, i);
+    const int32_t *b = &bounds[2 * k];
+    return b[0] < 0 ? text : re2::submatch_string(text, b[0], b[1]);
+  }
+  SEXP get() {
+    R_xlen_t size = string.size();
+    if (shape == SplitShape::List) {
+      List result(size);
+      for (R_xlen_t i = 0; i < size; i++) {
+        R_xlen_t np = npieces(i);
+        StringVector pieces(np == 0 ? 1 : np);
+        if (np == 0) {
+          pieces[0] = NA_STRING;
+        }
+        for (R_xlen_t j = 0; j < np; j++) {
+          SET_STRING_ELT(pieces, j, piece(i, first[i] + j));
+        }
+        result[i] = pieces;
+      }
+      return result;
+    }
+    // An NA element takes one cell or row, as in the list.
+    R_xlen_t maxcols = size == 0 ? 0 : 1, nrow = 0;
+    for (R_xlen_t i = 0; i < size; i++) {
+      R_xlen_t np = npieces(i);
+      maxcols = std::max(maxcols, np);
+      nrow += np == 0 ? 1 : np;
+    }
+    if (shape == SplitShape::Matrix) {
+      StringMatrix result(size, maxcols);
+      for (R_xlen_t i = 0; i < size; i++) {
+        R_xlen_t np = npieces(i);
+        for (R_xlen_t j = 0; j < maxcols; j++) {
+          SET_STRING_ELT(result, j * size + i,
+                         j < np ? piece(i, first[i] + j) : NA_STRING);
+        }
+      }
+      return result;
+    }
+    IntegerVector row_id(nrow), piece_id(nrow);
+    StringVector value(nrow);
+    R_xlen_t r = 0;
+    for (R_xlen_t i = 0; i < size; i++) {
+      R_xlen_t np = npieces(i);
+      if (np == 0) {
+        row_id[r] = i + 1;
+        piece_id[r] = 1;
+        value[r++] = NA_STRING;
+      }
+      for (R_xlen_t j = 0; j < np; j++, r++) {
+        row_id[r] = i + 1;
+        piece_id[r] = j + 1;
+        SET_STRING_ELT(value, r, piece(i, first[i] + j));
+      }
+    }
+    return re2::as_data_frame(List::create(Named("string") = row_id,
+                                           Named("piece") = piece_id,
+                                           Named("value") = value),
+                              nrow);
   }
-  SEXP get() { return result; }
 };
+
+SplitShape split_shape(SEXP simplify) {
+  if (TYPEOF(simplify) != STRSXP) {
+    return as<bool>(simplify) ? SplitShape::Matrix : SplitShape::List;
+  }
+  if (Rf_length(simplify) != 1 ||
+      std::strcmp(R_CHAR(STRING_ELT(simplify, 0)), "long") != 0) {
+    throw std::invalid_argument("simplify must be TRUE, FALSE or \"long\"");
+  }
+  return SplitShape::Long;
+}
+
 } // namespace
 
 //' Split string based on pattern
@@ -57,47 +145,32 @@ struct DoSplit : re2::DoMatchIntf {
 //'
 //' @inheritParams re2_match
 //' @param simplify If FALSE, the default, return a list of string vectors.
-//'   If TRUE, return a string matrix.
+//'   If TRUE, return a string matrix. If "long", return a data frame with
+//'   one row per piece and columns \code{string} (index of the string),
+//'   \code{piece} (index of the piece within the string) and \code{value}.
 //' @param n Number of string pieces to return. Default (Inf) returns all.
 //'
-//' @return A list of string vectors or a string matrix. See option.
+//' @return A list of string vectors, a string matrix or a data frame. See
+//'   option simplify.
 //'
 //' @example inst/examples/split.R
-//' @usage re2_split(string, pattern, simplify = FALSE, n = Inf)
+//' @usage re2_split(string, pattern, simplify = FALSE, n = Inf, nthreads = NULL)
 //'
 //' @seealso
 //'   \code{\link{re2_regexp}} for options to regular expression,
 //'   \link{re2_syntax} for regular expression syntax, and
 //'   \code{\link{re2_match}} to extract matched groups.
 //'
-// [[Rcpp::export(signature={string, pattern, simplify=FALSE, n=Inf})]]
-SEXP re2_split(StringVector string, SEXP pattern, bool simplify, double n) {
-  if (simplify) {
-    List lst = re2_split(string, pattern, false, n);
-    int maxcols = 0;
-    for (int i = 0; i < lst.size(); i++) {
-      StringVector sv(lst(i));
-      if (sv.size() > maxcols) {
-        maxcols = sv.size();
-      }
-    }
-    StringMatrix result(string.size(), maxcols);
-    for (int row = 0; row < lst.size(); row++) {
-      StringVector sv(lst(row));
-      int sv_size = sv.size();
-      for (int col = 0; col < maxcols; col++) {
-        result(row, col) = col < sv_size ? String(sv(col)) : NA_STRING;
-      }
-    }
-    return result;
-  } else {
-    List result(string.size());
-    if (n == R_PosInf || n < 0) {
-      DoSplit doer(result);
-      return re2_do_match(string, pattern, doer);
-    } else {
-      DoSplit doer(result, std::round(n - 1));
-      return re2_do_match(string, pattern, doer);
-    }
+// [[Rcpp::export(signature={string, pattern, simplify=FALSE, n=Inf, nthreads=NULL})]]
+SEXP re2_split(StringVector string, SEXP pattern, SEXP simplify, double n,
+               SEXP nthreads) {
+  SplitShape shape = split_shape(simplify);
+  int nthr = re2::nthreads_option(nthreads);
+  size_t limit = SIZE_MAX;
+  if (n != R_PosInf && n >= 0) {
+    // n pieces take n - 1 matches; n = 0 leaves the string whole, like 1.
+    limit = n < 1 ? 0 : static_cast<size_t>(std::round(n - 1));
   }
+  DoSplit doer(string, shape, limit);
+  return re2_do_match(string, pattern, doer, nthr);
 }
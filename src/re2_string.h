@@ -0,0 +1,19 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#ifndef RE2_STRING_H_
+#define RE2_STRING_H_
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+
+namespace re2 {
+
+// View of the bytes of a CHARSXP. R stores the length of every string,
+// so there is no need to scan for the terminating NUL.
+inline StringPiece as_string_piece(SEXP charsxp) {
+  return StringPiece(R_CHAR(charsxp), LENGTH(charsxp));
+}
+
+} // namespace re2
+#endif
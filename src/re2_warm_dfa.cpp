@@ -0,0 +1,76 @@
+// Copyright (c) 2021 Girish Palya
+// License: https://github.com/girishji/re2/blob/main/LICENSE.md
+
+#include <Rcpp.h>
+#include <re2/re2.h>
+#include "re2_regexp.h"
+
+using namespace Rcpp;
+
+//' Build the DFA of a compiled regexp ahead of time
+//'
+//' @description
+//' RE2 builds the states of its DFA (the execution engine that implements
+//'   Deterministic Finite Automaton search) lazily, while matching. The
+//'   first strings matched by a regexp pay for constructing the states
+//'   they visit. \code{re2_warm_dfa} builds the states reachable from the
+//'   start of a search eagerly, so that later calls to matching functions
+//'   with this regexp find them already built.
+//'
+//' States are kept in a cache bounded by the \verb{max_mem} option of
+//'   \code{\link{re2_regexp}}. If the cache fills up before all the states
+//'   are built, building stops and \code{complete} is FALSE; matching then
+//'   continues to build states lazily. Increase \verb{max_mem} to hold a
+//'   larger DFA.
+//'
+//' With \code{flat = TRUE}, the complete DFA is also copied into a flat
+//'   transition table (one row per state, one column per byte class).
+//'   Matching then runs a tight loop over the table that never builds
+//'   states or takes the lock guarding the state cache, which pays off for
+//'   a few hot patterns matched against a lot of text, especially from
+//'   several threads. If the DFA has more than \code{max_states} states
+//'   (10000 if \code{max_states} is 0), no table is built and \code{flat}
+//'   is FALSE in the result; matching then uses the lazily built DFA as
+//'   usual. Each state takes 4 bytes per byte class of the pattern. The
+//'   tables are saved with the regexp by \code{saveRDS} and
+//'   \code{re2_serialize}.
+//'
+//' @param re2ptr The value obtained from call to \code{\link{re2_regexp}}.
+//' @param reverse If TRUE, also build the reverse DFA, which is used to
+//'   locate the start of a match (\code{re2_match}, \code{re2_locate},
+//'   \code{re2_replace}, ...). \code{re2_detect} needs only the forward
+//'   DFA.
+//' @param max_states Stop after building this many states per DFA. 0 (the
+//'   default) builds as many as fit in memory.
+//' @param flat If TRUE, also build flat transition tables; see Details.
+//'
+//' @return A list with elements \code{states}, the number of states built,
+//'   and \code{complete}, FALSE if building stopped at \code{max_states} or
+//'   at the memory limit. With \code{flat = TRUE}, the list also has an
+//'   element \code{flat}, TRUE if the tables were built.
+//'
+//' @example inst/examples/warm_dfa.R
+//'
+//' @seealso \code{\link{re2_regexp}}.
+//'
+// [[Rcpp::export]]
+List re2_warm_dfa(SEXP re2ptr, bool reverse = false, int max_states = 0,
+                  bool flat = false) {
+  if (max_states == NA_INTEGER || max_states < 0) {
+    throw std::invalid_argument("max_states must be a non-negative integer");
+  }
+
+  const RE2 *re = re2::regexp_ptr(re2ptr);
+  bool complete = false;
+  int states = re->WarmDFA(reverse, max_states, &complete);
+  if (!flat) {
+    return List::create(Named("states") = states,
+                        Named("complete") = complete);
+  }
+  bool built = re->BuildFlatDFA(reverse, max_states > 0 ? max_states : 10000);
+  if (built) {
+    re2::save_regexp(re2ptr, reverse);
+  }
+  return List::create(Named("states") = states, Named("complete") = complete,
+                      Named("flat") = built);
+}
@@ -88,11 +88,11 @@ BitState::BitState(Prog* prog)
 // If so, remember that it was visited so that the next time,
 // we don't repeat the visit.
 bool BitState::ShouldVisit(int id, const char* p) {
-  int n = prog_->list_heads()[id] * static_cast<int>(text_.size()+1) +
-          static_cast<int>(p-text_.data());
-  if (visited_[n/kVisitedBits] & (uint64_t{1} << (n & (kVisitedBits-1))))
+  size_t n = prog_->list_heads()[id] * (text_.size()+1) +
+             static_cast<size_t>(p-text_.data());
+  if (visited_[static_cast<int>(n/kVisitedBits)] & (uint64_t{1} << (n & (kVisitedBits-1))))
     return false;
-  visited_[n/kVisitedBits] |= uint64_t{1} << (n & (kVisitedBits-1));
+  visited_[static_cast<int>(n/kVisitedBits)] |= uint64_t{1} << (n & (kVisitedBits-1));
   return true;
 }
 
@@ -306,8 +306,10 @@ bool BitState::Search(const StringPiece& text, const StringPiece& context,
     submatch_[i] = StringPiece();
 
   // Allocate scratch space.
-  int nvisited = prog_->list_count() * static_cast<int>(text.size()+1);
-  nvisited = (nvisited + kVisitedBits-1) / kVisitedBits;
+  // The bitmap covers just text, not context: RE2 passes the span located
+  // by the DFA, so long texts with short matches need only small bitmaps.
+  size_t nbits = prog_->list_count() * (text.size()+1);
+  int nvisited = static_cast<int>((nbits + kVisitedBits-1) / kVisitedBits);
   visited_ = PODArray<uint64_t>(nvisited);
   memset(visited_.data(), 0, nvisited*sizeof visited_[0]);
 
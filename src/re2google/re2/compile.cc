@@ -10,11 +10,14 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "util/logging.h"
 #include "util/utf.h"
+#include "re2/literal_accel.h"
 #include "re2/pod_array.h"
 #include "re2/prog.h"
 #include "re2/re2.h"
@@ -1136,6 +1139,20 @@ Prog* Compiler::Compile(Regexp* re, bool reversed, int64_t max_mem) {
   return c.Finish(re);
 }
 
+// Limits on the literals used by LiteralAccel.
+static const size_t kMaxAccelPrefixLen = 8;
+static const size_t kMaxAccelPrefixes = 10000;
+
+// Whether prefix accel for prefixes would skip enough of the text to be
+// worth it: memchr is only fast for a few bytes, so neither is looking
+// for many one-byte prefixes.
+static bool IsSelective(const std::vector<std::string>& prefixes) {
+  int short_prefixes = 0;
+  for (const std::string& prefix : prefixes)
+    short_prefixes += prefix.size() == 1;
+  return short_prefixes <= 3;
+}
+
 Prog* Compiler::Finish(Regexp* re) {
   if (failed_)
     return NULL;
@@ -1156,11 +1173,22 @@ Prog* Compiler::Finish(Regexp* re) {
   if (!prog_->reversed()) {
     std::string prefix;
     bool prefix_foldcase;
-    if (re->RequiredPrefixForAccel(&prefix, &prefix_foldcase) &&
-        !prefix_foldcase) {
+    if (re->RequiredPrefixForAccel(&prefix, &prefix_foldcase)) {
       prog_->prefix_size_ = prefix.size();
-      prog_->prefix_front_ = prefix.front();
-      prog_->prefix_back_ = prefix.back();
+      prog_->prefix_foldcase_ = prefix_foldcase;
+      prog_->prefix_front_ = static_cast<uint8_t>(prefix.front());
+      prog_->prefix_back_ = static_cast<uint8_t>(prefix.back());
+    } else if (!prog_->anchor_start()) {
+      // Matches might instead begin with one of several literals.
+      std::vector<std::string> prefixes;
+      if (re->RequiredPrefixesForAccel(&prefixes, &prefix_foldcase,
+                                       kMaxAccelPrefixLen,
+                                       kMaxAccelPrefixes) &&
+          IsSelective(prefixes)) {
+        int64_t budget = max_mem_ <= 0 ? 1<<20 : max_mem_/4;
+        prog_->literal_accel_ =
+            LiteralAccel::New(prefixes, prefix_foldcase, budget);
+      }
     }
   }
 
@@ -1172,6 +1200,8 @@ Prog* Compiler::Finish(Regexp* re) {
     m -= prog_->size_*sizeof(Prog::Inst);  // account for inst_
     if (prog_->CanBitState())
       m -= prog_->size_*sizeof(uint16_t);  // account for list_heads_
+    if (prog_->literal_accel_ != NULL)
+      m -= prog_->literal_accel_->MemoryUsage();
     if (m < 0)
       m = 0;
     prog_->set_dfa_mem(m);
@@ -28,6 +28,7 @@
 #include <algorithm>
 #include <atomic>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <new>
 #include <string>
@@ -43,6 +44,7 @@
 #include "re2/pod_array.h"
 #include "re2/prog.h"
 #include "re2/re2.h"
+#include "re2/serial.h"
 #include "re2/sparse_set.h"
 #include "re2/stringpiece.h"
 
@@ -60,6 +62,48 @@ static bool dfa_should_bail_when_slow = true;
 // Generates a lot of output -- only useful for debugging.
 static const bool ExtraDebug = false;
 
+// A reader-writer mutex for data that is read by many threads at once and
+// written rarely. It is split into shards, and a reader locks only the
+// shard assigned to its thread, so concurrent readers do not bounce a
+// shared lock word between their caches. A writer locks every shard.
+class ShardedMutex {
+ public:
+  ShardedMutex() {}
+
+  void ReaderLock() { shards_[Shard()].mu.ReaderLock(); }
+  void ReaderUnlock() { shards_[Shard()].mu.ReaderUnlock(); }
+  void WriterLock() {
+    for (int i = 0; i < kShards; i++)
+      shards_[i].mu.WriterLock();
+  }
+  void WriterUnlock() {
+    for (int i = kShards - 1; i >= 0; i--)
+      shards_[i].mu.WriterUnlock();
+  }
+
+ private:
+  static const int kShards = 8;
+
+  // Threads are assigned shards round robin, on first use.
+  static int Shard() {
+    static std::atomic<int> next_shard(0);
+    thread_local int shard =
+        next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return shard;
+  }
+
+  // The padding keeps any two shards off the same cache line, whatever
+  // the alignment of the ShardedMutex.
+  struct PaddedMutex {
+    Mutex mu;
+    char padding[64];
+  };
+  PaddedMutex shards_[kShards];
+
+  ShardedMutex(const ShardedMutex&) = delete;
+  ShardedMutex& operator=(const ShardedMutex&) = delete;
+};
+
 // A DFA implementation of a regular expression program.
 // Since this is entirely a forward declaration mandated by C++,
 // some of the comments here are better understood after reading
@@ -88,11 +132,41 @@ class DFA {
               bool anchored, bool want_earliest_match, bool run_forward,
               bool* failed, const char** ep, SparseSet* matches);
 
+  // Searches each of texts[0, n) forward, as its own context, setting
+  // matched[i] and, if epp is not NULL, epp[i] as Search would. Sets
+  // failed[i] (and clears matched[i]) if the search of texts[i] could
+  // not be completed. The cache lock is taken only once for the batch,
+  // and earliest-match searches with a flat table advance several texts
+  // in lockstep, so that their table lookups overlap.
+  void SearchBatch(const StringPiece* texts, size_t n, bool anchored,
+                   bool want_earliest_match, bool* matched, bool* failed,
+                   const char** epp);
+
   // Builds out all states for the entire DFA.
   // If cb is not empty, it receives one callback per state built.
-  // Returns the number of states built.
-  // FOR TESTING OR EXPERIMENTAL PURPOSES ONLY.
-  int BuildAllStates(const Prog::DFAStateCallback& cb);
+  // Starts from the state for an anchored search if anchored is true.
+  // If max_states > 0, stops once that many states have been built.
+  // If complete is not NULL, sets *complete to whether every state
+  // was built. Returns the number of states built.
+  int BuildAllStates(const Prog::DFAStateCallback& cb, bool anchored = false,
+                     int max_states = 0, bool* complete = NULL);
+
+  // Copies the entire DFA for anchored or unanchored searches into a
+  // flat transition table. Search then uses the table instead of the
+  // state cache, without locking. Returns false (and builds nothing) if
+  // the DFA has more than max_states states or runs out of memory.
+  bool BuildFlatTable(bool anchored, int max_states);
+
+  // Writes the flat tables built by BuildFlatTable to w, or reads the
+  // ones written by SerializeFlatTables from r. A table read for a DFA
+  // that failed to initialise is checked and dropped. Returns false if
+  // r fails or a table is malformed.
+  void SerializeFlatTables(SerialWriter* w);
+  bool DeserializeFlatTables(SerialReader* r);
+  bool HasFlatTable() const {
+    return flat_[0].load(std::memory_order_acquire) != NULL ||
+           flat_[1].load(std::memory_order_acquire) != NULL;
+  }
 
   // Computes min and max for matching strings.  Won't return strings
   // bigger than maxlen.
@@ -103,6 +177,7 @@ class DFA {
   class RWLocker;
   class StateSaver;
   class Workq;
+  struct FlatTable;
 
   // A single DFA state.  The DFA is represented as a graph of these
   // States, linked by the next_ pointers.  If in state s and reading
@@ -168,8 +243,9 @@ class DFA {
   typedef std::unordered_set<State*, StateHash, StateEqual> StateSet;
 
  private:
-  // Make it easier to swap in a scalable reader-writer mutex.
-  using CacheMutex = Mutex;
+  // Every search holds cache_mutex_ for reading, so it must scale with
+  // the number of threads searching with the same DFA.
+  using CacheMutex = ShardedMutex;
 
   enum {
     // Indices into start_ for unanchored searches.
@@ -341,6 +417,21 @@ class DFA {
   StateSet state_cache_;   // All States computed so far.
   StartInfo start_[kMaxStart];
 
+  // Flat transition tables built by BuildFlatTable, indexed by anchored.
+  // Immutable once published.
+  std::atomic<FlatTable*> flat_[2];
+
+  // Search using a flat transition table.
+  bool FlatSearch(const FlatTable* flat, const StringPiece& text,
+                  const StringPiece& context, bool want_earliest_match,
+                  bool run_forward, const char** epp);
+
+  // Earliest-match forward search of a batch using a flat table
+  // without prefix acceleration.
+  void FlatSearchEarliestBatch(const FlatTable* flat,
+                               const StringPiece* texts, size_t n,
+                               bool* matched);
+
   DFA(const DFA&) = delete;
   DFA& operator=(const DFA&) = delete;
 };
@@ -417,6 +508,29 @@ class DFA::Workq : public SparseSet {
   Workq& operator=(const Workq&) = delete;
 };
 
+// Flat transition table: a copy of the entire DFA in one array, so that
+// searching needs neither the state cache nor its locks.
+//
+// Row r of next occupies next[r*stride, (r+1)*stride). Its first
+// stride-1 entries are the row offsets (r'*stride) of the next states,
+// indexed by byte class, with kByteEndText last; its final entry holds
+// the kFlat* flags of the state. Row 0 is DeadState and row 1 is
+// FullMatchState.
+struct DFA::FlatTable {
+  enum {
+    kFlatMatch = 1,  // matching state
+    kFlatDead = 2,   // no match is possible from here
+    kFlatFull = 4,   // the rest of the text matches
+  };
+
+  int stride;
+  std::vector<uint32_t> next;
+  // Start rows and whether prefix acceleration applies to them, indexed
+  // by kStartBeginText, ... divided by 2.
+  uint32_t start[kMaxStart/2];
+  bool can_prefix_accel[kMaxStart/2];
+};
+
 DFA::DFA(Prog* prog, Prog::MatchKind kind, int64_t max_mem)
   : prog_(prog),
     kind_(kind),
@@ -424,6 +538,8 @@ DFA::DFA(Prog* prog, Prog::MatchKind kind, int64_t max_mem)
     q0_(NULL),
     q1_(NULL),
     mem_budget_(max_mem) {
+  for (int i = 0; i < 2; i++)
+    flat_[i].store(NULL, std::memory_order_relaxed);
   if (ExtraDebug)
     fprintf(stderr, "\nkind %d\n%s\n", kind_, prog_->DumpUnanchored().c_str());
   int nmark = 0;
@@ -470,6 +586,8 @@ DFA::~DFA() {
   delete q0_;
   delete q1_;
   ClearCache();
+  for (int i = 0; i < 2; i++)
+    delete flat_[i].load(std::memory_order_relaxed);
 }
 
 // In the DFA state graph, s->next[c] == NULL means that the
@@ -1120,6 +1238,11 @@ class DFA::RWLocker {
   // Notice that the lock is *released* temporarily.
   void LockForWriting();
 
+  // If the lock is held for writing right now, drop the write lock
+  // and re-acquire for reading, so that other threads can search
+  // again. The caller must not hold on to any State* from before.
+  void LockForReading();
+
  private:
   CacheMutex* mu_;
   bool writing_;
@@ -1142,6 +1265,15 @@ void DFA::RWLocker::LockForWriting() NO_THREAD_SAFETY_ANALYSIS {
   }
 }
 
+// Marked NO_THREAD_SAFETY_ANALYSIS for the same reason.
+void DFA::RWLocker::LockForReading() NO_THREAD_SAFETY_ANALYSIS {
+  if (writing_) {
+    mu_->WriterUnlock();
+    mu_->ReaderLock();
+    writing_ = false;
+  }
+}
+
 DFA::RWLocker::~RWLocker() {
   if (!writing_)
     mu_->ReaderUnlock();
@@ -1741,6 +1873,13 @@ bool DFA::Search(const StringPiece& text,
   }
   *failed = false;
 
+  if (matches == NULL) {
+    const FlatTable* flat = flat_[anchored].load(std::memory_order_acquire);
+    if (flat != NULL)
+      return FlatSearch(flat, text, context, want_earliest_match,
+                        run_forward, epp);
+  }
+
   if (ExtraDebug) {
     fprintf(stderr, "\nprogram:\n%s\n", prog_->DumpUnanchored().c_str());
     fprintf(stderr, "text %s anchored=%d earliest=%d fwd=%d kind %d\n",
@@ -1778,6 +1917,445 @@ bool DFA::Search(const StringPiece& text,
   return ret;
 }
 
+void DFA::SearchBatch(const StringPiece* texts, size_t n, bool anchored,
+                      bool want_earliest_match, bool* matched, bool* failed,
+                      const char** epp) {
+  if (epp != NULL) {
+    for (size_t i = 0; i < n; i++)
+      epp[i] = NULL;
+  }
+  for (size_t i = 0; i < n; i++) {
+    matched[i] = false;
+    failed[i] = !ok();
+  }
+  if (!ok() || n == 0)
+    return;
+
+  const FlatTable* flat = flat_[anchored].load(std::memory_order_acquire);
+  if (flat != NULL) {
+    // Prefix acceleration skips most of each text anyway, and calling it
+    // from the lockstep loop costs more than the overlap gains.
+    if (want_earliest_match && epp == NULL &&
+        !flat->can_prefix_accel[kStartBeginText/2]) {
+      FlatSearchEarliestBatch(flat, texts, n, matched);
+      return;
+    }
+    const char* ep;
+    for (size_t i = 0; i < n; i++) {
+      matched[i] = FlatSearch(flat, texts[i], texts[i], want_earliest_match,
+                              true, &ep);
+      if (epp != NULL)
+        epp[i] = ep;
+    }
+    return;
+  }
+
+  RWLocker l(&cache_mutex_);
+  for (size_t i = 0; i < n; i++) {
+    // A cache reset during the previous text left the lock held for
+    // writing; the rest of the batch need not keep other threads out.
+    l.LockForReading();
+    SearchParams params(texts[i], texts[i], &l);
+    params.anchored = anchored;
+    params.want_earliest_match = want_earliest_match;
+    params.run_forward = true;
+
+    if (!AnalyzeSearch(&params)) {
+      failed[i] = true;
+      continue;
+    }
+    if (params.start == DeadState)
+      continue;
+    if (params.start == FullMatchState) {
+      matched[i] = true;
+      if (epp != NULL)
+        epp[i] = want_earliest_match ? texts[i].data()
+                                     : texts[i].data() + texts[i].size();
+      continue;
+    }
+    bool ret = FastSearchLoop(&params);
+    if (params.failed) {
+      // FastSearchLoop may have reset the cache, which is fine: the next
+      // text starts over from AnalyzeSearch.
+      failed[i] = true;
+      continue;
+    }
+    matched[i] = ret;
+    if (epp != NULL)
+      epp[i] = params.ep;
+  }
+}
+
+void DFA::FlatSearchEarliestBatch(const FlatTable* flat,
+                                  const StringPiece* texts, size_t n,
+                                  bool* matched) {
+  const uint32_t* next = flat->next.data();
+  const int flagcol = flat->stride - 1;
+  const uint32_t s0 = flat->start[kStartBeginText/2];
+  const uint8_t* bytemap = prog_->bytemap();
+  const int endtext = ByteMap(kByteEndText);
+
+  uint32_t flags = next[s0 + flagcol];
+  if (flags != 0) {
+    // The answer does not depend on the text.
+    bool ret = (flags & FlatTable::kFlatDead) == 0;
+    for (size_t i = 0; i < n; i++)
+      matched[i] = ret;
+    return;
+  }
+
+  // Each lane walks one text. The lanes' table lookups are independent,
+  // so the CPU can have several of them in flight at once; a single
+  // search has to wait for each lookup before it can start the next.
+  struct Lane {
+    const uint8_t* p;
+    const uint8_t* ep;
+    uint32_t s;
+    size_t i;
+  };
+  static const int kLanes = 4;
+  Lane lanes[kLanes];
+  int nlanes = 0;
+  size_t k = 0;  // next text to start
+  for (; nlanes < kLanes && k < n; k++) {
+    Lane& lane = lanes[nlanes++];
+    lane.p = BytePtr(texts[k].data());
+    lane.ep = BytePtr(texts[k].data() + texts[k].size());
+    lane.s = s0;
+    lane.i = k;
+  }
+
+  while (nlanes > 0) {
+    for (int j = 0; j < nlanes;) {
+      Lane& lane = lanes[j];
+      if (lane.p != lane.ep) {
+        lane.s = next[lane.s + bytemap[*lane.p++]];
+        flags = next[lane.s + flagcol];
+        if (flags == 0) {
+          j++;
+          continue;
+        }
+      } else {
+        flags = next[next[lane.s + endtext] + flagcol];
+      }
+
+      // This text is done: the DFA is in a dead, full match or matching
+      // state, or has seen the end of the text.
+      matched[lane.i] = (flags & (FlatTable::kFlatMatch |
+                                  FlatTable::kFlatFull)) != 0;
+      if (k < n) {
+        lane.p = BytePtr(texts[k].data());
+        lane.ep = BytePtr(texts[k].data() + texts[k].size());
+        lane.s = s0;
+        lane.i = k++;
+        j++;
+      } else {
+        lane = lanes[--nlanes];
+      }
+    }
+  }
+}
+
+bool DFA::BuildFlatTable(bool anchored, int max_states) {
+  if (!ok() || kind_ == Prog::kManyMatch)
+    return false;
+  if (flat_[anchored].load(std::memory_order_acquire) != NULL)
+    return true;
+
+  std::unique_ptr<FlatTable> flat(new FlatTable);
+  int nnext = prog_->bytemap_range() + 1;  // + 1 for kByteEndText slot
+  int stride = nnext + 1;                  // + 1 for flags
+  flat->stride = stride;
+  if (max_states < 0 ||
+      (static_cast<uint64_t>(max_states) + 2) * stride > 0xFFFFFFFFu)
+    return false;
+
+  // Input bytes covering all of the next pointers, as in BuildAllStates.
+  std::vector<int> input(nnext);
+  for (int c = 0; c < 256; c++) {
+    int b = prog_->bytemap()[c];
+    while (c < 256-1 && prog_->bytemap()[c+1] == b)
+      c++;
+    input[b] = c;
+  }
+  input[prog_->bytemap_range()] = kByteEndText;
+
+  RWLocker l(&cache_mutex_);
+  SearchParams params(StringPiece(), StringPiece(), &l);
+  params.anchored = anchored;
+
+  // State pointers point into the cache, which cannot be reset while
+  // we hold cache_mutex_ for reading.
+  std::unordered_map<State*, uint32_t> rows;
+  std::deque<State*> q;
+  std::vector<uint32_t>& next = flat->next;
+  auto row = [&](State* s) -> uint32_t {
+    auto it = rows.find(s);
+    if (it != rows.end())
+      return it->second;
+    uint32_t r = static_cast<uint32_t>(rows.size());
+    rows.emplace(s, r);
+    next.resize(next.size() + stride);
+    if (s > SpecialStateMax)
+      q.push_back(s);
+    return r;
+  };
+  row(DeadState);
+  row(FullMatchState);
+  for (int i = 0; i < stride - 1; i++) {
+    next[i] = 0;
+    next[stride + i] = 1;
+  }
+  next[stride - 1] = FlatTable::kFlatDead;
+  next[2*stride - 1] = FlatTable::kFlatFull | FlatTable::kFlatMatch;
+
+  static const uint32_t kStartFlags[kMaxStart/2] = {
+    kEmptyBeginText|kEmptyBeginLine,  // kStartBeginText
+    kEmptyBeginLine,                  // kStartBeginLine
+    kFlagLastWord,                    // kStartAfterWordChar
+    0,                                // kStartAfterNonWordChar
+  };
+  for (int i = 0; i < kMaxStart/2; i++) {
+    StartInfo* info = &start_[2*i | (anchored ? kStartAnchored : 0)];
+    if (!AnalyzeSearchHelper(&params, info, kStartFlags[i]))
+      return false;
+    State* start = info->start.load(std::memory_order_acquire);
+    flat->start[i] = row(start);
+    flat->can_prefix_accel[i] = prog_->can_prefix_accel() &&
+                                !anchored &&
+                                start > SpecialStateMax &&
+                                start->flag_ >> kFlagNeedShift == 0;
+  }
+
+  // Flood to expand every state.
+  while (!q.empty()) {
+    if (static_cast<int>(rows.size()) - 2 > max_states)
+      return false;
+    State* s = q.front();
+    q.pop_front();
+    uint32_t r = rows[s];
+    for (int c : input) {
+      State* ns = RunStateOnByteUnlocked(s, c);
+      if (ns == NULL)  // out of memory
+        return false;
+      uint32_t nr = row(ns);
+      next[r*stride + ByteMap(c)] = nr;
+    }
+    next[r*stride + stride-1] = s->IsMatch() ? FlatTable::kFlatMatch : 0;
+  }
+  if (static_cast<int>(rows.size()) - 2 > max_states)
+    return false;
+
+  // Turn row numbers into row offsets.
+  for (uint32_t r = 0; r < rows.size(); r++)
+    for (int i = 0; i < stride - 1; i++)
+      next[r*stride + i] *= stride;
+  for (int i = 0; i < kMaxStart/2; i++)
+    flat->start[i] *= stride;
+
+  FlatTable* expected = NULL;
+  if (flat_[anchored].compare_exchange_strong(expected, flat.get(),
+                                              std::memory_order_acq_rel))
+    flat.release();
+  return true;
+}
+
+void DFA::SerializeFlatTables(SerialWriter* w) {
+  for (int anchored = 0; anchored < 2; anchored++) {
+    const FlatTable* flat = flat_[anchored].load(std::memory_order_acquire);
+    w->PutByte(flat != NULL);
+    if (flat == NULL)
+      continue;
+    w->Put32(flat->stride);
+    w->Put32(static_cast<uint32_t>(flat->next.size()));
+    for (uint32_t v : flat->next)
+      w->Put32(v);
+    for (int i = 0; i < kMaxStart/2; i++) {
+      w->Put32(flat->start[i]);
+      w->PutByte(flat->can_prefix_accel[i]);
+    }
+  }
+}
+
+bool DFA::DeserializeFlatTables(SerialReader* r) {
+  for (int anchored = 0; anchored < 2; anchored++) {
+    if (r->GetByte() == 0)
+      continue;
+    std::unique_ptr<FlatTable> flat(new FlatTable);
+    flat->stride = static_cast<int>(r->Get32());
+    uint32_t size = r->Get32();
+    if (flat->stride != prog_->bytemap_range() + 2 ||
+        size % flat->stride != 0 || size < 2u * flat->stride ||
+        !r->CanRead(size, 4))
+      return false;
+    // Every next entry must be the offset of a row, and every flags
+    // entry a combination of the kFlat* flags.
+    std::vector<uint32_t>& next = flat->next;
+    next.resize(size);
+    for (uint32_t i = 0; i < size; i++) {
+      uint32_t v = r->Get32();
+      if (i % flat->stride == static_cast<uint32_t>(flat->stride - 1)
+              ? v > (FlatTable::kFlatMatch | FlatTable::kFlatDead |
+                     FlatTable::kFlatFull)
+              : v >= size || v % flat->stride != 0)
+        return false;
+      next[i] = v;
+    }
+    for (int i = 0; i < kMaxStart/2; i++) {
+      flat->start[i] = r->Get32();
+      // Prefix accel may not have survived; see Prog::Deserialize.
+      flat->can_prefix_accel[i] = r->GetByte() != 0 &&
+                                  prog_->can_prefix_accel();
+      if (flat->start[i] >= size || flat->start[i] % flat->stride != 0)
+        return false;
+    }
+    if (!r->ok())
+      return false;
+    FlatTable* expected = NULL;
+    if (ok() && flat_[anchored].compare_exchange_strong(
+                    expected, flat.get(), std::memory_order_acq_rel))
+      flat.release();
+  }
+  return r->ok();
+}
+
+// Mirrors AnalyzeSearch and InlinedSearchLoop, reading transitions from
+// the flat table.
+bool DFA::FlatSearch(const FlatTable* flat, const StringPiece& text,
+                     const StringPiece& context, bool want_earliest_match,
+                     bool run_forward, const char** epp) {
+  if (text.begin() < context.begin() || text.end() > context.end()) {
+    LOG(DFATAL) << "context does not contain text";
+    return false;
+  }
+
+  int start;
+  if (run_forward) {
+    if (text.begin() == context.begin())
+      start = kStartBeginText;
+    else if (text.begin()[-1] == '\n')
+      start = kStartBeginLine;
+    else if (Prog::IsWordChar(text.begin()[-1] & 0xFF))
+      start = kStartAfterWordChar;
+    else
+      start = kStartAfterNonWordChar;
+  } else {
+    if (text.end() == context.end())
+      start = kStartBeginText;
+    else if (text.end()[0] == '\n')
+      start = kStartBeginLine;
+    else if (Prog::IsWordChar(text.end()[0] & 0xFF))
+      start = kStartAfterWordChar;
+    else
+      start = kStartAfterNonWordChar;
+  }
+  start /= 2;
+
+  const uint32_t* next = flat->next.data();
+  const int flagcol = flat->stride - 1;
+  const uint32_t s0 = flat->start[start];
+  const bool can_prefix_accel = flat->can_prefix_accel[start];
+  uint32_t flags = next[s0 + flagcol];
+  if (flags & FlatTable::kFlatDead)
+    return false;
+  if (flags & FlatTable::kFlatFull) {
+    if (run_forward == want_earliest_match)
+      *epp = text.data();
+    else
+      *epp = text.data() + text.size();
+    return true;
+  }
+
+  const uint8_t* p = BytePtr(text.data());
+  const uint8_t* ep = BytePtr(text.data() + text.size());
+  if (!run_forward) {
+    using std::swap;
+    swap(p, ep);
+  }
+  const uint8_t* bytemap = prog_->bytemap();
+  const uint8_t* lastmatch = NULL;
+  bool matched = false;
+
+  uint32_t s = s0;
+  if (flags & FlatTable::kFlatMatch) {
+    matched = true;
+    lastmatch = p;
+    if (want_earliest_match) {
+      *epp = reinterpret_cast<const char*>(lastmatch);
+      return true;
+    }
+  }
+
+  while (p != ep) {
+    if (can_prefix_accel && s == s0) {
+      p = BytePtr(prog_->PrefixAccel(p, ep - p));
+      if (p == NULL) {
+        p = ep;
+        break;
+      }
+    }
+
+    int c;
+    if (run_forward)
+      c = *p++;
+    else
+      c = *--p;
+
+    s = next[s + bytemap[c]];
+    flags = next[s + flagcol];
+    if (flags == 0)
+      continue;
+    if (flags & FlatTable::kFlatDead) {
+      *epp = reinterpret_cast<const char*>(lastmatch);
+      return matched;
+    }
+    if (flags & FlatTable::kFlatFull) {
+      *epp = reinterpret_cast<const char*>(ep);
+      return true;
+    }
+    // The DFA notices the match one byte late.
+    matched = true;
+    if (run_forward)
+      lastmatch = p - 1;
+    else
+      lastmatch = p + 1;
+    if (want_earliest_match) {
+      *epp = reinterpret_cast<const char*>(lastmatch);
+      return true;
+    }
+  }
+
+  // Process one more byte to see if it triggers a match.
+  int lastbyte;
+  if (run_forward) {
+    if (text.end() == context.end())
+      lastbyte = kByteEndText;
+    else
+      lastbyte = text.end()[0] & 0xFF;
+  } else {
+    if (text.begin() == context.begin())
+      lastbyte = kByteEndText;
+    else
+      lastbyte = text.begin()[-1] & 0xFF;
+  }
+  s = next[s + ByteMap(lastbyte)];
+  flags = next[s + flagcol];
+  if (flags & FlatTable::kFlatDead) {
+    *epp = reinterpret_cast<const char*>(lastmatch);
+    return matched;
+  }
+  if (flags & FlatTable::kFlatFull) {
+    *epp = reinterpret_cast<const char*>(ep);
+    return true;
+  }
+  if (flags & FlatTable::kFlatMatch) {
+    matched = true;
+    lastmatch = p;
+  }
+  *epp = reinterpret_cast<const char*>(lastmatch);
+  return matched;
+}
+
 DFA* Prog::GetDFA(MatchKind kind) {
   // For a forward DFA, half the memory goes to each DFA.
   // However, if it is a "many match" DFA, then there is
@@ -1895,20 +2473,52 @@ bool Prog::SearchDFA(const StringPiece& text, const StringPiece& const_context,
   return true;
 }
 
+void Prog::SearchDFABatch(const StringPiece* texts, size_t n, Anchor anchor,
+                          bool* matched, bool* failed) {
+  DCHECK(!reversed_);
+  bool anchored = anchor == kAnchored || anchor_start();
+  bool endmatch = anchor_end();
+  DFA* dfa = GetDFA(kLongestMatch);
+  if (!endmatch) {
+    dfa->SearchBatch(texts, n, anchored, true, matched, failed, NULL);
+  } else {
+    std::vector<const char*> ep(n);
+    dfa->SearchBatch(texts, n, anchored, false, matched, failed, ep.data());
+    for (size_t i = 0; i < n; i++) {
+      if (matched[i] && ep[i] != texts[i].data() + texts[i].size())
+        matched[i] = false;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (failed[i]) {
+      hooks::GetDFASearchFailureHook()({
+          // Nothing yet...
+      });
+      break;
+    }
+  }
+}
+
 // Build out all states in DFA.  Returns number of states.
-int DFA::BuildAllStates(const Prog::DFAStateCallback& cb) {
+int DFA::BuildAllStates(const Prog::DFAStateCallback& cb, bool anchored,
+                        int max_states, bool* complete) {
+  if (complete != NULL)
+    *complete = false;
   if (!ok())
     return 0;
 
-  // Pick out start state for unanchored search
-  // at beginning of text.
+  // Pick out start state for search at beginning of text.
   RWLocker l(&cache_mutex_);
   SearchParams params(StringPiece(), StringPiece(), &l);
-  params.anchored = false;
+  params.anchored = anchored;
   if (!AnalyzeSearch(&params) ||
-      params.start == NULL ||
-      params.start == DeadState)
+      params.start == NULL)
+    return 0;
+  if (params.start == DeadState) {
+    if (complete != NULL)
+      *complete = true;
     return 0;
+  }
 
   // Add start state to work queue.
   // Note that any State* that we handle here must point into the cache,
@@ -1935,6 +2545,8 @@ int DFA::BuildAllStates(const Prog::DFAStateCallback& cb) {
   // Flood to expand every state.
   bool oom = false;
   while (!q.empty()) {
+    if (max_states > 0 && static_cast<int>(m.size()) >= max_states)
+      break;
     State* s = q.front();
     q.pop_front();
     for (int c : input) {
@@ -1960,6 +2572,8 @@ int DFA::BuildAllStates(const Prog::DFAStateCallback& cb) {
       break;
   }
 
+  if (complete != NULL)
+    *complete = !oom && q.empty();
   return static_cast<int>(m.size());
 }
 
@@ -1968,6 +2582,45 @@ int Prog::BuildEntireDFA(MatchKind kind, const DFAStateCallback& cb) {
   return GetDFA(kind)->BuildAllStates(cb);
 }
 
+// Build a flat transition table for the DFA for kind.
+bool Prog::BuildFlatDFA(MatchKind kind, bool anchored, int max_states) {
+  return GetDFA(kind)->BuildFlatTable(anchored, max_states);
+}
+
+// Write the flat tables of the DFAs, and read them back into the DFAs of
+// a deserialized program. DFAs without tables are left to be created by
+// the first search that needs them.
+void Prog::SerializeFlatDFAs(SerialWriter* w) {
+  DFA* dfas[] = {dfa_first_, dfa_longest_};
+  for (DFA* dfa : dfas) {
+    bool flat = dfa != NULL && dfa->HasFlatTable();
+    w->PutByte(flat);
+    if (flat)
+      dfa->SerializeFlatTables(w);
+  }
+}
+
+bool Prog::DeserializeFlatDFAs(SerialReader* r) {
+  const MatchKind kinds[] = {kFirstMatch, kLongestMatch};
+  for (MatchKind kind : kinds) {
+    if (r->GetByte() == 0)
+      continue;
+    // RE2 never does reverse first match searches.
+    if (kind == kFirstMatch && reversed_)
+      return false;
+    if (!GetDFA(kind)->DeserializeFlatTables(r))
+      return false;
+  }
+  return r->ok();
+}
+
+// Build out up to max_states states in DFA for kind.
+int Prog::BuildDFA(MatchKind kind, bool anchored, int max_states,
+                   bool* complete) {
+  return GetDFA(kind)->BuildAllStates(nullptr, anchored, max_states,
+                                      complete);
+}
+
 void Prog::TEST_dfa_should_bail_when_slow(bool b) {
   dfa_should_bail_when_slow = b;
 }
@@ -0,0 +1,401 @@
+// Copyright 2021 The RE2 Authors.  All Rights Reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "re2/literal_accel.h"
+
+// Teddy needs SSSE3 (for PSHUFB). Use it when the compiler targets it.
+// Otherwise, with GCC and Clang on x86, compile it separately and use it
+// if the CPU supports it at run time.
+#if defined(__SSSE3__)
+#define RE2_LITERAL_ACCEL_SSSE3 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RE2_LITERAL_ACCEL_SSSE3 2
+#endif
+
+#if defined(RE2_LITERAL_ACCEL_SSSE3)
+#include <tmmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+
+#include "util/logging.h"
+#include "re2/serial.h"
+
+namespace re2 {
+
+// Larger sets give too many false positives per bucket.
+static const size_t kTeddyMaxLiterals = 64;
+static const int kTeddyBuckets = 8;
+
+static bool CPUHasSSSE3() {
+#if RE2_LITERAL_ACCEL_SSSE3 == 1
+  return true;
+#elif RE2_LITERAL_ACCEL_SSSE3 == 2
+  static const bool ssse3 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3") != 0;
+  }();
+  return ssse3;
+#else
+  return false;
+#endif
+}
+
+// Sorts literals and removes those that begin with another one.
+static void MinimizeLiterals(std::vector<std::string>* literals) {
+  std::sort(literals->begin(), literals->end());
+  size_t n = 0;
+  for (size_t i = 0; i < literals->size(); i++) {
+    if (n > 0 && (*literals)[i].compare(0, (*literals)[n-1].size(),
+                                        (*literals)[n-1]) == 0)
+      continue;
+    (*literals)[n++] = (*literals)[i];
+  }
+  literals->resize(n);
+}
+
+LiteralAccel* LiteralAccel::New(const std::vector<std::string>& literals,
+                                bool foldcase, int64_t max_mem) {
+  if (literals.empty())
+    return NULL;
+  std::unique_ptr<LiteralAccel> accel(new LiteralAccel);
+  accel->literals_ = literals;
+  accel->foldcase_ = foldcase;
+  accel->max_mem_ = max_mem;
+  MinimizeLiterals(&accel->literals_);
+  accel->min_len_ = accel->literals_[0].size();
+  for (const std::string& literal : accel->literals_) {
+    DCHECK(!literal.empty());
+    accel->min_len_ = std::min(accel->min_len_, literal.size());
+  }
+  if (accel->min_len_ == 0)
+    return NULL;
+
+  accel->teddy_ = accel->InitTeddy();
+  if (!accel->teddy_) {
+    // Shorten the literals until the automaton fits: the candidates are
+    // less precise, but still never miss a literal.
+    size_t max_len = 0;
+    for (const std::string& literal : accel->literals_)
+      max_len = std::max(max_len, literal.size());
+    while (!accel->InitAhoCorasick(max_mem)) {
+      if (max_len <= 1)
+        return NULL;
+      max_len--;
+      for (std::string& literal : accel->literals_) {
+        if (literal.size() > max_len)
+          literal.resize(max_len);
+      }
+      MinimizeLiterals(&accel->literals_);
+      accel->min_len_ = std::min(accel->min_len_, max_len);
+    }
+  }
+  if (accel->MemoryUsage() > max_mem)
+    return NULL;
+  return accel.release();
+}
+
+int64_t LiteralAccel::MemoryUsage() const {
+  int64_t m = sizeof *this;
+  for (const std::string& literal : literals_)
+    m += sizeof literal + literal.capacity();
+  m += bucket_begin_.capacity() * sizeof(int);
+  m += next_.capacity() * sizeof(int);
+  m += depth_.capacity() * sizeof(int);
+  return m;
+}
+
+void LiteralAccel::Serialize(SerialWriter* w) const {
+  w->PutByte(foldcase_);
+  w->Put64(static_cast<uint64_t>(max_mem_));
+  w->Put32(static_cast<uint32_t>(literals_.size()));
+  for (const std::string& literal : literals_)
+    w->PutString(literal);
+}
+
+LiteralAccel* LiteralAccel::Deserialize(SerialReader* r) {
+  bool foldcase = r->GetByte() != 0;
+  int64_t max_mem = static_cast<int64_t>(r->Get64());
+  uint32_t n = r->Get32();
+  if (!r->CanRead(n, 4))
+    return NULL;
+  std::vector<std::string> literals(n);
+  for (std::string& literal : literals) {
+    if (r->GetString(&literal) && literal.empty())
+      r->Fail();
+    if (!r->ok())
+      return NULL;
+  }
+  return New(literals, foldcase, max_mem);
+}
+
+bool LiteralAccel::InitTeddy() {
+  if (literals_.size() > kTeddyMaxLiterals || !CPUHasSSSE3())
+    return false;
+
+  // Sorted literals go to buckets in order, so that literals sharing a
+  // bucket tend to share leading bytes too.
+  int n = static_cast<int>(literals_.size());
+  int nbuckets = std::min(n, kTeddyBuckets);
+  bucket_begin_.resize(nbuckets + 1);
+  for (int b = 0; b <= nbuckets; b++)
+    bucket_begin_[b] = b * n / nbuckets;
+
+  teddy_len_ = static_cast<int>(std::min<size_t>(3, min_len_));
+  memset(lo_, 0, sizeof lo_);
+  memset(hi_, 0, sizeof hi_);
+  for (int b = 0; b < nbuckets; b++) {
+    for (int i = bucket_begin_[b]; i < bucket_begin_[b+1]; i++) {
+      for (int k = 0; k < teddy_len_; k++) {
+        uint8_t c = static_cast<uint8_t>(literals_[i][k]);
+        lo_[k][c & 15] |= 1 << b;
+        hi_[k][c >> 4] |= 1 << b;
+        if (foldcase_ && 'a' <= c && c <= 'z') {
+          c -= 'a' - 'A';
+          lo_[k][c & 15] |= 1 << b;
+          hi_[k][c >> 4] |= 1 << b;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool LiteralAccel::InitAhoCorasick(int64_t max_mem) {
+  // Byte classes: 0 for bytes that occur in no literal, and one class per
+  // byte (per letter if foldcase) that does.
+  bool used[256] = {};
+  for (const std::string& literal : literals_) {
+    for (char c : literal)
+      used[static_cast<uint8_t>(c)] = true;
+  }
+  nclass_ = 1;
+  for (int c = 0; c < 256; c++) {
+    if (foldcase_ && 'A' <= c && c <= 'Z')
+      continue;
+    class_[c] = used[c] ? nclass_++ : 0;
+  }
+  if (foldcase_) {
+    for (int c = 'A'; c <= 'Z'; c++)
+      class_[c] = class_[c + 'a' - 'A'];
+  }
+
+  // The trie has a node for each distinct prefix of the (sorted)
+  // literals. Check that the table will fit before building it.
+  int64_t nstates = 1;
+  for (size_t i = 0; i < literals_.size(); i++) {
+    size_t lcp = 0;
+    if (i > 0) {
+      const std::string& a = literals_[i-1];
+      const std::string& b = literals_[i];
+      while (lcp < a.size() && lcp < b.size() && a[lcp] == b[lcp])
+        lcp++;
+    }
+    nstates += literals_[i].size() - lcp;
+  }
+  if (nstates * nclass_ * static_cast<int64_t>(sizeof(int)) > max_mem ||
+      nstates * nclass_ > (1 << 30))
+    return false;
+
+  // Build the trie, with -1 for missing edges.
+  std::vector<int> go(nclass_, -1);
+  std::vector<bool> match(1, false);
+  std::vector<int> depth(1, 0);
+  for (const std::string& literal : literals_) {
+    int s = 0;
+    for (char c : literal) {
+      int k = class_[static_cast<uint8_t>(c)];
+      if (go[s*nclass_ + k] < 0) {
+        go[s*nclass_ + k] = static_cast<int>(match.size());
+        go.resize(go.size() + nclass_, -1);
+        match.push_back(false);
+        depth.push_back(depth[s] + 1);
+      }
+      s = go[s*nclass_ + k];
+    }
+    match[s] = true;
+  }
+  DCHECK_EQ(static_cast<int64_t>(match.size()), nstates);
+
+  // Turn the trie into an automaton: a missing edge goes where the edge
+  // from the failure state (the longest proper suffix in the trie) goes.
+  std::vector<int> fail(match.size(), 0);
+  std::deque<int> q;
+  for (int k = 0; k < nclass_; k++) {
+    int& t = go[k];
+    if (t < 0) {
+      t = 0;
+    } else {
+      fail[t] = 0;
+      q.push_back(t);
+    }
+  }
+  while (!q.empty()) {
+    int s = q.front();
+    q.pop_front();
+    match[s] = match[s] || match[fail[s]];
+    for (int k = 0; k < nclass_; k++) {
+      int& t = go[s*nclass_ + k];
+      if (t < 0) {
+        t = go[fail[s]*nclass_ + k];
+      } else {
+        fail[t] = go[fail[s]*nclass_ + k];
+        q.push_back(t);
+      }
+    }
+  }
+
+  // Renumber the states so that the matching ones come last.
+  int n = static_cast<int>(match.size());
+  std::vector<int> order(n);
+  int nmatch = 0;
+  for (int s = 0; s < n; s++)
+    nmatch += match[s];
+  int next_nonmatch = 0, next_match = n - nmatch;
+  for (int s = 0; s < n; s++)
+    order[s] = match[s] ? next_match++ : next_nonmatch++;
+  next_.assign(go.size(), 0);
+  depth_.assign(n, 0);
+  for (int s = 0; s < n; s++) {
+    for (int k = 0; k < nclass_; k++)
+      next_[order[s]*nclass_ + k] = order[go[s*nclass_ + k]] * nclass_;
+    depth_[order[s]] = depth[s];
+  }
+  first_match_ = (n - nmatch) * nclass_;
+  DCHECK_EQ(order[0], 0);
+  return true;
+}
+
+const void* LiteralAccel::Find(const void* data, size_t size) const {
+  const char* p = reinterpret_cast<const char*>(data);
+  if (size < min_len_)
+    return NULL;
+  if (teddy_)
+    return FindTeddy(p, p + size);
+  return FindAhoCorasick(p, p + size);
+}
+
+bool LiteralAccel::Verify(const char* p, const char* end,
+                          uint8_t bits) const {
+  for (int b = 0; bits != 0; b++, bits >>= 1) {
+    if ((bits & 1) == 0)
+      continue;
+    for (int i = bucket_begin_[b]; i < bucket_begin_[b+1]; i++) {
+      const std::string& literal = literals_[i];
+      if (literal.size() > static_cast<size_t>(end - p))
+        continue;
+      size_t j = 0;
+      for (; j < literal.size(); j++) {
+        char c = p[j];
+        if (foldcase_ && 'A' <= c && c <= 'Z')
+          c += 'a' - 'A';
+        if (c != literal[j])
+          break;
+      }
+      if (j == literal.size())
+        return true;
+    }
+  }
+  return false;
+}
+
+#if defined(RE2_LITERAL_ACCEL_SSSE3)
+// Finds the least significant non-zero bit in n.
+static int FindLSBSet(uint32_t n) {
+  DCHECK_NE(n, 0);
+  return __builtin_ctz(n);
+}
+
+// Searches the positions [p, end - 15 - len) 16 at a time, calling
+// verify(q, bits) for each candidate q. Returns the first verified
+// candidate, or NULL after setting *rest to the first position not
+// searched.
+template <typename Verify>
+#if RE2_LITERAL_ACCEL_SSSE3 == 2
+__attribute__((target("ssse3")))
+#endif
+static const char* TeddySSSE3(const char* p, const char* end, int len,
+                              const uint8_t lo[3][16], const uint8_t hi[3][16],
+                              Verify verify, const char** rest) {
+  __m128i lo_table[3], hi_table[3];
+  for (int k = 0; k < len; k++) {
+    lo_table[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo[k]));
+    hi_table[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi[k]));
+  }
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i zero = _mm_setzero_si128();
+  for (; end - p >= 16 + len - 1; p += 16) {
+    __m128i res = _mm_set1_epi8(-1);
+    for (int k = 0; k < len; k++) {
+      const __m128i in =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k));
+      const __m128i lo_idx = _mm_and_si128(in, nibble);
+      const __m128i hi_idx = _mm_and_si128(_mm_srli_epi16(in, 4), nibble);
+      res = _mm_and_si128(res,
+                          _mm_and_si128(_mm_shuffle_epi8(lo_table[k], lo_idx),
+                                        _mm_shuffle_epi8(hi_table[k], hi_idx)));
+    }
+    uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xFFFF;
+    if (mask != 0) {
+      alignas(16) uint8_t bits[16];
+      _mm_store_si128(reinterpret_cast<__m128i*>(bits), res);
+      for (; mask != 0; mask &= mask - 1) {
+        int j = FindLSBSet(mask);
+        if (verify(p + j, bits[j]))
+          return p + j;
+      }
+    }
+  }
+  *rest = p;
+  return NULL;
+}
+#endif
+
+const char* LiteralAccel::FindTeddy(const char* p, const char* end) const {
+#if defined(RE2_LITERAL_ACCEL_SSSE3)
+  const char* found = TeddySSSE3(
+      p, end, teddy_len_, lo_, hi_,
+      [this, end](const char* q, uint8_t bits) {
+        return Verify(q, end, bits);
+      },
+      &p);
+  if (found != NULL)
+    return found;
+#endif
+  for (; static_cast<size_t>(end - p) >= min_len_; p++) {
+    uint8_t bits = 0xFF;
+    for (int k = 0; k < teddy_len_; k++) {
+      uint8_t c = static_cast<uint8_t>(p[k]);
+      bits &= lo_[k][c & 15] & hi_[k][c >> 4];
+    }
+    if (bits != 0 && Verify(p, end, bits))
+      return p;
+  }
+  return NULL;
+}
+
+const char* LiteralAccel::FindAhoCorasick(const char* p,
+                                          const char* end) const {
+  const uint8_t* bp = reinterpret_cast<const uint8_t*>(p);
+  const uint8_t* ep = reinterpret_cast<const uint8_t*>(end);
+  const int* next = next_.data();
+  int s = 0;
+  for (; bp != ep; bp++) {
+    s = next[s + class_[*bp]];
+    if (s >= first_match_) {
+      // A literal that began earlier and has not ended yet is a prefix
+      // of a literal ending here, so it began no earlier than the
+      // longest one does.
+      return reinterpret_cast<const char*>(bp + 1) - depth_[s / nclass_];
+    }
+  }
+  return NULL;
+}
+
+}  // namespace re2
@@ -0,0 +1,107 @@
+// Copyright 2021 The RE2 Authors.  All Rights Reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef RE2_LITERAL_ACCEL_H_
+#define RE2_LITERAL_ACCEL_H_
+
+// Prefix acceleration for regexps whose matches must begin with one of
+// several literal strings, such as foo|bar|baz. Finds the first position
+// in a text where a match could begin, so that the DFA or NFA does not
+// have to step through the text in between.
+//
+// Small sets are searched with a Teddy-style packed matcher (as in
+// Hyperscan and the Rust regex crate): SSSE3 shuffles look up the first
+// few bytes of 16 text positions at once in nibble tables, which yields
+// a bitmask of the buckets of literals that may begin at each position;
+// candidates are then verified. Large sets, and CPUs without SSSE3, use
+// an Aho-Corasick automaton flattened into a table over byte classes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util/util.h"
+
+namespace re2 {
+
+class SerialReader;
+class SerialWriter;
+
+class LiteralAccel {
+ public:
+  // Builds the searcher for literals, which must be non-empty. If
+  // foldcase, ASCII letters match either case; the literals must be
+  // lowercase. Returns NULL if the searcher would need more than
+  // max_mem bytes.
+  static LiteralAccel* New(const std::vector<std::string>& literals,
+                           bool foldcase, int64_t max_mem);
+  ~LiteralAccel() {}
+
+  // Returns a pointer to the first position in data where one of the
+  // literals begins, or NULL if there is none. The Aho-Corasick search
+  // may return an earlier position, but never one after a literal.
+  const void* Find(const void* data, size_t size) const;
+
+  // Whether Find returns exactly the first position where a literal
+  // begins: true for the Teddy search (sets of up to 64 literals, when
+  // the CPU has SSSE3), false for Aho-Corasick.
+  bool IsExact() const { return teddy_; }
+
+  // Memory used by the searcher.
+  int64_t MemoryUsage() const;
+
+  // Writes the literals and options the searcher was built from, so that
+  // Deserialize can build it again (for the CPU it then runs on).
+  void Serialize(SerialWriter* w) const;
+
+  // Builds the searcher written by Serialize. Returns NULL if r fails or
+  // if New would.
+  static LiteralAccel* Deserialize(SerialReader* r);
+
+ private:
+  LiteralAccel() {}
+
+  bool InitTeddy();
+  bool InitAhoCorasick(int64_t max_mem);
+
+  const char* FindTeddy(const char* p, const char* end) const;
+  const char* FindAhoCorasick(const char* p, const char* end) const;
+
+  // Whether one of the literals in the buckets selected by bits begins
+  // at p (and ends before end).
+  bool Verify(const char* p, const char* end, uint8_t bits) const;
+
+  std::vector<std::string> literals_;
+  bool foldcase_;
+  int64_t max_mem_;  // as passed to New
+  size_t min_len_;  // length of the shortest literal
+
+  // Teddy: literals_ is split into (up to) 8 buckets, and
+  // lo_[k][c & 15] & hi_[k][c >> 4] has the bits of the buckets with a
+  // literal whose byte k might be c. teddy_len_ bytes are looked up.
+  bool teddy_;
+  int teddy_len_;
+  uint8_t lo_[3][16];
+  uint8_t hi_[3][16];
+  std::vector<int> bucket_begin_;  // bucket b is literals_[bucket_begin_[b],
+                                   //                      bucket_begin_[b+1])
+
+  // Aho-Corasick: next_[s + class_[c]] is the state after c in state s
+  // (states are premultiplied by nclass_). States at or after
+  // first_match_ end a literal; depth_[s / nclass_] is the length of the
+  // longest prefix of a literal that ends in state s.
+  uint16_t class_[256];
+  int nclass_;
+  int first_match_;
+  std::vector<int> next_;
+  std::vector<int> depth_;
+
+  LiteralAccel(const LiteralAccel&) = delete;
+  LiteralAccel& operator=(const LiteralAccel&) = delete;
+};
+
+}  // namespace re2
+
+#endif  // RE2_LITERAL_ACCEL_H_
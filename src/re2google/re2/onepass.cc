@@ -63,6 +63,7 @@
 #include "util/utf.h"
 #include "re2/pod_array.h"
 #include "re2/prog.h"
+#include "re2/serial.h"
 #include "re2/sparse_set.h"
 #include "re2/stringpiece.h"
 
@@ -154,33 +155,29 @@ struct OneState {
 };
 
 // The uint32_t conditions in the action are a combination of
-// condition and capture bits and the next state.  The bottom 16 bits
-// are the condition and capture bits, and the top 16 are the index of
-// the next state.
+// condition and capture bits and the next state.  The bottom bits
+// are the condition bits and the index of a capture set, and the top
+// bits are the index of the next state.
 //
 // Bits 0-5 are the empty-width flags from prog.h.
 // Bit 6 is kMatchWins, which means the match takes
 // priority over moving to next in a first-match search.
-// The remaining bits mark capture registers that should
-// be set to the current input position.  The capture bits
-// start at index 2, since the search loop can take care of
-// cap[0], cap[1] (the overall match position).
-// That means we can handle up to 5 capturing parens: $1 through $4, plus $0.
+// The next bits, up to onepass_index_shift_, hold the index of the set
+// of capture registers that should be set to the current input
+// position; set 0 is empty.  The sets are interned while the one-pass
+// NFA is built and stored in onepass_capsets_.  The number of bits
+// given to the set index depends on how many distinct sets there are,
+// and the rest go to the index of the next state, so programs with few
+// captures can have more states and programs with many captures are
+// not limited to a handful of capturing parens.
 // No input position can satisfy both kEmptyWordBoundary
 // and kEmptyNonWordBoundary, so we can use that as a sentinel
 // instead of needing an extra bit.
 
-static const int    kIndexShift   = 16;  // number of bits below index
 static const int    kEmptyShift   = 6;   // number of empty flags in prog.h
-static const int    kRealCapShift = kEmptyShift + 1;
-static const int    kRealMaxCap   = (kIndexShift - kRealCapShift) / 2 * 2;
-
-// Parameters used to skip over cap[0], cap[1].
-static const int    kCapShift     = kRealCapShift - 2;
-static const int    kMaxCap       = kRealMaxCap + 2;
+static const int    kCapShift     = kEmptyShift + 1;
 
 static const uint32_t kMatchWins  = 1 << kEmptyShift;
-static const uint32_t kCapMask    = ((1 << kRealMaxCap) - 1) << kRealCapShift;
 
 static const uint32_t kImpossible = kEmptyWordBoundary | kEmptyNonWordBoundary;
 
@@ -189,9 +186,6 @@ static const uint32_t kImpossible = kEmptyWordBoundary | kEmptyNonWordBoundary;
 void OnePass_Checks() {
   static_assert((1<<kEmptyShift)-1 == kEmptyAllFlags,
                 "kEmptyShift disagrees with kEmptyAllFlags");
-  // kMaxCap counts pointers, kMaxOnePassCapture counts pairs.
-  static_assert(kMaxCap == Prog::kMaxOnePassCapture*2,
-                "kMaxCap disagrees with kMaxOnePassCapture");
 }
 
 static bool Satisfy(uint32_t cond, const StringPiece& context, const char* p) {
@@ -201,13 +195,17 @@ static bool Satisfy(uint32_t cond, const StringPiece& context, const char* p) {
   return true;
 }
 
-// Apply the capture bits in cond, saving p to the appropriate
-// locations in cap[].
-static void ApplyCaptures(uint32_t cond, const char* p,
-                          const char** cap, int ncap) {
-  for (int i = 2; i < ncap; i++)
-    if (cond & (1 << kCapShift << i))
-      cap[i] = p;
+// Apply the capture set in cond, saving p to the appropriate
+// locations in cap[].  capsets[k] and capsets[k+1] delimit the
+// registers of set k (in increasing order) in capsets[].
+static void ApplyCaptures(uint32_t cond, uint32_t capmask, const int* capsets,
+                          const char* p, const char** cap, int ncap) {
+  int k = static_cast<int>((cond & capmask) >> kCapShift);
+  for (int i = capsets[k]; i < capsets[k+1]; i++) {
+    if (capsets[i] >= ncap)
+      break;
+    cap[capsets[i]] = p;
+  }
 }
 
 // Computes the OneState* for the given nodeindex.
@@ -231,14 +229,21 @@ bool Prog::SearchOnePass(const StringPiece& text,
   if (ncap < 2)
     ncap = 2;
 
-  const char* cap[kMaxCap];
-  for (int i = 0; i < ncap; i++)
+  // cap[] holds the registers of the current thread and matchcap[]
+  // those of the last match; on the stack unless there are many
+  // capturing parens.
+  static const int kStackCap = 32;
+  const char* stackcap[2*kStackCap];
+  PODArray<const char*> heapcap;
+  const char** cap = stackcap;
+  if (ncap > kStackCap) {
+    heapcap = PODArray<const char*>(2*ncap);
+    cap = heapcap.data();
+  }
+  const char** matchcap = cap + ncap;
+  for (int i = 0; i < 2*ncap; i++)
     cap[i] = NULL;
 
-  const char* matchcap[kMaxCap];
-  for (int i = 0; i < ncap; i++)
-    matchcap[i] = NULL;
-
   StringPiece context = const_context;
   if (context.data() == NULL)
     context = text;
@@ -257,6 +262,10 @@ bool Prog::SearchOnePass(const StringPiece& text,
   // int statesize = sizeof(OneState) + bytemap_range()*sizeof(uint32_t);
   // start() is always mapped to the zeroth OneState.
   OneState* state = IndexToNode(nodes, statesize, 0);
+  const int indexshift = onepass_index_shift_;
+  const uint32_t capmask = ((uint32_t{1} << indexshift) - 1) &
+                           ~((uint32_t{1} << kCapShift) - 1);
+  const int* capsets = onepass_capsets_.data();
   uint8_t* bytemap = bytemap_;
   const char* bp = text.data();
   const char* ep = text.data() + text.size();
@@ -273,7 +282,7 @@ bool Prog::SearchOnePass(const StringPiece& text,
     // Determine whether we can reach act->next.
     // If so, advance state and nextmatchcond.
     if ((cond & kEmptyAllFlags) == 0 || Satisfy(cond, context, p)) {
-      uint32_t nextindex = cond >> kIndexShift;
+      uint32_t nextindex = cond >> indexshift;
       state = IndexToNode(nodes, statesize, nextindex);
       nextmatchcond = state->matchcond;
     } else {
@@ -309,8 +318,8 @@ bool Prog::SearchOnePass(const StringPiece& text,
     if ((matchcond & kEmptyAllFlags) == 0 || Satisfy(matchcond, context, p)) {
       for (int i = 2; i < 2*nmatch; i++)
         matchcap[i] = cap[i];
-      if (nmatch > 1 && (matchcond & kCapMask))
-        ApplyCaptures(matchcond, p, matchcap, ncap);
+      if (nmatch > 1 && (matchcond & capmask))
+        ApplyCaptures(matchcond, capmask, capsets, p, matchcap, ncap);
       matchcap[1] = p;
       matched = true;
 
@@ -326,8 +335,8 @@ bool Prog::SearchOnePass(const StringPiece& text,
   skipmatch:
     if (state == NULL)
       goto done;
-    if ((cond & kCapMask) && nmatch > 1)
-      ApplyCaptures(cond, p, cap, ncap);
+    if ((cond & capmask) && nmatch > 1)
+      ApplyCaptures(cond, capmask, capsets, p, cap, ncap);
   }
 
   // Look for match at end of input.
@@ -335,8 +344,8 @@ bool Prog::SearchOnePass(const StringPiece& text,
     uint32_t matchcond = state->matchcond;
     if (matchcond != kImpossible &&
         ((matchcond & kEmptyAllFlags) == 0 || Satisfy(matchcond, context, p))) {
-      if (nmatch > 1 && (matchcond & kCapMask))
-        ApplyCaptures(matchcond, p, cap, ncap);
+      if (nmatch > 1 && (matchcond & capmask))
+        ApplyCaptures(matchcond, capmask, capsets, p, cap, ncap);
       for (int i = 2; i < ncap; i++)
         matchcap[i] = cap[i];
       matchcap[1] = p;
@@ -370,9 +379,68 @@ static bool AddQ(Instq *q, int id) {
   return true;
 }
 
+// While the one-pass NFA is built, conditions and actions are 64 bits
+// wide: the next state index is in the top 32 bits and the capture set
+// index is not limited to the bits left over once the number of states
+// is known.  They are packed into 32 bits at the end.
+static const int kBuildIndexShift = 32;
+
 struct InstCond {
   int id;
-  uint32_t cond;
+  uint64_t cond;
+};
+
+// Interns the sets of capture registers set by actions, so that an
+// action can refer to a set by a small index.  Set 0 is empty.
+class CaptureSets {
+ public:
+  CaptureSets() : sets_(1) {}
+
+  // Returns the index of set k with register reg added.
+  int Add(int k, int reg) {
+    std::vector<int> set = sets_[k];
+    std::vector<int>::iterator it =
+        std::lower_bound(set.begin(), set.end(), reg);
+    if (it != set.end() && *it == reg)
+      return k;
+    set.insert(it, reg);
+    std::map<std::vector<int>, int>::iterator found = index_.find(set);
+    if (found != index_.end())
+      return found->second;
+    int n = static_cast<int>(sets_.size());
+    index_[set] = n;
+    sets_.push_back(set);
+    return n;
+  }
+
+  int size() const { return static_cast<int>(sets_.size()); }
+
+  // Number of ints in the flattened form.
+  int flat_size() const {
+    int n = size() + 1;
+    for (size_t k = 0; k < sets_.size(); k++)
+      n += static_cast<int>(sets_[k].size());
+    return n;
+  }
+
+  // Flattens the sets into flat, which must have flat_size() elements:
+  // flat[k] and flat[k+1] delimit the registers of set k in flat.
+  void Flatten(int* flat) const {
+    int n = size() + 1;
+    for (size_t k = 0; k < sets_.size(); k++) {
+      flat[k] = n;
+      for (size_t i = 0; i < sets_[k].size(); i++)
+        flat[n++] = sets_[k][i];
+    }
+    flat[sets_.size()] = n;
+  }
+
+ private:
+  std::vector<std::vector<int>> sets_;
+  std::map<std::vector<int>, int> index_;
+
+  CaptureSets(const CaptureSets&) = delete;
+  CaptureSets& operator=(const CaptureSets&) = delete;
 };
 
 // Returns whether this is a one-pass program; that is,
@@ -400,12 +468,12 @@ bool Prog::IsOnePass() {
 
   // Steal memory for the one-pass NFA from the overall DFA budget.
   // Willing to use at most 1/4 of the DFA budget (heuristic).
-  // Limit max node count to 65000 as a conservative estimate to
-  // avoid overflowing 16-bit node index in encoding.
+  // The node count is also limited by the bits left for the node index
+  // once the capture sets are known; that is checked at the end.
   int maxnodes = 2 + inst_count(kInstByteRange);
   int statesize = sizeof(uint32_t) + bytemap_range()*sizeof(uint32_t);
   // int statesize = sizeof(OneState) + bytemap_range()*sizeof(uint32_t);
-  if (maxnodes >= 65000 || dfa_mem_ / 4 / statesize < maxnodes)
+  if (dfa_mem_ / 4 / statesize < maxnodes)
     return false;
 
   // Flood the graph starting at the start state, and check
@@ -423,23 +491,28 @@ bool Prog::IsOnePass() {
   // Originally, nodes was a uint8_t[maxnodes*statesize], but that was
   // unnecessarily optimistic: why allocate a large amount of memory
   // upfront for a large program when it is unlikely to be one-pass?
-  std::vector<uint8_t> nodes;
+  // Node k is nodes[k*nodewidth], its matchcond, followed by its
+  // actions, in the 64-bit form used while building.
+  int nodewidth = 1 + bytemap_range_;
+  std::vector<uint64_t> nodes;
+  CaptureSets capsets;
 
   Instq tovisit(size), workq(size);
   AddQ(&tovisit, start());
   nodebyid[start()] = 0;
   int nalloc = 1;
-  nodes.insert(nodes.end(), statesize, 0);
+  nodes.insert(nodes.end(), nodewidth, 0);
   for (Instq::iterator it = tovisit.begin(); it != tovisit.end(); ++it) {
     int id = *it;
     int nodeindex = nodebyid[id];
-    OneState* node = IndexToNode(nodes.data(), statesize, nodeindex);
+    uint64_t* node = &nodes[nodeindex*nodewidth];
+    uint64_t* action = node + 1;
 
     // Flood graph using manual stack, filling in actions as found.
     // Default is none.
     for (int b = 0; b < bytemap_range_; b++)
-      node->action[b] = kImpossible;
-    node->matchcond = kImpossible;
+      action[b] = kImpossible;
+    node[0] = kImpossible;
 
     workq.clear();
     bool matched = false;
@@ -448,7 +521,7 @@ bool Prog::IsOnePass() {
     stack[nstack++].cond = 0;
     while (nstack > 0) {
       int id = stack[--nstack].id;
-      uint32_t cond = stack[nstack].cond;
+      uint64_t cond = stack[nstack].cond;
 
     Loop:
       Prog::Inst* ip = inst(id);
@@ -480,21 +553,23 @@ bool Prog::IsOnePass() {
             AddQ(&tovisit, ip->out());
             nodebyid[ip->out()] = nalloc;
             nalloc++;
-            nodes.insert(nodes.end(), statesize, 0);
+            nodes.insert(nodes.end(), nodewidth, 0);
             // Update node because it might have been invalidated.
-            node = IndexToNode(nodes.data(), statesize, nodeindex);
+            node = &nodes[nodeindex*nodewidth];
+            action = node + 1;
           }
           for (int c = ip->lo(); c <= ip->hi(); c++) {
             int b = bytemap_[c];
             // Skip any bytes immediately after c that are also in b.
             while (c < 256-1 && bytemap_[c+1] == b)
               c++;
-            uint32_t act = node->action[b];
-            uint32_t newact = (nextindex << kIndexShift) | cond;
+            uint64_t act = action[b];
+            uint64_t newact =
+                (static_cast<uint64_t>(nextindex) << kBuildIndexShift) | cond;
             if (matched)
               newact |= kMatchWins;
             if ((act & kImpossible) == kImpossible) {
-              node->action[b] = newact;
+              action[b] = newact;
             } else if (act != newact) {
               if (ExtraDebug)
                 LOG(ERROR) << StringPrintf(
@@ -510,12 +585,13 @@ bool Prog::IsOnePass() {
               // Skip any bytes immediately after c that are also in b.
               while (c < 256-1 && bytemap_[c+1] == b)
                 c++;
-              uint32_t act = node->action[b];
-              uint32_t newact = (nextindex << kIndexShift) | cond;
+              uint64_t act = action[b];
+              uint64_t newact =
+                  (static_cast<uint64_t>(nextindex) << kBuildIndexShift) | cond;
               if (matched)
                 newact |= kMatchWins;
               if ((act & kImpossible) == kImpossible) {
-                node->action[b] = newact;
+                action[b] = newact;
               } else if (act != newact) {
                 if (ExtraDebug)
                   LOG(ERROR) << StringPrintf(
@@ -545,8 +621,13 @@ bool Prog::IsOnePass() {
             stack[nstack++].cond = cond;
           }
 
-          if (ip->opcode() == kInstCapture && ip->cap() < kMaxCap)
-            cond |= (1 << kCapShift) << ip->cap();
+          // cap[0] and cap[1] are taken care of by the search loop.
+          if (ip->opcode() == kInstCapture && ip->cap() >= 2) {
+            int k = capsets.Add(static_cast<int>(cond >> kCapShift),
+                                ip->cap());
+            cond = (cond & ((1 << kCapShift) - 1)) |
+                   (static_cast<uint64_t>(k) << kCapShift);
+          }
           if (ip->opcode() == kInstEmptyWidth)
             cond |= ip->empty();
 
@@ -575,7 +656,7 @@ bool Prog::IsOnePass() {
             goto fail;
           }
           matched = true;
-          node->matchcond = cond;
+          node[0] = cond;
 
           if (ip->last())
             break;
@@ -591,43 +672,154 @@ bool Prog::IsOnePass() {
     }
   }
 
-  if (ExtraDebug) {  // For debugging, dump one-pass NFA to LOG(ERROR).
-    LOG(ERROR) << "bytemap:\n" << DumpByteMap();
-    LOG(ERROR) << "prog:\n" << Dump();
-
-    std::map<int, int> idmap;
-    for (int i = 0; i < size; i++)
-      if (nodebyid[i] != -1)
-        idmap[nodebyid[i]] = i;
-
-    std::string dump;
-    for (Instq::iterator it = tovisit.begin(); it != tovisit.end(); ++it) {
-      int id = *it;
-      int nodeindex = nodebyid[id];
-      if (nodeindex == -1)
-        continue;
-      OneState* node = IndexToNode(nodes.data(), statesize, nodeindex);
-      dump += StringPrintf("node %d id=%d: matchcond=%#x\n",
-                           nodeindex, id, node->matchcond);
-      for (int i = 0; i < bytemap_range_; i++) {
-        if ((node->action[i] & kImpossible) == kImpossible)
+  {
+    // Give the capture set index as many bits as it needs and the node
+    // index the rest.
+    int capbits = 0;
+    while ((1 << capbits) < capsets.size())
+      capbits++;
+    int indexshift = kCapShift + capbits;
+    if (indexshift >= 32 ||
+        static_cast<uint64_t>(nalloc) > (uint64_t{1} << (32 - indexshift))) {
+      if (ExtraDebug)
+        LOG(ERROR) << StringPrintf(
+            "Not OnePass: %d nodes and %d capture sets do not fit",
+            nalloc, capsets.size());
+      goto fail;
+    }
+    int64_t capsetmem = capsets.flat_size() * sizeof(int);
+    if (dfa_mem_ / 4 < nalloc*statesize + capsetmem)
+      goto fail;
+
+    if (ExtraDebug) {  // For debugging, dump one-pass NFA to LOG(ERROR).
+      LOG(ERROR) << "bytemap:\n" << DumpByteMap();
+      LOG(ERROR) << "prog:\n" << Dump();
+
+      std::map<int, int> idmap;
+      for (int i = 0; i < size; i++)
+        if (nodebyid[i] != -1)
+          idmap[nodebyid[i]] = i;
+
+      std::string dump;
+      for (Instq::iterator it = tovisit.begin(); it != tovisit.end(); ++it) {
+        int id = *it;
+        int nodeindex = nodebyid[id];
+        if (nodeindex == -1)
           continue;
-        dump += StringPrintf("  %d cond %#x -> %d id=%d\n",
-                             i, node->action[i] & 0xFFFF,
-                             node->action[i] >> kIndexShift,
-                             idmap[node->action[i] >> kIndexShift]);
+        const uint64_t* node = &nodes[nodeindex*nodewidth];
+        dump += StringPrintf("node %d id=%d: matchcond=%#x\n",
+                             nodeindex, id, static_cast<uint32_t>(node[0]));
+        for (int i = 0; i < bytemap_range_; i++) {
+          uint64_t act = node[1+i];
+          if ((act & kImpossible) == kImpossible)
+            continue;
+          int next = static_cast<int>(act >> kBuildIndexShift);
+          dump += StringPrintf("  %d cond %#x -> %d id=%d\n",
+                               i, static_cast<uint32_t>(act), next,
+                               idmap[next]);
+        }
       }
+      LOG(ERROR) << "nodes:\n" << dump;
     }
-    LOG(ERROR) << "nodes:\n" << dump;
-  }
 
-  dfa_mem_ -= nalloc*statesize;
-  onepass_nodes_ = PODArray<uint8_t>(nalloc*statesize);
-  memmove(onepass_nodes_.data(), nodes.data(), nalloc*statesize);
-  return true;
+    // Pack the nodes into their 32-bit form.
+    onepass_nodes_ = PODArray<uint8_t>(nalloc*statesize);
+    for (int k = 0; k < nalloc; k++) {
+      OneState* state = IndexToNode(onepass_nodes_.data(), statesize, k);
+      const uint64_t* node = &nodes[k*nodewidth];
+      state->matchcond = static_cast<uint32_t>(node[0]);
+      for (int b = 0; b < bytemap_range_; b++) {
+        uint64_t act = node[1+b];
+        state->action[b] =
+            (static_cast<uint32_t>(act >> kBuildIndexShift) << indexshift) |
+            static_cast<uint32_t>(act);
+      }
+    }
+    onepass_capsets_ = PODArray<int>(capsets.flat_size());
+    capsets.Flatten(onepass_capsets_.data());
+    onepass_index_shift_ = indexshift;
+    dfa_mem_ -= nalloc*statesize + capsetmem;
+    return true;
+  }
 
 fail:
   return false;
 }
 
+void Prog::SerializeOnePass(SerialWriter* w) {
+  bool has_nodes = onepass_nodes_.data() != NULL;
+  w->PutByte((did_onepass_ ? 1 : 0) | (has_nodes ? 2 : 0));
+  if (!has_nodes)
+    return;
+  w->Put32(onepass_index_shift_);
+  int nwords = onepass_nodes_.size() / static_cast<int>(sizeof(uint32_t));
+  w->Put32(nwords);
+  for (int i = 0; i < nwords; i++) {
+    uint32_t word;
+    memmove(&word, onepass_nodes_.data() + i*sizeof word, sizeof word);
+    w->Put32(word);
+  }
+  w->Put32(onepass_capsets_.size());
+  for (int i = 0; i < onepass_capsets_.size(); i++)
+    w->Put32(onepass_capsets_[i]);
+}
+
+bool Prog::DeserializeOnePass(SerialReader* r) {
+  uint8_t flags = r->GetByte();
+  did_onepass_ = (flags & 1) != 0;
+  if ((flags & 2) == 0)
+    return r->ok();
+
+  // Check the next node and the capture set of every condition, so that
+  // SearchOnePass can trust them as it trusts the ones IsOnePass() makes.
+  int indexshift = static_cast<int>(r->Get32());
+  uint32_t nwords = r->Get32();
+  int statewords = 1 + bytemap_range_;
+  if (!r->CanRead(nwords, 4) || indexshift < kCapShift || indexshift >= 32 ||
+      nwords == 0 || nwords % statewords != 0)
+    return false;
+  uint32_t nnodes = nwords / statewords;
+  std::vector<uint32_t> words(nwords);
+  for (uint32_t i = 0; i < nwords; i++)
+    words[i] = r->Get32();
+  uint32_t ncapsets = r->Get32();
+  if (!r->CanRead(ncapsets, 4) || ncapsets == 0)
+    return false;
+  PODArray<int> capsets(ncapsets);
+  for (uint32_t i = 0; i < ncapsets; i++)
+    capsets[i] = static_cast<int>(r->Get32());
+  if (!r->ok())
+    return false;
+
+  // capsets[k] and capsets[k+1] delimit set k; the sets follow the
+  // nsets+1 offsets.
+  int nsets = capsets[0] - 1;
+  if (nsets < 1 || capsets[0] > static_cast<int>(ncapsets))
+    return false;
+  for (int k = 0; k < nsets; k++) {
+    if (capsets[k] > capsets[k+1] ||
+        capsets[k+1] > static_cast<int>(ncapsets))
+      return false;
+  }
+  for (int i = capsets[0]; i < static_cast<int>(ncapsets); i++) {
+    if (capsets[i] < 0)
+      return false;
+  }
+  const uint32_t capmask = ((uint32_t{1} << indexshift) - 1) &
+                           ~((uint32_t{1} << kCapShift) - 1);
+  for (uint32_t i = 0; i < nwords; i++) {
+    uint32_t cond = words[i];
+    if (static_cast<int>((cond & capmask) >> kCapShift) >= nsets)
+      return false;
+    if (i % statewords != 0 && (cond >> indexshift) >= nnodes)
+      return false;
+  }
+
+  onepass_nodes_ = PODArray<uint8_t>(nwords*sizeof(uint32_t));
+  memmove(onepass_nodes_.data(), words.data(), nwords*sizeof(uint32_t));
+  onepass_capsets_ = std::move(capsets);
+  onepass_index_shift_ = indexshift;
+  return true;
+}
+
 }  // namespace re2
@@ -7,12 +7,28 @@
 
 #include "re2/prog.h"
 
+// Prefix accel uses AVX2 when the compiler targets it. Otherwise, with
+// GCC and Clang on x86, an AVX2 version is compiled separately and chosen
+// at run time if the CPU supports it, falling back to SSE2 (on x86-64 and
+// x86 with SSE2) or to portable code.
 #if defined(__AVX2__)
+#define RE2_PREFIX_ACCEL_AVX2 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RE2_PREFIX_ACCEL_AVX2 2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RE2_PREFIX_ACCEL_SSE2 1
+#endif
+
+#if defined(RE2_PREFIX_ACCEL_AVX2)
 #include <immintrin.h>
+#elif defined(RE2_PREFIX_ACCEL_SSE2)
+#include <emmintrin.h>
+#endif
 #ifdef _MSC_VER
 #include <intrin.h>
 #endif
-#endif
 #include <stdint.h>
 #include <string.h>
 #include <algorithm>
@@ -23,6 +39,8 @@
 #include "util/logging.h"
 #include "util/strutil.h"
 #include "re2/bitmap256.h"
+#include "re2/literal_accel.h"
+#include "re2/serial.h"
 #include "re2/stringpiece.h"
 
 namespace re2 {
@@ -116,9 +134,12 @@ Prog::Prog()
     size_(0),
     bytemap_range_(0),
     prefix_size_(0),
+    prefix_foldcase_(false),
     prefix_front_(-1),
     prefix_back_(-1),
+    literal_accel_(NULL),
     list_count_(0),
+    onepass_index_shift_(0),
     dfa_mem_(0),
     dfa_first_(NULL),
     dfa_longest_(NULL) {
@@ -127,6 +148,7 @@ Prog::Prog()
 Prog::~Prog() {
   DeleteDFA(dfa_longest_);
   DeleteDFA(dfa_first_);
+  delete literal_accel_;
 }
 
 typedef SparseSet Workq;
@@ -916,7 +938,184 @@ void Prog::ComputeHints(std::vector<Inst>* flat, int begin, int end) {
   }
 }
 
-#if defined(__AVX2__)
+// Version of the encoding written by Prog::Serialize.
+static const uint8_t kProgSerialVersion = 1;
+
+void Prog::Serialize(std::string* out) {
+  DCHECK(did_flatten_);
+  SerialWriter w(out);
+  w.PutByte(kProgSerialVersion);
+  w.PutByte((anchor_start_ ? 1 : 0) | (anchor_end_ ? 2 : 0) |
+            (reversed_ ? 4 : 0) | (prefix_foldcase_ ? 8 : 0));
+  w.Put32(start_);
+  w.Put32(start_unanchored_);
+  w.Put32(size_);
+  w.Put32(bytemap_range_);
+  w.PutBytes(bytemap_, sizeof bytemap_);
+  w.Put64(prefix_size_);
+  w.PutByte(static_cast<uint8_t>(prefix_front_));
+  w.PutByte(static_cast<uint8_t>(prefix_back_));
+  w.Put64(static_cast<uint64_t>(dfa_mem_));
+
+  // An instruction is its out_opcode_ word and one word of arguments.
+  for (int id = 0; id < size_; id++) {
+    Inst* ip = inst(id);
+    w.Put32(ip->out_opcode_);
+    switch (ip->opcode()) {
+      case kInstAlt:
+      case kInstAltMatch:
+        w.Put32(ip->out1());
+        break;
+      case kInstByteRange:
+        w.Put32(ip->lo() | ip->hi() << 8 |
+                static_cast<uint32_t>(ip->ia_.oc_.hint_foldcase_) << 16);
+        break;
+      case kInstCapture:
+        w.Put32(ip->cap());
+        break;
+      case kInstEmptyWidth:
+        w.Put32(ip->empty());
+        break;
+      case kInstMatch:
+        w.Put32(ip->match_id());
+        break;
+      default:
+        w.Put32(0);
+        break;
+    }
+  }
+
+  w.PutByte(literal_accel_ != NULL);
+  if (literal_accel_ != NULL)
+    literal_accel_->Serialize(&w);
+  SerializeOnePass(&w);
+  SerializeFlatDFAs(&w);
+}
+
+Prog* Prog::Deserialize(StringPiece* in) {
+  SerialReader r(in);
+  if (r.GetByte() != kProgSerialVersion)
+    return NULL;
+  std::unique_ptr<Prog> prog(new Prog);
+  uint8_t flags = r.GetByte();
+  prog->anchor_start_ = (flags & 1) != 0;
+  prog->anchor_end_ = (flags & 2) != 0;
+  prog->reversed_ = (flags & 4) != 0;
+  prog->prefix_foldcase_ = (flags & 8) != 0;
+  uint32_t start = r.Get32();
+  uint32_t start_unanchored = r.Get32();
+  uint32_t size = r.Get32();
+  uint32_t bytemap_range = r.Get32();
+  r.GetBytes(prog->bytemap_, sizeof prog->bytemap_);
+  uint64_t prefix_size = r.Get64();
+  prog->prefix_front_ = r.GetByte();
+  prog->prefix_back_ = r.GetByte();
+  prog->dfa_mem_ = static_cast<int64_t>(r.Get64());
+  if (!r.ok() || size == 0 || size > Inst::kMaxInst ||
+      start >= size || start_unanchored >= size ||
+      bytemap_range == 0 || bytemap_range > 256 ||
+      prefix_size > (1u << 30) || prog->dfa_mem_ < 0 ||
+      !r.CanRead(size, 8))
+    return NULL;
+  for (int c = 0; c < 256; c++) {
+    if (prog->bytemap_[c] >= bytemap_range)
+      return NULL;
+  }
+  prog->start_ = start;
+  prog->start_unanchored_ = start_unanchored;
+  prog->size_ = size;
+  prog->bytemap_range_ = bytemap_range;
+  prog->prefix_size_ = prefix_size;
+  if (prefix_size == 0) {
+    prog->prefix_front_ = -1;
+    prog->prefix_back_ = -1;
+  }
+
+  // Check every instruction id, so that the engines can trust them as
+  // they trust the ones made by the compiler.
+  prog->inst_ = PODArray<Inst>(size);
+  for (int id = 0; id < prog->size_; id++) {
+    Inst* ip = prog->inst(id);
+    ip->out_opcode_ = r.Get32();
+    uint32_t arg = r.Get32();
+    if (ip->opcode() >= kNumInst || ip->out() >= prog->size_)
+      return NULL;
+    switch (ip->opcode()) {
+      case kInstAlt:
+        // Flatten() leaves no Alt instructions.
+        return NULL;
+      case kInstAltMatch:
+        // The engines go on to id+1 without checking last(), so insist on
+        // the shape Flatten() gives: out and out1 are the next two
+        // instructions.
+        if (ip->last() || ip->out() != id+1 ||
+            arg != static_cast<uint32_t>(id+2) || arg >= size)
+          return NULL;
+        ip->ia_.out1_ = arg;
+        break;
+      case kInstByteRange:
+        ip->ia_.oc_.lo_ = arg & 0xFF;
+        ip->ia_.oc_.hi_ = (arg >> 8) & 0xFF;
+        ip->ia_.oc_.hint_foldcase_ = static_cast<uint16_t>(arg >> 16);
+        if (id + ip->hint() >= prog->size_)
+          return NULL;
+        break;
+      case kInstCapture:
+        if (static_cast<int32_t>(arg) < 0)
+          return NULL;
+        ip->ia_.cap_ = static_cast<int32_t>(arg);
+        break;
+      case kInstEmptyWidth:
+        if (arg & ~kEmptyAllFlags)
+          return NULL;
+        ip->ia_.empty_ = static_cast<EmptyOp>(arg);
+        break;
+      case kInstMatch:
+        ip->ia_.match_id_ = static_cast<int32_t>(arg);
+        break;
+      default:
+        ip->ia_.out1_ = 0;
+        break;
+    }
+  }
+  // Instruction 0 is Fail, and the last one ends a list, as Flatten()
+  // leaves them.
+  if (!r.ok() || prog->inst(0)->opcode() != kInstFail ||
+      !prog->inst(prog->size_ - 1)->last())
+    return NULL;
+
+  // The list counts and heads follow from where the lists end.
+  prog->did_flatten_ = true;
+  for (int i = 0; i < kNumInst; i++)
+    prog->inst_count_[i] = 0;
+  std::vector<int> heads(1, 0);
+  for (int id = 0; id < prog->size_; id++) {
+    Inst* ip = prog->inst(id);
+    prog->inst_count_[ip->opcode()]++;
+    if (ip->last() && id + 1 < prog->size_)
+      heads.push_back(id + 1);
+  }
+  prog->list_count_ = static_cast<int>(heads.size());
+  if (prog->size_ <= 512) {
+    prog->list_heads_ = PODArray<uint16_t>(prog->size_);
+    memset(prog->list_heads_.data(), 0xFF,
+           prog->size_*sizeof prog->list_heads_[0]);
+    for (int i = 0; i < prog->list_count_; ++i)
+      prog->list_heads_[heads[i]] = i;
+  }
+
+  if (r.GetByte() != 0) {
+    // May be NULL if the searcher no longer fits on this CPU; searches
+    // then go without literal accel.
+    prog->literal_accel_ = LiteralAccel::Deserialize(&r);
+  }
+  if (!r.ok() || !prog->DeserializeOnePass(&r) ||
+      !prog->DeserializeFlatDFAs(&r))
+    return NULL;
+  return prog.release();
+}
+
+#if defined(RE2_PREFIX_ACCEL_AVX2) || defined(RE2_PREFIX_ACCEL_SSE2)
 // Finds the least significant non-zero bit in n.
 static int FindLSBSet(uint32_t n) {
   DCHECK_NE(n, 0);
@@ -940,49 +1139,143 @@ static int FindLSBSet(uint32_t n) {
 }
 #endif
 
+// The bytes compared by prefix accel. A candidate is a position p with
+// (p[0] | front_mask) == front and (p[back_offset] | back_mask) == back.
+// The masks are 0x20 for ASCII letters of case-folded prefixes (which are
+// lowercase) and 0 otherwise.
+struct PrefixFilter {
+  uint8_t front;
+  uint8_t back;
+  uint8_t front_mask;
+  uint8_t back_mask;
+  size_t back_offset;
+};
+
+// Each of the vectorized searches below tests the positions [p, end) in
+// whole blocks. It returns the first candidate found, or NULL after
+// setting *rest to the first position that it did not test.
+
+#if defined(RE2_PREFIX_ACCEL_AVX2)
+#if RE2_PREFIX_ACCEL_AVX2 == 2
+__attribute__((target("avx2")))
+#endif
+static const char* PrefixAccel_AVX2(const char* p, const char* end,
+                                    const PrefixFilter& f, const char** rest) {
+  const __m256i f_set1 = _mm256_set1_epi8(static_cast<char>(f.front));
+  const __m256i b_set1 = _mm256_set1_epi8(static_cast<char>(f.back));
+  const __m256i f_mask = _mm256_set1_epi8(static_cast<char>(f.front_mask));
+  const __m256i b_mask = _mm256_set1_epi8(static_cast<char>(f.back_mask));
+  for (; end - p >= static_cast<ptrdiff_t>(sizeof(__m256i));
+       p += sizeof(__m256i)) {
+    const __m256i f_loadu = _mm256_or_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), f_mask);
+    const __m256i b_loadu = _mm256_or_si256(
+        _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p + f.back_offset)), b_mask);
+    const __m256i f_cmpeq = _mm256_cmpeq_epi8(f_set1, f_loadu);
+    const __m256i b_cmpeq = _mm256_cmpeq_epi8(b_set1, b_loadu);
+    const int fb_testz = _mm256_testz_si256(f_cmpeq, b_cmpeq);
+    if (fb_testz == 0) {  // ZF: 1 means zero, 0 means non-zero.
+      const __m256i fb_and = _mm256_and_si256(f_cmpeq, b_cmpeq);
+      const int fb_movemask = _mm256_movemask_epi8(fb_and);
+      return p + FindLSBSet(fb_movemask);
+    }
+  }
+  *rest = p;
+  return NULL;
+}
+
+#if RE2_PREFIX_ACCEL_AVX2 == 2
+static bool CPUHasAVX2() {
+  static const bool avx2 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  return avx2;
+}
+#endif
+#endif
+
+#if defined(RE2_PREFIX_ACCEL_SSE2)
+static const char* PrefixAccel_SSE2(const char* p, const char* end,
+                                    const PrefixFilter& f, const char** rest) {
+  const __m128i f_set1 = _mm_set1_epi8(static_cast<char>(f.front));
+  const __m128i b_set1 = _mm_set1_epi8(static_cast<char>(f.back));
+  const __m128i f_mask = _mm_set1_epi8(static_cast<char>(f.front_mask));
+  const __m128i b_mask = _mm_set1_epi8(static_cast<char>(f.back_mask));
+  for (; end - p >= static_cast<ptrdiff_t>(sizeof(__m128i));
+       p += sizeof(__m128i)) {
+    const __m128i f_loadu = _mm_or_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), f_mask);
+    const __m128i b_loadu = _mm_or_si128(
+        _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p + f.back_offset)), b_mask);
+    const __m128i fb_and = _mm_and_si128(_mm_cmpeq_epi8(f_set1, f_loadu),
+                                         _mm_cmpeq_epi8(b_set1, b_loadu));
+    const int fb_movemask = _mm_movemask_epi8(fb_and);
+    if (fb_movemask != 0)
+      return p + FindLSBSet(fb_movemask);
+  }
+  *rest = p;
+  return NULL;
+}
+#endif
+
 const void* Prog::PrefixAccel_FrontAndBack(const void* data, size_t size) {
-  DCHECK_GE(prefix_size_, 2);
+  DCHECK(prefix_size_ >= 2 || prefix_foldcase_);
   if (size < prefix_size_)
     return NULL;
   // Don't bother searching the last prefix_size_-1 bytes for prefix_front_.
   // This also means that probing for prefix_back_ doesn't go out of bounds.
   size -= prefix_size_-1;
 
-#if defined(__AVX2__)
-  // Use AVX2 to look for prefix_front_ and prefix_back_ 32 bytes at a time.
-  if (size >= sizeof(__m256i)) {
-    const __m256i* fp = reinterpret_cast<const __m256i*>(
-        reinterpret_cast<const char*>(data));
-    const __m256i* bp = reinterpret_cast<const __m256i*>(
-        reinterpret_cast<const char*>(data) + prefix_size_-1);
-    const __m256i* endfp = fp + size/sizeof(__m256i);
-    const __m256i f_set1 = _mm256_set1_epi8(prefix_front_);
-    const __m256i b_set1 = _mm256_set1_epi8(prefix_back_);
-    while (fp != endfp) {
-      const __m256i f_loadu = _mm256_loadu_si256(fp++);
-      const __m256i b_loadu = _mm256_loadu_si256(bp++);
-      const __m256i f_cmpeq = _mm256_cmpeq_epi8(f_set1, f_loadu);
-      const __m256i b_cmpeq = _mm256_cmpeq_epi8(b_set1, b_loadu);
-      const int fb_testz = _mm256_testz_si256(f_cmpeq, b_cmpeq);
-      if (fb_testz == 0) {  // ZF: 1 means zero, 0 means non-zero.
-        const __m256i fb_and = _mm256_and_si256(f_cmpeq, b_cmpeq);
-        const int fb_movemask = _mm256_movemask_epi8(fb_and);
-        const int fb_ctz = FindLSBSet(fb_movemask);
-        return reinterpret_cast<const char*>(fp-1) + fb_ctz;
-      }
-    }
-    data = fp;
-    size = size%sizeof(__m256i);
+  PrefixFilter f;
+  f.front = static_cast<uint8_t>(prefix_front_);
+  f.back = static_cast<uint8_t>(prefix_back_);
+  f.front_mask = prefix_foldcase_ && 'a' <= f.front && f.front <= 'z' ? 0x20 : 0;
+  f.back_mask = prefix_foldcase_ && 'a' <= f.back && f.back <= 'z' ? 0x20 : 0;
+  f.back_offset = prefix_size_-1;
+
+  const char* p = reinterpret_cast<const char*>(data);
+  const char* end = p + size;
+#if defined(RE2_PREFIX_ACCEL_AVX2)
+#if RE2_PREFIX_ACCEL_AVX2 == 2
+  if (CPUHasAVX2())
+#endif
+  {
+    const char* found = PrefixAccel_AVX2(p, end, f, &p);
+    if (found != NULL)
+      return found;
+  }
+#endif
+#if defined(RE2_PREFIX_ACCEL_SSE2)
+  {
+    const char* found = PrefixAccel_SSE2(p, end, f, &p);
+    if (found != NULL)
+      return found;
   }
 #endif
 
-  const char* p0 = reinterpret_cast<const char*>(data);
-  for (const char* p = p0;; p++) {
-    DCHECK_GE(size, static_cast<size_t>(p-p0));
-    p = reinterpret_cast<const char*>(memchr(p, prefix_front_, size - (p-p0)));
-    if (p == NULL || p[prefix_size_-1] == prefix_back_)
-      return p;
+  const uint8_t* bp = reinterpret_cast<const uint8_t*>(p);
+  const uint8_t* ep = reinterpret_cast<const uint8_t*>(end);
+  if (f.front_mask == 0) {
+    for (;; bp++) {
+      DCHECK_GE(ep, bp);
+      bp = reinterpret_cast<const uint8_t*>(memchr(bp, f.front, ep - bp));
+      if (bp == NULL || (bp[f.back_offset] | f.back_mask) == f.back)
+        return bp;
+    }
+  }
+  for (; bp != ep; bp++) {
+    if ((bp[0] | f.front_mask) == f.front &&
+        (bp[f.back_offset] | f.back_mask) == f.back)
+      return bp;
   }
+  return NULL;
+}
+
+const void* Prog::PrefixAccel_Literals(const void* data, size_t size) {
+  return literal_accel_->Find(data, size);
 }
 
 }  // namespace re2
@@ -50,7 +50,10 @@ enum EmptyOp {
 };
 
 class DFA;
+class LiteralAccel;
 class Regexp;
+class SerialReader;
+class SerialWriter;
 
 // Compiled form of regexp program.
 class Prog {
@@ -215,20 +218,31 @@ class Prog {
   void set_anchor_end(bool b) { anchor_end_ = b; }
   int bytemap_range() { return bytemap_range_; }
   const uint8_t* bytemap() { return bytemap_; }
-  bool can_prefix_accel() { return prefix_size_ != 0; }
+  bool can_prefix_accel() {
+    return prefix_size_ != 0 || literal_accel_ != NULL;
+  }
 
   // Accelerates to the first likely occurrence of the prefix.
   // Returns a pointer to the first byte or NULL if not found.
   const void* PrefixAccel(const void* data, size_t size) {
+    if (literal_accel_ != NULL)
+      return PrefixAccel_Literals(data, size);
     DCHECK_GE(prefix_size_, 1);
-    return prefix_size_ == 1 ? memchr(data, prefix_front_, size)
-                             : PrefixAccel_FrontAndBack(data, size);
+    return prefix_size_ == 1 && !prefix_foldcase_
+               ? memchr(data, prefix_front_, size)
+               : PrefixAccel_FrontAndBack(data, size);
   }
 
   // An implementation of prefix accel that looks for prefix_front_ and
   // prefix_back_ to return fewer false positives than memchr(3) alone.
+  // Uses SSE2 or AVX2 (if the CPU has it) to test 16 or 32 positions at
+  // a time. If prefix_foldcase_, ASCII letters match in either case.
   const void* PrefixAccel_FrontAndBack(const void* data, size_t size);
 
+  // An implementation of prefix accel for regexps whose matches begin
+  // with one of several literals (see LiteralAccel).
+  const void* PrefixAccel_Literals(const void* data, size_t size);
+
   // Returns string representation of program for debugging.
   std::string Dump();
   std::string DumpUnanchored();
@@ -281,6 +295,14 @@ class Prog {
                  Anchor anchor, MatchKind kind, StringPiece* match0,
                  bool* failed, SparseSet* matches);
 
+  // Searches each of texts[0, n) for a match, as its own context, and sets
+  // matched[i] as SearchDFA(texts[i], texts[i], anchor, kLongestMatch,
+  // NULL, &failed[i], NULL) would. The DFA setup and cache lock are paid
+  // once for the batch rather than once per text, which matters when the
+  // texts are short. Forward programs only.
+  void SearchDFABatch(const StringPiece* texts, size_t n, Anchor anchor,
+                      bool* matched, bool* failed);
+
   // The callback issued after building each DFA state with BuildEntireDFA().
   // If next is null, then the memory budget has been exhausted and building
   // will halt. Otherwise, the state has been built and next points to an array
@@ -298,6 +320,21 @@ class Prog {
   // FOR TESTING OR EXPERIMENTAL PURPOSES ONLY.
   int BuildEntireDFA(MatchKind kind, const DFAStateCallback& cb);
 
+  // Build the DFA for the given match kind ahead of time, so that later
+  // searches find its states already in the cache. Starts from the state
+  // for an anchored or unanchored search at the beginning of the text.
+  // Stops after max_states states (if max_states > 0) or when the DFA
+  // runs out of memory. Sets *complete to whether every reachable state
+  // was built. Returns the number of states built.
+  int BuildDFA(MatchKind kind, bool anchored, int max_states, bool* complete);
+
+  // Copy the entire DFA for the given match kind into a flat transition
+  // table, which SearchDFA then uses without taking any locks. Returns
+  // false, leaving searches to the lazily built DFA, if the DFA has more
+  // than max_states states or runs out of memory. Not used by RE2::Set
+  // (kManyMatch).
+  bool BuildFlatDFA(MatchKind kind, bool anchored, int max_states);
+
   // Controls whether the DFA should bail out early if the NFA would be faster.
   // FOR TESTING ONLY.
   static void TEST_dfa_should_bail_when_slow(bool b);
@@ -323,8 +360,6 @@ class Prog {
                       Anchor anchor, MatchKind kind,
                       StringPiece* match, int nmatch);
 
-  static const int kMaxOnePassCapture = 5;  // $0 through $4
-
   // Backtracking search: the gold standard against which the other
   // implementations are checked.  FOR TESTING ONLY.
   // It allocates a ton of memory to avoid running forever.
@@ -360,6 +395,19 @@ class Prog {
   // its own Match instruction recording the index in the output vector.
   static Prog* CompileSet(Regexp* re, RE2::Anchor anchor, int64_t max_mem);
 
+  // Appends a portable encoding of the program to out: the instructions,
+  // the bytemap, the prefix accel, the one-pass NFA (if IsOnePass() has
+  // been called) and any flat DFA tables built by BuildFlatDFA(). DFA
+  // states built lazily by searches are not included. Must not run
+  // concurrently with the first search of the program. Not for programs
+  // compiled with CompileSet().
+  void Serialize(std::string* out);
+
+  // Decodes a program written by Serialize() from the front of *in and
+  // advances *in past it, so that it is ready to search without being
+  // compiled. Returns NULL if the encoding is malformed.
+  static Prog* Deserialize(StringPiece* in);
+
   // Flattens the Prog from "tree" form to "list" form. This is an in-place
   // operation in the sense that the old instructions are lost.
   void Flatten();
@@ -396,6 +444,13 @@ class Prog {
   DFA* GetDFA(MatchKind kind);
   void DeleteDFA(DFA* dfa);
 
+  // The parts of Serialize() and Deserialize() that belong to the
+  // one-pass NFA and to the flat DFA tables.
+  void SerializeOnePass(SerialWriter* w);
+  bool DeserializeOnePass(SerialReader* r);
+  void SerializeFlatDFAs(SerialWriter* w);
+  bool DeserializeFlatDFAs(SerialReader* r);
+
   bool anchor_start_;       // regexp has explicit start anchor
   bool anchor_end_;         // regexp has explicit end anchor
   bool reversed_;           // whether program runs backward over input
@@ -407,8 +462,10 @@ class Prog {
   int size_;                // number of instructions
   int bytemap_range_;       // bytemap_[x] < bytemap_range_
   size_t prefix_size_;      // size of prefix (0 if no prefix)
+  bool prefix_foldcase_;    // prefix is case-insensitive (and lowercase)
   int prefix_front_;        // first byte of prefix (-1 if no prefix)
   int prefix_back_;         // last byte of prefix (-1 if no prefix)
+  LiteralAccel* literal_accel_;  // accel for several prefixes (or NULL)
 
   int list_count_;                 // count of lists (see above)
   int inst_count_[kNumInst];       // count of instructions by opcode
@@ -417,6 +474,8 @@ class Prog {
 
   PODArray<Inst> inst_;              // pointer to instruction array
   PODArray<uint8_t> onepass_nodes_;  // data for OnePass nodes
+  PODArray<int> onepass_capsets_;    // capture sets of OnePass actions
+  int onepass_index_shift_;          // bits below node index in actions
 
   int64_t dfa_mem_;         // Maximum memory for DFAs.
   DFA* dfa_first_;          // DFA cached for kFirstMatch/kManyMatch
@@ -20,7 +20,10 @@
 #include <string.h>
 #include <algorithm>
 #include <atomic>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
@@ -32,6 +35,7 @@
 #include "util/utf.h"
 #include "re2/prog.h"
 #include "re2/regexp.h"
+#include "re2/serial.h"
 #include "re2/sparse_array.h"
 
 namespace re2 {
@@ -55,7 +59,9 @@ RE2::Options::Options(RE2::CannedOptions opt)
     case_sensitive_(true),
     perl_classes_(false),
     word_boundary_(false),
-    one_line_(false) {
+    one_line_(false),
+    bit_state_max_mem_(kDefaultBitStateMaxMem),
+    one_pass_max_text_(kDefaultOnePassMaxText) {
 }
 
 // static empty objects for use as const references.
@@ -170,7 +176,7 @@ int RE2::Options::ParseFlags() const {
   return flags;
 }
 
-void RE2::Init(const StringPiece& pattern, const Options& options) {
+void RE2::InitFields(const StringPiece& pattern, const Options& options) {
   static std::once_flag empty_once;
   std::call_once(empty_once, []() {
     empty_string = new std::string;
@@ -194,6 +200,10 @@ void RE2::Init(const StringPiece& pattern, const Options& options) {
   rprog_ = NULL;
   named_groups_ = NULL;
   group_names_ = NULL;
+}
+
+void RE2::Init(const StringPiece& pattern, const Options& options) {
+  InitFields(pattern, options);
 
   RegexpStatus status;
   entire_regexp_ = Regexp::Parse(
@@ -245,8 +255,10 @@ void RE2::Init(const StringPiece& pattern, const Options& options) {
 // Returns rprog_, computing it if needed.
 re2::Prog* RE2::ReverseProg() const {
   std::call_once(rprog_once_, [](const RE2* re) {
-    re->rprog_ =
-        re->suffix_regexp_->CompileToReverseProg(re->options_.max_mem() / 3);
+    re->ParsePattern();
+    if (re->suffix_regexp_ != NULL)
+      re->rprog_ = re->suffix_regexp_->CompileToReverseProg(
+          re->options_.max_mem() / 3);
     if (re->rprog_ == NULL) {
       if (re->options_.log_errors())
         LOG(ERROR) << "Error reverse compiling '" << trunc(re->pattern_) << "'";
@@ -346,6 +358,171 @@ int RE2::ReverseProgramFanout(std::vector<int>* histogram) const {
   return Fanout(prog, histogram);
 }
 
+// Calls f(prog, kind, anchored) for each DFA used by unanchored searches,
+// mirroring the choice of DFAs made by Match(). Searches that only ask
+// whether there is a match run the kLongestMatch DFA for the earliest
+// match, so it is included along with the DFA for the match kind.
+// rprog is the reverse program, or NULL to skip it.
+static void ForEachSearchDFA(
+    Prog* prog, Prog* rprog, bool longest_match,
+    const std::function<void(Prog*, Prog::MatchKind, bool)>& f) {
+  if (!prog->anchor_end()) {
+    f(prog, Prog::kLongestMatch, prog->anchor_start());
+    if (!longest_match)
+      f(prog, Prog::kFirstMatch, prog->anchor_start());
+  }
+  if (rprog != NULL)
+    f(rprog, Prog::kLongestMatch, true);
+}
+
+int RE2::WarmDFA(bool reverse, int max_states, bool* complete) const {
+  if (complete != NULL)
+    *complete = false;
+  if (prog_ == NULL)
+    return -1;
+
+  Prog* rprog = reverse || prog_->anchor_end() ? ReverseProg() : NULL;
+  bool done = true;
+  int nstates = 0;
+  ForEachSearchDFA(prog_, rprog, options_.longest_match(),
+                   [&](Prog* prog, Prog::MatchKind kind, bool anchored) {
+    bool built = false;
+    nstates += prog->BuildDFA(kind, anchored, max_states, &built);
+    done = done && built;
+  });
+  if (complete != NULL)
+    *complete = done;
+  return nstates;
+}
+
+bool RE2::BuildFlatDFA(bool reverse, int max_states) const {
+  if (prog_ == NULL)
+    return false;
+
+  Prog* rprog = reverse || prog_->anchor_end() ? ReverseProg() : NULL;
+  if ((reverse || prog_->anchor_end()) && rprog == NULL)
+    return false;
+  bool built = true;
+  ForEachSearchDFA(prog_, rprog, options_.longest_match(),
+                   [&](Prog* prog, Prog::MatchKind kind, bool anchored) {
+    built = prog->BuildFlatDFA(kind, anchored, max_states) && built;
+  });
+  return built;
+}
+
+re2::Regexp* RE2::Regexp() const {
+  ParsePattern();
+  return entire_regexp_;
+}
+
+void RE2::ParsePattern() const {
+  std::call_once(regexp_once_, [](const RE2* re) {
+    // Init() has parsed the pattern already, or failed to compile it.
+    if (re->entire_regexp_ != NULL || re->prog_ == NULL)
+      return;
+    re->entire_regexp_ = Regexp::Parse(
+        re->pattern_,
+        static_cast<Regexp::ParseFlags>(re->options_.ParseFlags()),
+        NULL);
+    if (re->entire_regexp_ == NULL)
+      return;
+    std::string prefix;
+    bool prefix_foldcase;
+    re2::Regexp* suffix;
+    if (re->entire_regexp_->RequiredPrefix(&prefix, &prefix_foldcase,
+                                           &suffix))
+      re->suffix_regexp_ = suffix;
+    else
+      re->suffix_regexp_ = re->entire_regexp_->Incref();
+  }, this);
+}
+
+// Version of the encoding written by RE2::Serialize.
+static const uint8_t kRE2SerialVersion = 1;
+
+bool RE2::Serialize(bool reverse, std::string* out) const {
+  if (prog_ == NULL)
+    return false;
+  Prog* rprog = reverse ? ReverseProg() : NULL;
+
+  SerialWriter w(out);
+  w.PutByte(kRE2SerialVersion);
+  w.PutString(prefix_);
+  w.PutByte(prefix_foldcase_);
+  w.Put32(num_captures_);
+  const std::map<int, std::string>& names = CapturingGroupNames();
+  w.Put32(static_cast<uint32_t>(names.size()));
+  for (const auto& name : names) {
+    w.Put32(name.first);
+    w.PutString(name.second);
+  }
+  prog_->Serialize(out);
+  w.PutByte(rprog != NULL);
+  if (rprog != NULL)
+    rprog->Serialize(out);
+  return true;
+}
+
+RE2* RE2::Deserialize(const StringPiece& pattern, const Options& options,
+                      const StringPiece& data) {
+  std::unique_ptr<RE2> re(new RE2(NoInit()));
+  re->InitFields(pattern, options);
+
+  StringPiece in(data);
+  SerialReader r(&in);
+  if (r.GetByte() != kRE2SerialVersion)
+    return NULL;
+  r.GetString(&re->prefix_);
+  re->prefix_foldcase_ = r.GetByte() != 0;
+  re->num_captures_ = static_cast<int>(r.Get32());
+  uint32_t nnames = r.Get32();
+  if (!r.CanRead(nnames, 8) || re->num_captures_ < 0)
+    return NULL;
+  std::unique_ptr<std::map<int, std::string>> group_names(
+      new std::map<int, std::string>);
+  std::unique_ptr<std::map<std::string, int>> named_groups(
+      new std::map<std::string, int>);
+  for (uint32_t i = 0; i < nnames; i++) {
+    int index = static_cast<int>(r.Get32());
+    std::string name;
+    if (!r.GetString(&name) || index < 1 || index > re->num_captures_)
+      return NULL;
+    (*group_names)[index] = name;
+    // Names arrive in group order, so the leftmost group keeps a repeated
+    // name, as in Regexp::NamedCaptures.
+    named_groups->emplace(name, index);
+  }
+
+  std::unique_ptr<Prog> prog(Prog::Deserialize(&in));
+  if (prog == NULL || prog->reversed())
+    return NULL;
+  std::unique_ptr<Prog> rprog;
+  if (r.GetByte() != 0) {
+    rprog.reset(Prog::Deserialize(&in));
+    if (rprog == NULL || !rprog->reversed())
+      return NULL;
+  }
+  if (!r.ok() || !in.empty())
+    return NULL;
+
+  re->prog_ = prog.release();
+  re->is_one_pass_ = re->prog_->IsOnePass();
+  if (rprog != NULL) {
+    std::call_once(re->rprog_once_, [&rprog](const RE2* re) {
+      re->rprog_ = rprog.release();
+    }, re.get());
+  }
+  std::call_once(re->named_groups_once_, [&named_groups](const RE2* re) {
+    re->named_groups_ = named_groups->empty() ? empty_named_groups
+                                              : named_groups.release();
+  }, re.get());
+  std::call_once(re->group_names_once_, [&group_names](const RE2* re) {
+    re->group_names_ = group_names->empty() ? empty_group_names
+                                            : group_names.release();
+  }, re.get());
+  return re.release();
+}
+
 // Returns named_groups_, computing it if needed.
 const std::map<std::string, int>& RE2::NamedCapturingGroups() const {
   std::call_once(named_groups_once_, [](const RE2* re) {
@@ -690,15 +867,35 @@ bool RE2::Match(const StringPiece& text,
   if (options_.longest_match())
     kind = Prog::kLongestMatch;
 
-  bool can_one_pass = (is_one_pass_ && ncap <= Prog::kMaxOnePassCapture);
+  bool can_one_pass = is_one_pass_;
 
   // BitState allocates a bitmap of size prog_->list_count() * text.size().
   // It also allocates a stack of 3-word structures which could potentially
   // grow as large as prog_->list_count() * text.size(), but in practice is
-  // much smaller.
+  // much smaller. The bitmap is sized to the text actually searched.
+  // Skipping the DFA in favour of BitState means searching the whole text,
+  // so that is only done under the original fixed bitmap size. After the
+  // DFA has run, the text searched is just the match, and it may use
+  // BitState up to bit_state_max_mem.
   const int kMaxBitStateBitmapSize = 256*1024;  // bitmap size <= max (bits)
   bool can_bit_state = prog_->CanBitState();
-  size_t bit_state_text_max = kMaxBitStateBitmapSize / prog_->list_count();
+  size_t bit_state_skip_dfa_max = 0;
+  size_t bit_state_text_max = 0;
+  if (can_bit_state && options_.bit_state_max_mem() > 0) {
+    // BitState counts the 64-bit words of its bitmap in an int.
+    const uint64_t kMaxBits =
+        static_cast<uint64_t>(std::numeric_limits<int>::max()) * 64;
+    uint64_t bits = std::min<uint64_t>(
+        static_cast<uint64_t>(options_.bit_state_max_mem()), kMaxBits / 8) * 8;
+    bit_state_text_max = static_cast<size_t>(std::min<uint64_t>(
+        bits / prog_->list_count(),
+        static_cast<uint64_t>(std::numeric_limits<int>::max()) - 1));
+    bit_state_skip_dfa_max = std::min<size_t>(
+        kMaxBitStateBitmapSize / prog_->list_count(), bit_state_text_max);
+  }
+  size_t one_pass_text_max = 0;
+  if (options_.one_pass_max_text() > 0)
+    one_pass_text_max = static_cast<size_t>(options_.one_pass_max_text());
 
 #ifdef RE2_HAVE_THREAD_LOCAL
   hooks::context = this;
@@ -800,12 +997,13 @@ bool RE2::Match(const StringPiece& text,
       // On tiny texts, OnePass outruns even the DFA, and
       // it doesn't have the shared state and occasional mutex that
       // the DFA does.
-      if (can_one_pass && text.size() <= 4096 &&
+      if (can_one_pass && text.size() <= one_pass_text_max &&
           (ncap > 1 || text.size() <= 8)) {
         skipped_test = true;
         break;
       }
-      if (can_bit_state && text.size() <= bit_state_text_max && ncap > 1) {
+      if (can_bit_state && text.size() <= bit_state_skip_dfa_max &&
+          ncap > 1) {
         skipped_test = true;
         break;
       }
@@ -879,6 +1077,33 @@ bool RE2::Match(const StringPiece& text,
   return true;
 }
 
+void RE2::MatchBatch(const StringPiece* texts, size_t n, bool* matched) const {
+  // With a required prefix, prog_ matches only what follows the prefix,
+  // so leave those regexps to Match.
+  if (!ok() || !prefix_.empty()) {
+    for (size_t i = 0; i < n; i++)
+      matched[i] = Match(texts[i], 0, texts[i].size(), UNANCHORED, NULL, 0);
+    return;
+  }
+
+#ifdef RE2_HAVE_THREAD_LOCAL
+  hooks::context = this;
+#endif
+  static const size_t kBatch = 256;
+  bool failed[kBatch];
+  for (size_t i = 0; i < n; i += kBatch) {
+    size_t m = std::min(kBatch, n - i);
+    prog_->SearchDFABatch(texts + i, m, Prog::kUnanchored, matched + i,
+                          failed);
+    // Match falls back to the NFA when the DFA gives up.
+    for (size_t j = 0; j < m; j++) {
+      if (failed[j])
+        matched[i + j] = Match(texts[i + j], 0, texts[i + j].size(),
+                               UNANCHORED, NULL, 0);
+    }
+  }
+}
+
 // Internal matcher - like Match() but takes Args not StringPieces.
 bool RE2::DoMatch(const StringPiece& text,
                   Anchor re_anchor,
@@ -742,6 +742,203 @@ bool Regexp::RequiredPrefixForAccel(std::string* prefix, bool* foldcase) {
   return true;
 }
 
+// How the ASCII letters of the prefixes found by PrefixesForAccel are
+// to be matched: ignoring case, or exactly. LiteralAccel applies one
+// setting to all the literals, so a set that needs both is not used.
+enum {
+  kPrefixFoldCase = 1 << 0,
+  kPrefixExactCase = 1 << 1,
+};
+
+static bool IsASCIILetter(Rune r) {
+  return ('A' <= r && r <= 'Z') || ('a' <= r && r <= 'z');
+}
+
+// Helper for RequiredPrefixesForAccel. Sets *prefixes to strings such
+// that every match of re begins with one of them, and *exact to whether
+// re matches exactly those strings and nothing else. The empty string
+// means that a match can begin with anything. Adds to *fold the ways
+// (kPrefixFoldCase, kPrefixExactCase) in which the letters of the
+// strings must be matched. Returns false if re is not something we know
+// how to handle.
+static bool PrefixesForAccel(Regexp* re, int depth, size_t max_len,
+                             size_t max_prefixes,
+                             std::vector<std::string>* prefixes,
+                             bool* exact, int* fold) {
+  prefixes->clear();
+  *exact = false;
+  if (depth > 100)
+    return false;
+
+  bool latin1 = (re->parse_flags() & Regexp::Latin1) != 0;
+  switch (re->op()) {
+    default:
+      return false;
+
+    case kRegexpEmptyMatch:
+      prefixes->emplace_back();
+      *exact = true;
+      return true;
+
+    case kRegexpLiteral:
+    case kRegexpLiteralString: {
+      Rune rune;
+      Rune* runes = &rune;
+      int nrunes = 1;
+      if (re->op() == kRegexpLiteral) {
+        rune = re->rune();
+      } else {
+        runes = re->runes();
+        nrunes = re->nrunes();
+      }
+      std::string bytes;
+      ConvertRunesToBytes(latin1, runes, nrunes, &bytes);
+      for (int i = 0; i < nrunes; i++) {
+        if (IsASCIILetter(runes[i]))
+          *fold |= (re->parse_flags() & Regexp::FoldCase) ? kPrefixFoldCase
+                                                          : kPrefixExactCase;
+      }
+      prefixes->push_back(bytes);
+      *exact = true;
+      return true;
+    }
+
+    case kRegexpCharClass: {
+      CharClass* cc = re->cc();
+      if (cc->empty() || static_cast<size_t>(cc->size()) > max_prefixes)
+        return false;
+      for (CharClass::iterator i = cc->begin(); i != cc->end(); ++i) {
+        for (Rune r = i->lo; r <= i->hi; r++) {
+          std::string bytes;
+          ConvertRunesToBytes(latin1, &r, 1, &bytes);
+          prefixes->push_back(bytes);
+          // A letter without its other case must be matched exactly.
+          if (IsASCIILetter(r) && !cc->Contains(r ^ 0x20))
+            *fold |= kPrefixExactCase;
+        }
+      }
+      *exact = true;
+      return true;
+    }
+
+    case kRegexpCapture:
+      return PrefixesForAccel(re->sub()[0], depth+1, max_len, max_prefixes,
+                              prefixes, exact, fold);
+
+    case kRegexpQuest:
+    case kRegexpStar:
+    case kRegexpPlus:
+    case kRegexpRepeat: {
+      if (!PrefixesForAccel(re->sub()[0], depth+1, max_len, max_prefixes,
+                            prefixes, exact, fold))
+        return false;
+      // x? matches exactly what x does, and the empty string.
+      *exact = *exact && re->op() == kRegexpQuest;
+      if (re->op() == kRegexpQuest || re->op() == kRegexpStar ||
+          (re->op() == kRegexpRepeat && re->min() == 0))
+        prefixes->emplace_back();
+      return true;
+    }
+
+    case kRegexpAlternate: {
+      std::vector<std::string> sub;
+      *exact = true;
+      for (int i = 0; i < re->nsub(); i++) {
+        bool sub_exact;
+        if (!PrefixesForAccel(re->sub()[i], depth+1, max_len, max_prefixes,
+                              &sub, &sub_exact, fold))
+          return false;
+        if (prefixes->size() + sub.size() > max_prefixes)
+          return false;
+        prefixes->insert(prefixes->end(), sub.begin(), sub.end());
+        *exact = *exact && sub_exact;
+      }
+      return true;
+    }
+
+    case kRegexpConcat: {
+      // Extend the prefixes of the first subexpressions by those of the
+      // next ones for as long as the prefixes are exact and short.
+      std::vector<std::string> sub;
+      prefixes->emplace_back();
+      *exact = true;
+      for (int i = 0; i < re->nsub() && *exact; i++) {
+        bool all_long = true;
+        for (const std::string& prefix : *prefixes)
+          all_long = all_long && prefix.size() >= max_len;
+        bool sub_exact;
+        int sub_fold = 0;
+        // Stop, too, before letters that would need the other way of
+        // matching case than the ones so far, as in (?i:foo)BAR.
+        if (all_long ||
+            !PrefixesForAccel(re->sub()[i], depth+1, max_len, max_prefixes,
+                              &sub, &sub_exact, &sub_fold) ||
+            prefixes->size() * sub.size() > max_prefixes ||
+            (*fold | sub_fold) == (kPrefixFoldCase | kPrefixExactCase)) {
+          *exact = false;
+          break;
+        }
+        *fold |= sub_fold;
+        std::vector<std::string> product;
+        for (const std::string& prefix : *prefixes)
+          for (const std::string& suffix : sub)
+            product.push_back(prefix + suffix);
+        prefixes->swap(product);
+        *exact = sub_exact;
+      }
+      return true;
+    }
+  }
+}
+
+bool Regexp::RequiredPrefixesForAccel(std::vector<std::string>* prefixes,
+                                      bool* foldcase, size_t max_len,
+                                      size_t max_prefixes) {
+  prefixes->clear();
+  *foldcase = false;
+
+  bool exact;
+  int fold = 0;
+  if (!PrefixesForAccel(this, 0, max_len, max_prefixes, prefixes, &exact,
+                        &fold) ||
+      fold == (kPrefixFoldCase | kPrefixExactCase)) {
+    prefixes->clear();
+    return false;
+  }
+  *foldcase = fold == kPrefixFoldCase;
+  for (std::string& prefix : *prefixes) {
+    if (prefix.size() > max_len)
+      prefix.resize(max_len);
+    if (*foldcase) {
+      for (char& c : prefix) {
+        if ('A' <= c && c <= 'Z')
+          c += 'a' - 'A';
+      }
+    }
+  }
+
+  // Keep only the shortest of the strings sharing a prefix: the others
+  // add nothing when looking for where a match can begin. After sorting,
+  // the strings that begin with a given string follow it directly.
+  std::sort(prefixes->begin(), prefixes->end());
+  size_t n = 0;
+  for (size_t i = 0; i < prefixes->size(); i++) {
+    const std::string& prefix = (*prefixes)[i];
+    if (n > 0 && prefix.compare(0, (*prefixes)[n-1].size(),
+                                (*prefixes)[n-1]) == 0)
+      continue;
+    (*prefixes)[n++] = prefix;
+  }
+  prefixes->resize(n);
+
+  if (prefixes->empty() || prefixes->front().empty()) {
+    prefixes->clear();
+    *foldcase = false;
+    return false;
+  }
+  return true;
+}
+
 // Character class builder is a balanced binary tree (STL set)
 // containing non-overlapping, non-abutting RuneRanges.
 // The less-than operator used in the tree treats two
@@ -91,6 +91,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "util/util.h"
 #include "util/logging.h"
@@ -449,6 +450,19 @@ class Regexp {
   // regardless of the return value.
   bool RequiredPrefixForAccel(std::string* prefix, bool* foldcase);
 
+  // Whether every match of this regexp must begin with one of a small
+  // set of non-empty fixed strings (perhaps after ASCII case-folding),
+  // as in foo|bar|ba[rz]. If so, returns the strings, which are at most
+  // max_len bytes long (strings that would be longer are truncated) and
+  // of which none is a prefix of another. Fails if there would be more
+  // than max_prefixes strings, or if the letters of some strings would
+  // have to match ignoring case and those of others exactly.
+  // Callers should expect *prefixes and *foldcase to be "zeroed"
+  // regardless of the return value.
+  bool RequiredPrefixesForAccel(std::vector<std::string>* prefixes,
+                                bool* foldcase, size_t max_len,
+                                size_t max_prefixes);
+
  private:
   // Constructor allocates vectors as appropriate for operator.
   explicit Regexp(RegexpOp op, ParseFlags parse_flags);
@@ -0,0 +1,109 @@
+// Copyright 2021 The RE2 Authors.  All Rights Reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef RE2_SERIAL_H_
+#define RE2_SERIAL_H_
+
+// Helpers for the portable encoding of compiled regexps written by
+// RE2::Serialize and Prog::Serialize. Integers are little-endian and of
+// fixed width, so that the encoding does not depend on the host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "re2/stringpiece.h"
+
+namespace re2 {
+
+class SerialWriter {
+ public:
+  explicit SerialWriter(std::string* out) : out_(out) {}
+
+  void PutByte(uint8_t v) { out_->push_back(static_cast<char>(v)); }
+  void Put32(uint32_t v) { PutInt(v, 4); }
+  void Put64(uint64_t v) { PutInt(v, 8); }
+  void PutBytes(const void* data, size_t n) {
+    out_->append(static_cast<const char*>(data), n);
+  }
+  void PutString(const std::string& s) {
+    Put32(static_cast<uint32_t>(s.size()));
+    PutBytes(s.data(), s.size());
+  }
+
+ private:
+  void PutInt(uint64_t v, int nbytes) {
+    for (int i = 0; i < nbytes; i++)
+      out_->push_back(static_cast<char>((v >> (8*i)) & 0xFF));
+  }
+
+  std::string* out_;
+
+  SerialWriter(const SerialWriter&) = delete;
+  SerialWriter& operator=(const SerialWriter&) = delete;
+};
+
+// Reads from the front of *in, advancing it. Reading past the end fails
+// the reader: ok() becomes false and every later read returns zero.
+class SerialReader {
+ public:
+  explicit SerialReader(StringPiece* in) : in_(in), ok_(true) {}
+
+  bool ok() const { return ok_; }
+  void Fail() { ok_ = false; }
+
+  uint8_t GetByte() { return static_cast<uint8_t>(GetInt(1)); }
+  uint32_t Get32() { return static_cast<uint32_t>(GetInt(4)); }
+  uint64_t Get64() { return GetInt(8); }
+  bool GetBytes(void* data, size_t n) {
+    if (!Need(n))
+      return false;
+    memmove(data, in_->data(), n);
+    in_->remove_prefix(n);
+    return true;
+  }
+  bool GetString(std::string* s) {
+    uint32_t n = Get32();
+    if (!Need(n))
+      return false;
+    s->assign(in_->data(), n);
+    in_->remove_prefix(n);
+    return true;
+  }
+
+  // Whether count items of at least size bytes each could remain, so that
+  // a corrupt count fails before anything is allocated for it.
+  bool CanRead(uint64_t count, size_t size) {
+    if (ok_ && count > in_->size() / (size == 0 ? 1 : size))
+      ok_ = false;
+    return ok_;
+  }
+
+ private:
+  bool Need(size_t n) {
+    if (ok_ && in_->size() < n)
+      ok_ = false;
+    return ok_;
+  }
+  uint64_t GetInt(int nbytes) {
+    if (!Need(nbytes))
+      return 0;
+    uint64_t v = 0;
+    for (int i = 0; i < nbytes; i++)
+      v |= static_cast<uint64_t>(static_cast<uint8_t>((*in_)[i])) << (8*i);
+    in_->remove_prefix(nbytes);
+    return v;
+  }
+
+  StringPiece* in_;
+  bool ok_;
+
+  SerialReader(const SerialReader&) = delete;
+  SerialReader& operator=(const SerialReader&) = delete;
+};
+
+}  // namespace re2
+
+#endif  // RE2_SERIAL_H_
@@ -3,6 +3,7 @@
 // license that can be found in the LICENSE file.
 
 #include <stdint.h>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -122,6 +123,160 @@ TEST(SingleThreaded, BuildEntireDFA) {
   re->Decref();
 }
 
+// Check that BuildDFA stops at max_states and reports whether
+// the DFA is complete, and that RE2::WarmDFA leaves matching intact.
+TEST(SingleThreaded, BuildDFA) {
+  Regexp* re = Regexp::Parse("a[ab]{4}b", Regexp::LikePerl, NULL);
+  ASSERT_TRUE(re != NULL);
+  Prog* prog = re->CompileToProg(0);
+  ASSERT_TRUE(prog != NULL);
+  bool complete = true;
+  int partial = prog->BuildDFA(Prog::kFirstMatch, false, 5, &complete);
+  ASSERT_GE(partial, 5);
+  ASSERT_FALSE(complete);
+  int nstates = prog->BuildDFA(Prog::kFirstMatch, false, 0, &complete);
+  ASSERT_TRUE(complete);
+  ASSERT_GT(nstates, partial);
+  ASSERT_EQ(nstates, prog->BuildEntireDFA(Prog::kFirstMatch, nullptr));
+  delete prog;
+  re->Decref();
+
+  RE2 re2("(a[ab]{4}b)c");
+  ASSERT_GT(re2.WarmDFA(true, 0, &complete), 0);
+  ASSERT_TRUE(complete);
+  StringPiece m;
+  ASSERT_TRUE(RE2::PartialMatch("xxaababbcxx", re2, &m));
+  ASSERT_EQ(m, "aababb");
+
+  // A tiny memory budget cannot hold the DFA.
+  RE2::Options opt;
+  opt.set_max_mem(1<<14);
+  RE2 big("a[ab]{20}b", opt);
+  ASSERT_TRUE(big.ok());
+  ASSERT_GT(big.WarmDFA(false, 0, &complete), 0);
+  ASSERT_FALSE(complete);
+  ASSERT_TRUE(RE2::PartialMatch("xxaaaaaaaaaaaaaaaaaaaaabxx", big));
+}
+
+// Check that searches using the flat transition table agree with
+// searches using the lazily built DFA.
+TEST(SingleThreaded, BuildFlatDFA) {
+  const char* patterns[] = {
+    "a[ab]{4}b",
+    "(?i)hello|world",
+    "^abc",
+    "abc$",
+    "\\bfoo\\b",
+    "(?m)^x+$",
+    "(a+)(b*)",
+    "",
+    "a*",
+  };
+  const char* texts[] = {
+    "",
+    "xxaababbcxx",
+    "HeLLo, World",
+    "abcabc",
+    "a foo b",
+    "foobar",
+    "y\nxx\nz",
+    "aaab",
+    "\xff\xfe abc",
+  };
+  for (const char* pattern : patterns) {
+    RE2 lazy(pattern);
+    RE2 flat(pattern);
+    ASSERT_TRUE(flat.BuildFlatDFA(true, 1000)) << pattern;
+    for (const char* text : texts) {
+      StringPiece context(text);
+      for (size_t begin = 0; begin <= context.size(); begin++) {
+        for (size_t end = begin; end <= context.size(); end++) {
+          for (RE2::Anchor anchor : {RE2::UNANCHORED, RE2::ANCHOR_START,
+                                     RE2::ANCHOR_BOTH}) {
+            StringPiece m1[2], m2[2];
+            bool r1 = lazy.Match(context, begin, end, anchor, m1, 2);
+            bool r2 = flat.Match(context, begin, end, anchor, m2, 2);
+            ASSERT_EQ(r1, r2) << pattern << " " << text;
+            if (r1) {
+              ASSERT_EQ(m1[0].data(), m2[0].data());
+              ASSERT_EQ(m1[0].size(), m2[0].size());
+            }
+            ASSERT_EQ(lazy.Match(context, begin, end, anchor, NULL, 0),
+                      flat.Match(context, begin, end, anchor, NULL, 0));
+          }
+        }
+      }
+    }
+  }
+
+  // Too many states for the budget: searches fall back to the lazy DFA.
+  RE2 big("a[ab]{20}b");
+  ASSERT_FALSE(big.BuildFlatDFA(false, 100));
+  ASSERT_TRUE(RE2::PartialMatch("xxaaaaaaaaaaaaaaaaaaaaabxx", big));
+}
+
+// Check that MatchBatch agrees with Match, whether the DFA is flat,
+// lazy, or too small to complete some searches.
+TEST(SingleThreaded, MatchBatch) {
+  const char* patterns[] = {
+    "a[ab]{4}b",
+    "(?i)hello|world",
+    "^abc",
+    "^a+b",
+    "abc$",
+    "\\bfoo\\b",
+    "(?m)^x+$",
+    "",
+    "a*",
+    "x?",
+    "[^y]",
+    "0[01]{10}$",
+  };
+  std::vector<std::string> texts = {
+    "",
+    "xxaababbcxx",
+    "HeLLo, World",
+    "abcabc",
+    "aaab",
+    "a foo b",
+    "foobar",
+    "y\nxx\nz",
+    "yyy",
+    "\xff\xfe abc",
+    "0101010101010101",
+    "1000000000001",
+  };
+  // Enough texts to cycle every lane of the lockstep search.
+  for (int i = 0; i < 20; i++)
+    texts.push_back(std::string(i, 'a') + "b" + std::string(20 - i, 'y'));
+  // Too many DFA states for the small budget below.
+  std::string bits;
+  for (int i = 0; i < 20000; i++)
+    bits += "01"[(static_cast<uint32_t>(i) * 2654435761u >> 13) & 1];
+  texts.push_back(bits);
+  std::vector<StringPiece> pieces(texts.begin(), texts.end());
+  pieces.push_back(StringPiece());
+
+  RE2::Options small;
+  small.set_max_mem(1<<14);
+  small.set_log_errors(false);
+  for (const char* pattern : patterns) {
+    RE2 lazy(pattern);
+    RE2 flat(pattern);
+    RE2 tiny(pattern, small);
+    flat.BuildFlatDFA(false, 1000);
+    for (const RE2* re : {&lazy, &flat, &tiny}) {
+      std::unique_ptr<bool[]> matched(new bool[pieces.size()]);
+      re->MatchBatch(pieces.data(), pieces.size(), matched.get());
+      for (size_t i = 0; i < pieces.size(); i++)
+        ASSERT_EQ(lazy.Match(pieces[i], 0, pieces[i].size(), RE2::UNANCHORED,
+                             NULL, 0),
+                  matched[i])
+            << pattern << " " << pieces[i];
+    }
+  }
+}
+
 // Test that the DFA gets the right result even if it runs
 // out of memory during a search.  The regular expression
 // 0[01]{n}$ matches a binary string of 0s and 1s only if
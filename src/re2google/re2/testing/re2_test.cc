@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -21,6 +22,7 @@
 #include "util/test.h"
 #include "util/logging.h"
 #include "util/strutil.h"
+#include "re2/prog.h"
 #include "re2/re2.h"
 #include "re2/regexp.h"
 
@@ -1383,6 +1385,46 @@ TEST(RE2, BitstateCaptureBug) {
   EXPECT_FALSE(re.Match(s, 0, s.size(), RE2::UNANCHORED, NULL, 0));
 }
 
+// The submatch engine thresholds change only which engine runs,
+// never the submatches found.
+TEST(RE2, SubmatchEngineThresholds) {
+  std::string text = "x{\"items\":[";
+  for (int i = 0; i < 1000; i++)
+    text += "{\"id\":" + std::to_string(i) + "},";
+  text += "{}]}y";
+  const char* patterns[] = {
+    "\\{\"items\":\\[(.*)\\]\\}",
+    "(\\d+)\\}(,)\\{(.*?)(\\d)\\}",
+    "^x(\\{)(.*)(y)$",
+  };
+  for (const char* pattern : patterns) {
+    RE2 want(pattern);
+    ASSERT_TRUE(want.ok()) << pattern;
+    int n = want.NumberOfCapturingGroups() + 1;
+    std::vector<StringPiece> want_sp(n);
+    ASSERT_TRUE(want.Match(text, 0, text.size(), RE2::UNANCHORED,
+                           want_sp.data(), n)) << pattern;
+
+    for (int64_t mem : {int64_t{0}, int64_t{1}<<20, int64_t{1}<<30}) {
+      for (int64_t one_pass : {int64_t{0}, int64_t{1}<<20}) {
+        RE2::Options opt;
+        opt.set_bit_state_max_mem(mem);
+        opt.set_one_pass_max_text(one_pass);
+        RE2 re(pattern, opt);
+        std::vector<StringPiece> sp(n);
+        for (RE2::Anchor anchor : {RE2::UNANCHORED, RE2::ANCHOR_START}) {
+          bool matched = re.Match(text, 0, text.size(), anchor, sp.data(), n);
+          bool want_matched = want.Match(text, 0, text.size(), anchor,
+                                         want_sp.data(), n);
+          ASSERT_EQ(want_matched, matched) << pattern;
+          for (int i = 0; matched && i < n; i++)
+            EXPECT_EQ(want_sp[i], sp[i]) << pattern << " " << i;
+        }
+      }
+    }
+  }
+}
+
 // C++ version of bug 609710.
 TEST(RE2, UnicodeClasses) {
   const std::string str = "ABCDEFGHI譚永鋒";
@@ -1534,6 +1576,135 @@ TEST(RE2, CapturingGroupNames) {
   EXPECT_EQ(want, have);
 }
 
+// Check that a deserialized regexp matches like the one it came from,
+// and that truncated data is rejected.
+TEST(RE2, Serialize) {
+  const char* patterns[] = {
+    "a[ab]{4}b",
+    "(?i)hello|world",
+    "^abc",
+    "abc$",
+    "\\bfoo\\b",
+    "(?m)^x+$",
+    "(a+)(?P<b>b*)",
+    "((abc)(?P<G2>)|((e+)(?P<G2>.*)(?P<G1>u+)))",
+    "(?i)abc(d+)",
+    "",
+    "a*",
+  };
+  const char* texts[] = {
+    "",
+    "xxaababbcxx",
+    "HeLLo, World",
+    "abcabc",
+    "a foo b",
+    "y\nxx\nz",
+    "aaab",
+    "eeeuuu",
+    "ABCddd",
+    "\xff\xfe abc",
+  };
+  for (const char* pattern : patterns) {
+    for (bool flat : {false, true}) {
+      RE2 re(pattern);
+      if (flat) {
+        ASSERT_TRUE(re.BuildFlatDFA(true, 1000)) << pattern;
+      }
+      std::string data;
+      ASSERT_TRUE(re.Serialize(true, &data)) << pattern;
+      std::unique_ptr<RE2> copy(RE2::Deserialize(pattern, re.options(), data));
+      ASSERT_TRUE(copy != NULL) << pattern;
+      ASSERT_EQ(re.NumberOfCapturingGroups(),
+                copy->NumberOfCapturingGroups());
+      ASSERT_EQ(re.NamedCapturingGroups(), copy->NamedCapturingGroups());
+      ASSERT_EQ(re.CapturingGroupNames(), copy->CapturingGroupNames());
+      std::string again;
+      ASSERT_TRUE(copy->Serialize(true, &again));
+      ASSERT_EQ(data, again) << pattern;
+
+      const int n = 1 + re.NumberOfCapturingGroups();
+      for (const char* text : texts) {
+        StringPiece context(text);
+        for (RE2::Anchor anchor : {RE2::UNANCHORED, RE2::ANCHOR_START,
+                                   RE2::ANCHOR_BOTH}) {
+          std::vector<StringPiece> m1(n), m2(n);
+          bool r1 = re.Match(context, 0, context.size(), anchor,
+                             m1.data(), n);
+          bool r2 = copy->Match(context, 0, context.size(), anchor,
+                                m2.data(), n);
+          ASSERT_EQ(r1, r2) << pattern << " " << text;
+          for (int i = 0; r1 && i < n; i++) {
+            ASSERT_EQ(m1[i].data(), m2[i].data()) << pattern << " " << text;
+            ASSERT_EQ(m1[i].size(), m2[i].size()) << pattern << " " << text;
+          }
+        }
+      }
+      // The pattern is parsed on demand.
+      ASSERT_EQ(re.Regexp()->ToString(), copy->Regexp()->ToString());
+
+      for (size_t len = 0; len < data.size(); len++) {
+        StringPiece prefix(data.data(), len);
+        std::unique_ptr<RE2> bad(RE2::Deserialize(pattern, re.options(),
+                                                  prefix));
+        ASSERT_TRUE(bad == NULL) << pattern << " " << len;
+      }
+    }
+  }
+
+  // A regexp that failed to compile has nothing to serialize.
+  RE2::Options options;
+  options.set_log_errors(false);
+  RE2 bad("a(", options);
+  std::string data;
+  ASSERT_FALSE(bad.Serialize(false, &data));
+
+  // Instructions that the engines would follow out of bounds are
+  // rejected. Without a prefix or named groups, the program starts 14
+  // bytes in and its instructions, 8 bytes each, 292 bytes after that.
+  RE2 dotstar("(?s)abc.*", RE2::Latin1);
+  ASSERT_TRUE(dotstar.Serialize(false, &data));
+  auto get32 = [](const std::string& s, size_t i) {
+    uint32_t v = 0;
+    for (int j = 0; j < 4; j++)
+      v |= static_cast<uint32_t>(static_cast<uint8_t>(s[i+j])) << (8*j);
+    return v;
+  };
+  auto put32 = [](std::string* s, size_t i, uint32_t v) {
+    for (int j = 0; j < 4; j++)
+      (*s)[i+j] = static_cast<char>((v >> (8*j)) & 0xFF);
+  };
+  const size_t insts = 14 + 292;
+  int size = static_cast<int>(get32(data, 14 + 10));
+  int altmatch = -1;
+  for (int id = 0; id < size; id++) {
+    if ((get32(data, insts + 8*id) & 7) == kInstAltMatch)
+      altmatch = id;
+  }
+  ASSERT_GE(altmatch, 0);
+  std::unique_ptr<RE2> copy(
+      RE2::Deserialize(dotstar.pattern(), dotstar.options(), data));
+  ASSERT_TRUE(copy != NULL);
+  ASSERT_TRUE(RE2::PartialMatch("xxabcyy", *copy));
+
+  const size_t at = insts + 8*altmatch;
+  const uint32_t word = get32(data, at);
+  const uint32_t arg = get32(data, at + 4);
+  const uint32_t corrupt[][2] = {
+    {word | 8, arg},                          // last() set
+    {(word & ~7u) | kInstAlt, arg},           // Alt, never in a flat Prog
+    {word + (1 << 4), arg},                   // out is not id+1
+    {word, arg + 1},                          // out1 is not id+2
+  };
+  for (const auto& c : corrupt) {
+    std::string bad_data = data;
+    put32(&bad_data, at, c[0]);
+    put32(&bad_data, at + 4, c[1]);
+    std::unique_ptr<RE2> bad_copy(
+        RE2::Deserialize(dotstar.pattern(), dotstar.options(), bad_data));
+    ASSERT_TRUE(bad_copy == NULL) << c[0] << " " << c[1];
+  }
+}
+
 TEST(RE2, RegexpToStringLossOfAnchor) {
   EXPECT_EQ(RE2("^[a-c]at", RE2::POSIX).Regexp()->ToString(), "^[a-c]at");
   EXPECT_EQ(RE2("^[a-c]at").Regexp()->ToString(), "(?-m:^)[a-c]at");
@@ -11,6 +11,7 @@
 #include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "util/benchmark.h"
 #include "util/test.h"
@@ -150,6 +151,8 @@ ParseImpl SearchParse2CachedPCRE, SearchParse2CachedRE2;
 
 ParseImpl SearchParse1CachedPCRE, SearchParse1CachedRE2;
 
+RE2* GetCachedRE2(const char* regexp);
+
 // Benchmark: failed search for regexp in random text.
 
 // Generate random text that won't contain the search string,
@@ -301,6 +304,41 @@ BENCHMARK_RANGE(Search_BigFixed_CachedPCRE,    8, 32<<10)->ThreadRange(1, NumCPU
 #endif
 BENCHMARK_RANGE(Search_BigFixed_CachedRE2,     8, 1<<20)->ThreadRange(1, NumCPUs());
 
+// Benchmark: many threads searching with one shared RE2.
+// The benchmark harness runs in a single thread, so the threads are
+// started here; the argument is the number of threads. Each thread
+// searches short texts, so that taking the DFA cache lock for every
+// search is a noticeable part of the cost. Bytes per second is the
+// throughput of all the threads together.
+
+void SearchParallel(benchmark::State& state, const char* regexp) {
+  int nthreads = static_cast<int>(state.range(0));
+  int64_t iters = state.iterations();
+  std::string s = RandomText(1<<10);
+  RE2& re = *GetCachedRE2(regexp);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nthreads; i++) {
+    threads.emplace_back([&]() {
+      for (int64_t j = 0; j < iters; j++)
+        CHECK(!RE2::PartialMatch(s, re));
+    });
+  }
+  for (std::thread& t : threads)
+    t.join();
+  state.SetBytesProcessed(nthreads * iters * static_cast<int64_t>(s.size()));
+}
+
+// Unlike EASY1 and MEDIUM, these are not anchored at the end, which
+// would let RE2 search backward from the end of text and stop at once.
+#define PARALLEL_EASY    "A[AB]B[BC]C[CD]D[DE]E[EF]F[FG]G[GH]H[HI]I[IJ]J"
+#define PARALLEL_MEDIUM  "[XYZ]ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+
+void Search_Parallel_Easy_CachedRE2(benchmark::State& state)    { SearchParallel(state, PARALLEL_EASY); }
+void Search_Parallel_Medium_CachedRE2(benchmark::State& state)  { SearchParallel(state, PARALLEL_MEDIUM); }
+
+BENCHMARK_RANGE(Search_Parallel_Easy_CachedRE2,    1, NumCPUs());
+BENCHMARK_RANGE(Search_Parallel_Medium_CachedRE2,  1, NumCPUs());
+
 // Benchmark: FindAndConsume
 
 void FindAndConsume(benchmark::State& state) {
@@ -494,6 +532,82 @@ BENCHMARK(Parse_CachedDigits_Backtrack)->ThreadRange(1, NumCPUs());
 BENCHMARK(Parse_CachedDigits_RE2)->ThreadRange(1, NumCPUs());
 BENCHMARK(Parse_CachedDigits_BitState)->ThreadRange(1, NumCPUs());
 
+// Benchmark: extract state.range(0) capture groups (4, 8, 16, 32) from
+// a structured log line with a one-pass regexp.
+
+void MakeCaptures(int n, std::string* regexp, std::string* text) {
+  for (int i = 0; i < n; i++) {
+    if (i > 0) {
+      *regexp += " ";
+      *text += " ";
+    }
+    *regexp += StringPrintf("k%d=(\\w+)", i);
+    *text += StringPrintf("k%d=value%d", i, i);
+  }
+}
+
+void ParseCaptures(benchmark::State& state,
+                   bool (*search)(Prog*, const StringPiece&,
+                                  StringPiece*, int)) {
+  int n = state.range(0);
+  std::string regexp, text;
+  MakeCaptures(n, &regexp, &text);
+  Regexp* re = Regexp::Parse(regexp, Regexp::LikePerl, NULL);
+  CHECK(re);
+  Prog* prog = re->CompileToProg(0);
+  CHECK(prog);
+  std::vector<StringPiece> sp(n+1);
+  for (auto _ : state) {
+    CHECK(search(prog, text, sp.data(), n+1));
+  }
+  CHECK_EQ(sp[n], StringPrintf("value%d", n-1));
+  state.SetBytesProcessed(state.iterations() * text.size());
+  delete prog;
+  re->Decref();
+}
+
+bool CapturesOnePass(Prog* prog, const StringPiece& text,
+                     StringPiece* sp, int nsp) {
+  CHECK(prog->IsOnePass());
+  return prog->SearchOnePass(text, text, Prog::kAnchored, Prog::kFullMatch,
+                             sp, nsp);
+}
+
+bool CapturesNFA(Prog* prog, const StringPiece& text,
+                 StringPiece* sp, int nsp) {
+  return prog->SearchNFA(text, StringPiece(), Prog::kAnchored,
+                         Prog::kFullMatch, sp, nsp);
+}
+
+bool CapturesBitState(Prog* prog, const StringPiece& text,
+                      StringPiece* sp, int nsp) {
+  CHECK(prog->CanBitState());
+  return prog->SearchBitState(text, text, Prog::kAnchored, Prog::kFullMatch,
+                              sp, nsp);
+}
+
+void Parse_Captures_OnePass(benchmark::State& state)   { ParseCaptures(state, CapturesOnePass); }
+void Parse_Captures_NFA(benchmark::State& state)       { ParseCaptures(state, CapturesNFA); }
+void Parse_Captures_BitState(benchmark::State& state)  { ParseCaptures(state, CapturesBitState); }
+
+void Parse_Captures_RE2(benchmark::State& state) {
+  int n = state.range(0);
+  std::string regexp, text;
+  MakeCaptures(n, &regexp, &text);
+  RE2 re(regexp);
+  CHECK(re.ok());
+  std::vector<StringPiece> sp(n+1);
+  for (auto _ : state) {
+    CHECK(re.Match(text, 0, text.size(), RE2::ANCHOR_BOTH, sp.data(), n+1));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+BENCHMARK_RANGE(Parse_Captures_OnePass,   4, 32)->ThreadRange(1, NumCPUs());
+BENCHMARK_RANGE(Parse_Captures_NFA,       4, 32)->ThreadRange(1, NumCPUs());
+BENCHMARK_RANGE(Parse_Captures_BitState,  4, 32)->ThreadRange(1, NumCPUs());
+BENCHMARK_RANGE(Parse_Captures_RE2,       4, 32)->ThreadRange(1, NumCPUs());
+
 void Parse3DigitDs(benchmark::State& state,
                    void (*parse3)(benchmark::State&, const char*,
                                   const StringPiece&)) {
@@ -2,10 +2,14 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <stdlib.h>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "util/test.h"
 #include "util/logging.h"
+#include "re2/literal_accel.h"
 #include "re2/prog.h"
 #include "re2/regexp.h"
 
@@ -131,6 +135,124 @@ TEST(RequiredPrefixForAccel, SimpleTests) {
   }
 }
 
+static struct PrefixesTest {
+  const char* regexp;
+  bool return_value;
+  const char* prefixes;  // joined by commas
+  bool foldcase;
+} required_prefixes_tests[] = {
+  // Not handled: anything can begin a match.
+  { "", false },
+  { "a*", false },
+  { "a?b", true, "ab,b", false },
+  { "\\bfoo|bar", false },
+  { "^foo|^bar", false },
+  { "foo|bar|.", false },
+  { "[a-z]+", true, "a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t,u,v,w,x,y,z",
+    false },
+
+  // Alternations, factored or not.
+  { "foo|bar|baz", true, "bar,baz,foo", false },
+  { "foo|foobar|bar", true, "bar,foo", false },
+  { "(?:ab|cd)ef", true, "abef,cdef", false },
+  { "(ab|cd)+e", true, "ab,cd", false },
+  { "x(?:ab|cd)*e", true, "x", false },
+  { "(?i)Foo|BAR", true, "bar,foo", true },
+  { "(?i)foo|123", true, "123,foo", true },
+
+  // Literals whose letters need different case matching cannot share
+  // one searcher; a concatenation stops before the change.
+  { "(?i)foo|(?-i)BAR", false },
+  { "(?i:abc)|XYZ", false },
+  { "(?i:xyz)|[a-c]", false },
+  { "XYZ|[a-c]", true, "XYZ,a,b,c", false },
+  { "(?i:foo)BAR", true, "foo", true },
+  { "abc(?i:DEF)|xyz", true, "abc,xyz", false },
+  { "abcdefghij|xyz", true, "abcdefgh,xyz", false },
+};
+
+TEST(RequiredPrefixesForAccel, SimpleTests) {
+  for (const auto& t : required_prefixes_tests) {
+    Regexp* re = Regexp::Parse(t.regexp, Regexp::LikePerl, NULL);
+    ASSERT_TRUE(re != NULL) << t.regexp;
+    std::vector<std::string> prefixes;
+    bool foldcase;
+    ASSERT_EQ(t.return_value,
+              re->RequiredPrefixesForAccel(&prefixes, &foldcase, 8, 100))
+        << t.regexp << " " << re->Dump();
+    if (t.return_value) {
+      std::string joined;
+      for (const std::string& prefix : prefixes)
+        joined += (joined.empty() ? "" : ",") + prefix;
+      ASSERT_EQ(joined, t.prefixes) << t.regexp;
+      ASSERT_EQ(foldcase, t.foldcase) << t.regexp;
+    }
+    re->Decref();
+  }
+}
+
+// Check LiteralAccel against a naive search, for small sets (Teddy, if
+// the CPU has SSSE3) and large ones (Aho-Corasick).
+TEST(LiteralAccel, Find) {
+  const char alphabet[] = "abcABC\xff";
+  srand(1);
+  for (int nliterals : {2, 5, 40, 200}) {
+    for (bool foldcase : {false, true}) {
+      std::vector<std::string> literals;
+      for (int i = 0; i < nliterals; i++) {
+        std::string literal(1 + rand() % 6, ' ');
+        for (char& c : literal)
+          c = alphabet[rand() % (foldcase ? 3 : sizeof alphabet - 1)];
+        literals.push_back(literal);
+      }
+      // A short literal makes nearly every position a candidate.
+      std::vector<std::string> long_literals;
+      for (const std::string& literal : literals)
+        long_literals.push_back(literal + literal + literal);
+      for (const auto* set : {&literals, &long_literals}) {
+        std::unique_ptr<LiteralAccel> accel(
+            LiteralAccel::New(*set, foldcase, 1<<20));
+        ASSERT_TRUE(accel != NULL);
+        for (int i = 0; i < 200; i++) {
+          std::string text(rand() % 100, ' ');
+          for (char& c : text)
+            c = alphabet[rand() % (sizeof alphabet - 1)];
+          const char* first = NULL;
+          for (size_t p = 0; p < text.size() && first == NULL; p++) {
+            for (const std::string& literal : *set) {
+              if (text.size() - p < literal.size())
+                continue;
+              std::string sub = text.substr(p, literal.size());
+              if (foldcase) {
+                for (char& c : sub)
+                  if ('A' <= c && c <= 'Z')
+                    c += 'a' - 'A';
+              }
+              if (sub == literal) {
+                first = text.data() + p;
+                break;
+              }
+            }
+          }
+          const char* found = reinterpret_cast<const char*>(
+              accel->Find(text.data(), text.size()));
+          if (first == NULL) {
+            ASSERT_TRUE(found == NULL) << text;
+          } else {
+            // Aho-Corasick may report an earlier candidate. Teddy, which
+            // takes the smaller sets when the CPU allows, verifies its
+            // candidates and finds the first literal exactly.
+            ASSERT_TRUE(found != NULL && found <= first) << text;
+            if (accel->IsExact()) {
+              ASSERT_EQ(found, first) << text;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
 TEST(PrefixAccel, BasicTest) {
   Regexp* re = Regexp::Parse("abc\\d+", Regexp::LikePerl, NULL);
   ASSERT_TRUE(re != NULL);
@@ -150,4 +272,65 @@ TEST(PrefixAccel, BasicTest) {
   re->Decref();
 }
 
+// Check the vectorized searches, including the case-insensitive ones,
+// against a naive search at every alignment and text length.
+TEST(PrefixAccel, FoldCase) {
+  struct {
+    const char* regexp;
+    const char* prefix;  // lowercase if foldcase
+    bool foldcase;
+  } tests[] = {
+    { "abc\\d+", "abc", false },
+    { "(?i)ERROR \\d+", "error ", true },
+    { "(?i)x\\d", "x", true },
+    { "(?i)@x", "@x", true },
+    { "(?i)\\x{4e2d}z", "\xe4\xb8\xadz", true },
+  };
+  const char alphabet[] = "aAbBcCeErRoOxXzZ @`-\xe4\xb8\xad\xff";
+  for (const auto& t : tests) {
+    Regexp* re = Regexp::Parse(t.regexp, Regexp::LikePerl, NULL);
+    ASSERT_TRUE(re != NULL);
+    Prog* prog = re->CompileToProg(0);
+    ASSERT_TRUE(prog != NULL);
+    ASSERT_TRUE(prog->can_prefix_accel()) << t.regexp;
+    std::string prefix(t.prefix);
+    auto same = [&](const char* p) {
+      for (size_t k = 0; k < prefix.size(); k++) {
+        char c = p[k];
+        if (t.foldcase && 'A' <= c && c <= 'Z')
+          c += 'a' - 'A';
+        if (c != prefix[k])
+          return false;
+      }
+      return true;
+    };
+    srand(1);
+    for (int i = 0; i < 2000; i++) {
+      std::string text(1 + rand() % 100, ' ');
+      for (char& c : text)
+        c = alphabet[rand() % (sizeof alphabet - 1)];
+      if (rand() % 2 == 0)
+        text.replace(rand() % text.size(), 0, t.prefix);
+      for (size_t begin = 0; begin < 4 && begin < text.size(); begin++) {
+        const char* expected = NULL;
+        for (size_t k = begin; k + prefix.size() <= text.size(); k++) {
+          // The filter tests only the first and last bytes.
+          std::string probe = prefix;
+          probe.front() = text[k];
+          probe.back() = text[k + prefix.size() - 1];
+          if (same(probe.data())) {
+            expected = text.data() + k;
+            break;
+          }
+        }
+        const char* p = reinterpret_cast<const char*>(
+            prog->PrefixAccel(text.data() + begin, text.size() - begin));
+        ASSERT_EQ(expected, p) << t.regexp << " " << text;
+      }
+    }
+    delete prog;
+    re->Decref();
+  }
+}
+
 }  // namespace re2
@@ -305,6 +305,30 @@ RegexpTest simple_tests[] = {
   { "a\\C+?", "a" },
   { "a\\C??", "a" },
 
+  // Alternations of literals (multi-literal prefix accel).
+  { "foo|bar|baz", "xxbazxbarfoo" },
+  { "foo|bar|baz", "fobaba" },
+  { "(?i)foo|bar|baz", "xxBAzxbarfoo" },
+  { "(?:ab|cd)ef|gh", "abcdefgh" },
+  { "(?:ab|cd)?ef|gh", "abcdxefgh" },
+  { "(ab|abcd)+e", "xabcdabe" },
+  { "bcd|abcde", "xabcdx" },
+  { "bcd|abcde", "xabcdex" },
+  { "a(?:b|c)d|x[yz]", "acxzabd" },
+  { "(?:Ab|b)[cd]|e\\d", "xxbdAbce9" },
+
+  // One-pass regexps with many capturing parens.
+  { "^(\\w+) (\\d+) (\\w+)=(\\d+) (\\w+)=(\\d+) (\\w+)=(\\w*)$",
+    "GET 200 ms=15 bytes=1024 path=" },
+  { "^(\\w+) (\\d+) (\\w+)=(\\d+) (\\w+)=(\\d+) (\\w+)=(\\w*)$",
+    "GET 200 ms=15 bytes=1024 path=x y" },
+  { "^(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)(k)(l)(m)(n)(o)(p)$",
+    "abcdefghijklmnop" },
+  { "^(?:(a)|(b)|(c)|(d)|(e)|(f)|(g)|(h)|(i)|(j))+x?$", "jihgfedcbax" },
+  { "^((((((((x))))))))(y?)(z*)$", "xyzz" },
+  { "^(?:(\\d+)-)?(\\d+)(?:\\.(\\d+))?(?:\\.(\\d+))?(?:\\.(\\d+))?$",
+    "12-3.4.5" },
+
   // Former bugs.
   { "a\\C*|ba\\C", "baba" },
   { "\\w*I\\w*", "Inc." },
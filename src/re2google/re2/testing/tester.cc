@@ -379,8 +379,7 @@ void TestInstance::RunSearch(Engine type,
     case kEngineOnePass:
       if (prog_ == NULL ||
           !prog_->IsOnePass() ||
-          anchor == Prog::kUnanchored ||
-          nsubmatch > Prog::kMaxOnePassCapture) {
+          anchor == Prog::kUnanchored) {
         result->skipped = true;
         break;
       }
@@ -56,7 +56,12 @@
 #define VLOG(x) if((x)>0){}else LOG_INFO.stream()
 
 #ifdef RE2_R_BUILD
-#include <R_ext/Print.h>
+namespace re2 {
+// Prints message on the R console. On a worker thread of the package's
+// parallel_for(), which must not call R, the message is kept and printed
+// once the workers have joined. Defined in src/re2_parallel.cpp.
+void r_log_message(const std::string& message);
+}  // namespace re2
 #endif
 
 class LogMessage {
@@ -69,7 +74,7 @@ class LogMessage {
     stream() << "\n";
     std::string s = str_.str();
 #ifdef RE2_R_BUILD
-    Rprintf("%s", s.data());
+    re2::r_log_message(s);
 #else
     size_t n = s.size();
     if (fwrite(s.data(), 1, n, stderr) < n) {}  // shut up gcc
@@ -22,7 +22,9 @@
 #include <string.h>
 #include <algorithm>
 #include <atomic>
+#include <functional>
 #include <iterator>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
@@ -34,6 +36,7 @@
 #include "util/utf.h"
 #include "re2/prog.h"
 #include "re2/regexp.h"
+#include "re2/serial.h"
 #include "re2/sparse_array.h"
 
 #include <RInside.h>                    // for the embedded R via RInside
@@ -72,7 +75,9 @@ RE2::Options::Options(RE2::CannedOptions opt)
     case_sensitive_(true),
     perl_classes_(false),
     word_boundary_(false),
-    one_line_(false) {
+    one_line_(false),
+    bit_state_max_mem_(kDefaultBitStateMaxMem),
+    one_pass_max_text_(kDefaultOnePassMaxText) {
 }
 
 // static empty objects for use as const references.
@@ -187,7 +192,7 @@ int RE2::Options::ParseFlags() const {
   return flags;
 }
 
-void RE2::Init(const StringPiece& pattern, const Options& options) {
+void RE2::InitFields(const StringPiece& pattern, const Options& options) {
   static std::once_flag empty_once;
   std::call_once(empty_once, []() {
     empty_string = new std::string;
@@ -211,6 +216,10 @@ void RE2::Init(const StringPiece& pattern, const Options& options) {
   rprog_ = NULL;
   named_groups_ = NULL;
   group_names_ = NULL;
+}
+
+void RE2::Init(const StringPiece& pattern, const Options& options) {
+  InitFields(pattern, options);
 
   RegexpStatus status;
   entire_regexp_ = Regexp::Parse(
@@ -262,8 +271,10 @@ void RE2::Init(const StringPiece& pattern, const Options& options) {
 // Returns rprog_, computing it if needed.
 re2::Prog* RE2::ReverseProg() const {
   std::call_once(rprog_once_, [](const RE2* re) {
-    re->rprog_ =
-        re->suffix_regexp_->CompileToReverseProg(re->options_.max_mem() / 3);
+    re->ParsePattern();
+    if (re->suffix_regexp_ != NULL)
+      re->rprog_ = re->suffix_regexp_->CompileToReverseProg(
+          re->options_.max_mem() / 3);
     if (re->rprog_ == NULL) {
       if (re->options_.log_errors())
         LOG(ERROR) << "Error reverse compiling '" << trunc(re->pattern_) << "'";
@@ -363,6 +374,171 @@ int RE2::ReverseProgramFanout(std::vector<int>* histogram) const {
   return Fanout(prog, histogram);
 }
 
+// Calls f(prog, kind, anchored) for each DFA used by unanchored searches,
+// mirroring the choice of DFAs made by Match(). Searches that only ask
+// whether there is a match run the kLongestMatch DFA for the earliest
+// match, so it is included along with the DFA for the match kind.
+// rprog is the reverse program, or NULL to skip it.
+static void ForEachSearchDFA(
+    Prog* prog, Prog* rprog, bool longest_match,
+    const std::function<void(Prog*, Prog::MatchKind, bool)>& f) {
+  if (!prog->anchor_end()) {
+    f(prog, Prog::kLongestMatch, prog->anchor_start());
+    if (!longest_match)
+      f(prog, Prog::kFirstMatch, prog->anchor_start());
+  }
+  if (rprog != NULL)
+    f(rprog, Prog::kLongestMatch, true);
+}
+
+int RE2::WarmDFA(bool reverse, int max_states, bool* complete) const {
+  if (complete != NULL)
+    *complete = false;
+  if (prog_ == NULL)
+    return -1;
+
+  Prog* rprog = reverse || prog_->anchor_end() ? ReverseProg() : NULL;
+  bool done = true;
+  int nstates = 0;
+  ForEachSearchDFA(prog_, rprog, options_.longest_match(),
+                   [&](Prog* prog, Prog::MatchKind kind, bool anchored) {
+    bool built = false;
+    nstates += prog->BuildDFA(kind, anchored, max_states, &built);
+    done = done && built;
+  });
+  if (complete != NULL)
+    *complete = done;
+  return nstates;
+}
+
+bool RE2::BuildFlatDFA(bool reverse, int max_states) const {
+  if (prog_ == NULL)
+    return false;
+
+  Prog* rprog = reverse || prog_->anchor_end() ? ReverseProg() : NULL;
+  if ((reverse || prog_->anchor_end()) && rprog == NULL)
+    return false;
+  bool built = true;
+  ForEachSearchDFA(prog_, rprog, options_.longest_match(),
+                   [&](Prog* prog, Prog::MatchKind kind, bool anchored) {
+    built = prog->BuildFlatDFA(kind, anchored, max_states) && built;
+  });
+  return built;
+}
+
+re2::Regexp* RE2::Regexp() const {
+  ParsePattern();
+  return entire_regexp_;
+}
+
+void RE2::ParsePattern() const {
+  std::call_once(regexp_once_, [](const RE2* re) {
+    // Init() has parsed the pattern already, or failed to compile it.
+    if (re->entire_regexp_ != NULL || re->prog_ == NULL)
+      return;
+    re->entire_regexp_ = Regexp::Parse(
+        re->pattern_,
+        static_cast<Regexp::ParseFlags>(re->options_.ParseFlags()),
+        NULL);
+    if (re->entire_regexp_ == NULL)
+      return;
+    std::string prefix;
+    bool prefix_foldcase;
+    re2::Regexp* suffix;
+    if (re->entire_regexp_->RequiredPrefix(&prefix, &prefix_foldcase,
+                                           &suffix))
+      re->suffix_regexp_ = suffix;
+    else
+      re->suffix_regexp_ = re->entire_regexp_->Incref();
+  }, this);
+}
+
+// Version of the encoding written by RE2::Serialize.
+static const uint8_t kRE2SerialVersion = 1;
+
+bool RE2::Serialize(bool reverse, std::string* out) const {
+  if (prog_ == NULL)
+    return false;
+  Prog* rprog = reverse ? ReverseProg() : NULL;
+
+  SerialWriter w(out);
+  w.PutByte(kRE2SerialVersion);
+  w.PutString(prefix_);
+  w.PutByte(prefix_foldcase_);
+  w.Put32(num_captures_);
+  const std::map<int, std::string>& names = CapturingGroupNames();
+  w.Put32(static_cast<uint32_t>(names.size()));
+  for (const auto& name : names) {
+    w.Put32(name.first);
+    w.PutString(name.second);
+  }
+  prog_->Serialize(out);
+  w.PutByte(rprog != NULL);
+  if (rprog != NULL)
+    rprog->Serialize(out);
+  return true;
+}
+
+RE2* RE2::Deserialize(const StringPiece& pattern, const Options& options,
+                      const StringPiece& data) {
+  std::unique_ptr<RE2> re(new RE2(NoInit()));
+  re->InitFields(pattern, options);
+
+  StringPiece in(data);
+  SerialReader r(&in);
+  if (r.GetByte() != kRE2SerialVersion)
+    return NULL;
+  r.GetString(&re->prefix_);
+  re->prefix_foldcase_ = r.GetByte() != 0;
+  re->num_captures_ = static_cast<int>(r.Get32());
+  uint32_t nnames = r.Get32();
+  if (!r.CanRead(nnames, 8) || re->num_captures_ < 0)
+    return NULL;
+  std::unique_ptr<std::map<int, std::string>> group_names(
+      new std::map<int, std::string>);
+  std::unique_ptr<std::map<std::string, int>> named_groups(
+      new std::map<std::string, int>);
+  for (uint32_t i = 0; i < nnames; i++) {
+    int index = static_cast<int>(r.Get32());
+    std::string name;
+    if (!r.GetString(&name) || index < 1 || index > re->num_captures_)
+      return NULL;
+    (*group_names)[index] = name;
+    // Names arrive in group order, so the leftmost group keeps a repeated
+    // name, as in Regexp::NamedCaptures.
+    named_groups->emplace(name, index);
+  }
+
+  std::unique_ptr<Prog> prog(Prog::Deserialize(&in));
+  if (prog == NULL || prog->reversed())
+    return NULL;
+  std::unique_ptr<Prog> rprog;
+  if (r.GetByte() != 0) {
+    rprog.reset(Prog::Deserialize(&in));
+    if (rprog == NULL || !rprog->reversed())
+      return NULL;
+  }
+  if (!r.ok() || !in.empty())
+    return NULL;
+
+  re->prog_ = prog.release();
+  re->is_one_pass_ = re->prog_->IsOnePass();
+  if (rprog != NULL) {
+    std::call_once(re->rprog_once_, [&rprog](const RE2* re) {
+      re->rprog_ = rprog.release();
+    }, re.get());
+  }
+  std::call_once(re->named_groups_once_, [&named_groups](const RE2* re) {
+    re->named_groups_ = named_groups->empty() ? empty_named_groups
+                                              : named_groups.release();
+  }, re.get());
+  std::call_once(re->group_names_once_, [&group_names](const RE2* re) {
+    re->group_names_ = group_names->empty() ? empty_group_names
+                                            : group_names.release();
+  }, re.get());
+  return re.release();
+}
+
 // Returns named_groups_, computing it if needed.
 const std::map<std::string, int>& RE2::NamedCapturingGroups() const {
 
@@ -670,6 +846,10 @@ static void embed_re2_inner(const std::string &pattern, const RE2::Options &opti
   cmd += std::string(", perl_classes=") + (options.perl_classes() ? "T" : "F");    
   cmd += std::string(", word_boundary=") +(options.word_boundary() ? "T" : "F");   
   cmd += std::string(", one_line=") +     (options.one_line() ? "T" : "F");        
+  cmd += std::string(", bit_state_max_mem=") +
+    std::to_string(options.bit_state_max_mem());
+  cmd += std::string(", one_pass_max_text=") +
+    std::to_string(options.one_pass_max_text());
   cmd += ")";
 
   R.parseEvalQ(cmd);
@@ -756,6 +936,33 @@ bool RE2::Match(const StringPiece& text,
 
 }
 
+void RE2::MatchBatch(const StringPiece* texts, size_t n, bool* matched) const {
+  // With a required prefix, prog_ matches only what follows the prefix,
+  // so leave those regexps to Match.
+  if (!ok() || !prefix_.empty()) {
+    for (size_t i = 0; i < n; i++)
+      matched[i] = Match(texts[i], 0, texts[i].size(), UNANCHORED, NULL, 0);
+    return;
+  }
+
+#ifdef RE2_HAVE_THREAD_LOCAL
+  hooks::context = this;
+#endif
+  static const size_t kBatch = 256;
+  bool failed[kBatch];
+  for (size_t i = 0; i < n; i += kBatch) {
+    size_t m = std::min(kBatch, n - i);
+    prog_->SearchDFABatch(texts + i, m, Prog::kUnanchored, matched + i,
+                          failed);
+    // Match falls back to the NFA when the DFA gives up.
+    for (size_t j = 0; j < m; j++) {
+      if (failed[j])
+        matched[i + j] = Match(texts[i + j], 0, texts[i + j].size(),
+                               UNANCHORED, NULL, 0);
+    }
+  }
+}
+
 // Internal matcher - like Match() but takes Args not StringPieces.
 bool RE2::DoMatch(const StringPiece& text,
                   Anchor re_anchor,
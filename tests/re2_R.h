@@ -315,10 +315,45 @@ class RE2 {
   int ProgramFanout(std::vector<int>* histogram) const;
   int ReverseProgramFanout(std::vector<int>* histogram) const;
 
+  // Builds the DFA states used by unanchored searches ahead of time, so
+  // that the first searches do not pay for constructing them. If reverse
+  // is true, also builds the reverse DFA, which finds where a match
+  // starts when submatches are requested. Stops after max_states states
+  // per DFA (if max_states > 0) or when a DFA runs out of memory (see
+  // max_mem). If complete is not null, sets *complete to whether every
+  // reachable state was built. Returns the number of states built, or -1
+  // if the RE2 could not be created properly.
+  int WarmDFA(bool reverse, int max_states, bool* complete) const;
+
+  // Builds the DFAs used by unanchored searches (and the reverse DFA if
+  // reverse is true) in full and copies each into a flat transition
+  // table. The DFA phase of a search then runs on the tables without
+  // locking the DFA state cache. Returns false if a DFA has more
+  // than max_states states or runs out of memory; searches on the DFAs
+  // that could not be flattened keep using the lazily built DFA.
+  bool BuildFlatDFA(bool reverse, int max_states) const;
+
+  // Appends a portable encoding of the compiled regexp to out, from which
+  // Deserialize() recreates it without parsing or compiling the pattern:
+  // the program with its one-pass NFA and flat DFA tables (see
+  // BuildFlatDFA), the reverse program if reverse is true, the required
+  // prefix and the capturing group names. The pattern and options are not
+  // included. Must not run concurrently with the first search. Returns
+  // false if the RE2 could not be created properly.
+  bool Serialize(bool reverse, std::string* out) const;
+
+  // Recreates the regexp that Serialize() wrote to data. pattern and
+  // options must be the ones it was created with: they are kept, and the
+  // pattern is parsed only if the parsed form is needed later (Regexp(),
+  // or the reverse program if it was not serialized). Returns NULL if
+  // data is malformed or comes from an incompatible version.
+  static RE2* Deserialize(const StringPiece& pattern, const Options& options,
+                          const StringPiece& data);
+
   // Returns the underlying Regexp; not for general use.
   // Returns entire_regexp_ so that callers don't need
   // to know about prefix_ and prefix_foldcase_.
-  re2::Regexp* Regexp() const { return entire_regexp_; }
+  re2::Regexp* Regexp() const;
 
   /***** The array-based matching interface ******/
 
@@ -568,6 +603,13 @@ class RE2 {
              StringPiece* submatch,
              int nsubmatch) const;
 
+  // Sets matched[i] to Match(texts[i], 0, texts[i].size(), UNANCHORED,
+  // NULL, 0) for each i in [0, n). For many short texts this is much
+  // faster than calling Match in a loop: the DFA is entered once for the
+  // whole batch, and texts are searched in lockstep when the DFA has been
+  // flattened with BuildFlatDFA.
+  void MatchBatch(const StringPiece* texts, size_t n, bool* matched) const;
+
   // Check that the given rewrite string is suitable for use with this
   // regular expression.  It checks that:
   //   * The regular expression has enough parenthesized subexpressions
@@ -609,6 +651,9 @@ class RE2 {
     //   never_capture    (false) parse all parens as non-capturing
     //   case_sensitive   (true)  match is case-sensitive (regexp can override
     //                              with (?i) unless in posix_syntax mode)
+    //   bit_state_max_mem (32 KB) max size of the BitState bitmap
+    //   one_pass_max_text (4096)  max text size for which the DFA is skipped
+    //                               in favour of OnePass
     //
     // The following options are only consulted when posix_syntax == true.
     // When posix_syntax == false, these features are always enabled and
@@ -645,10 +690,28 @@ class RE2 {
     //
     // Once a DFA fills its budget, it flushes its cache and starts over.
     // If this happens too often, RE2 falls back on the NFA implementation.
+    //
+    // Submatches are found by OnePass if the regexp is one-pass, otherwise
+    // by BitState, which backtracks over the text but marks each
+    // (instruction list, text position) pair it visits in a bitmap of
+    // (list count) * (text length) bits, and otherwise by the much slower
+    // NFA. The bit_state_max_mem option bounds that bitmap: once the DFA
+    // has located the match, BitState is used on matches of up to
+    // 8 * bit_state_max_mem / (list count) bytes. The bitmap is allocated
+    // per search and sized to the match, so raising the limit costs memory
+    // only when long matches are found. (Anchored searches skip the DFA
+    // and run BitState on the whole text only while its bitmap stays under
+    // the default 256K bits.)
+    // one_pass_max_text is the size of text below which anchored searches
+    // needing submatches go straight to OnePass without running the DFA.
 
     // For now, make the default budget something close to Code Search.
     static const int kDefaultMaxMem = 8<<20;
 
+    // Defaults for the submatch engine thresholds.
+    static const int kDefaultBitStateMaxMem = 32<<10;  // 256K bits
+    static const int kDefaultOnePassMaxText = 4096;
+
     enum Encoding {
       EncodingUTF8 = 1,
       EncodingLatin1
@@ -667,7 +730,9 @@ class RE2 {
       case_sensitive_(true),
       perl_classes_(false),
       word_boundary_(false),
-      one_line_(false) {
+      one_line_(false),
+      bit_state_max_mem_(kDefaultBitStateMaxMem),
+      one_pass_max_text_(kDefaultOnePassMaxText) {
     }
 
     /*implicit*/ Options(CannedOptions);
@@ -711,6 +776,12 @@ class RE2 {
     bool one_line() const { return one_line_; }
     void set_one_line(bool b) { one_line_ = b; }
 
+    int64_t bit_state_max_mem() const { return bit_state_max_mem_; }
+    void set_bit_state_max_mem(int64_t m) { bit_state_max_mem_ = m; }
+
+    int64_t one_pass_max_text() const { return one_pass_max_text_; }
+    void set_one_pass_max_text(int64_t n) { one_pass_max_text_ = n; }
+
     void Copy(const Options& src) {
       *this = src;
     }
@@ -731,6 +802,8 @@ class RE2 {
     bool perl_classes_;
     bool word_boundary_;
     bool one_line_;
+    int64_t bit_state_max_mem_;
+    int64_t one_pass_max_text_;
   };
 
   // Returns the options set in the constructor.
@@ -745,7 +818,15 @@ class RE2 {
   static Arg Octal(T* ptr);
 
  private:
+  struct NoInit {};
+  explicit RE2(NoInit) {}
+
   void Init(const StringPiece& pattern, const Options& options);
+  // The part of Init() before parsing, shared with Deserialize().
+  void InitFields(const StringPiece& pattern, const Options& options);
+  // Parses the pattern of a deserialized RE2, the first time the parsed
+  // form is needed.
+  void ParsePattern() const;
 
   bool DoMatch(const StringPiece& text,
                Anchor re_anchor,
@@ -757,13 +838,14 @@ class RE2 {
 
   std::string pattern_;         // string regular expression
   Options options_;             // option flags
-  re2::Regexp* entire_regexp_;  // parsed regular expression
+  mutable re2::Regexp* entire_regexp_;  // parsed regular expression
   const std::string* error_;    // error indicator (or points to empty string)
   ErrorCode error_code_;        // error code
   std::string error_arg_;       // fragment of regexp showing error
   std::string prefix_;          // required prefix (before suffix_regexp_)
   bool prefix_foldcase_;        // prefix_ is ASCII case-insensitive
-  re2::Regexp* suffix_regexp_;  // parsed regular expression, prefix_ removed
+  mutable re2::Regexp* suffix_regexp_;  // parsed regular expression,
+                                        // prefix_ removed
   re2::Prog* prog_;             // compiled program for regexp
   int num_captures_;            // number of capturing groups
   bool is_one_pass_;            // can use prog_->SearchOnePass?
@@ -775,6 +857,7 @@ class RE2 {
   // Map from capture indices to names
   mutable const std::map<int, std::string>* group_names_;
 
+  mutable std::once_flag regexp_once_;
   mutable std::once_flag rprog_once_;
   mutable std::once_flag named_groups_once_;
   mutable std::once_flag group_names_once_;